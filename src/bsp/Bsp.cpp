@@ -23,6 +23,12 @@
 #include "LeafNavMeshGenerator.h"
 #include "NavMeshGenerator.h"
 #include "PolyOctree.h"
+#include "StructIndex.h"
+#include "TaskGraph.h"
+#include "TextureCache.h"
+#include <thread>
+#include <atomic>
+#include <array>
 
 typedef map< string, vec3 > mapStringToVector;
 
@@ -33,7 +39,7 @@ vec3 default_hull_extents[MAX_MAP_HULLS] = {
 	vec3(16, 16, 18)	// hull 3
 };
 
-int g_sort_mode = SORT_CLIPNODES;
+thread_local int g_sort_mode = SORT_CLIPNODES;
 
 Bsp::Bsp() {
 	lumps = new byte * [HEADER_LUMPS];
@@ -83,7 +89,7 @@ Bsp::Bsp(const Bsp& other) {
 	valid = true;
 }
 
-Bsp::Bsp(std::string fpath)
+Bsp::Bsp(std::string fpath, bool mapped, bool loadEnts)
 {
 	lumps = NULL;
 
@@ -100,12 +106,13 @@ Bsp::Bsp(std::string fpath)
 		return;
 	}
 
-	if (!load_lumps(fpath)) {
+	if (!(mapped ? load_mapped_lumps(fpath) : load_lumps(fpath))) {
 		logf("%s is not a valid BSP file\n", fpath.c_str());
 		return;
 	}
 
-	load_ents();
+	if (loadEnts)
+		load_ents();
 	update_lump_pointers();
 
 	valid = true;
@@ -116,12 +123,17 @@ Bsp::~Bsp()
 	if (lumps) {
 		for (int i = 0; i < HEADER_LUMPS; i++)
 			if (lumps[i]) {
-				delete[] lumps[i];
+				free_lump(i);
 			}
 		delete[] lumps;
 		lumps = NULL;
 	}
 
+	if (mappedFile) {
+		delete mappedFile;
+		mappedFile = NULL;
+	}
+
 	for (int i = 0; i < ents.size(); i++) {
 		delete ents[i];
 		ents[i] = NULL;
@@ -142,7 +154,7 @@ void Bsp::get_bounding_box(vec3& mins, vec3& maxs) {
 	mins = thisWorld.nMins;
 	maxs = thisWorld.nMaxs;
 
-	if (ents.size() && ents[0]->hasKey("origin")) {
+	if (ents.size() && ents[0]->hasKey(Entity::KEY_ORIGIN)) {
 		vec3 origin = ents[0]->getOrigin();
 		mins += origin;
 		maxs += origin;
@@ -720,8 +732,8 @@ bool Bsp::move(vec3 offset, int modelIdx) {
 			g_progress.tick();
 
 			vec3 ori;
-			if (ents[i]->hasKey("origin")) {
-				ori = parseVector(ents[i]->getKeyvalue("origin"));
+			if (ents[i]->hasKey(Entity::KEY_ORIGIN)) {
+				ori = parseVector(ents[i]->getKeyvalue(Entity::KEY_ORIGIN));
 			}
 			ori += offset;
 
@@ -1165,8 +1177,6 @@ LumpState Bsp::duplicate_lumps(int targets) {
 
 	for (int i = 0; i < HEADER_LUMPS; i++) {
 		if ((targets & (1 << i)) == 0) {
-			state.lumps[i] = NULL;
-			state.lumpLen[i] = 0;
 			continue;
 		}
 
@@ -1174,9 +1184,20 @@ LumpState Bsp::duplicate_lumps(int targets) {
 			update_ent_lump();
 		}
 
-		state.lumps[i] = new byte[header.lump[i].nLength];
-		state.lumpLen[i] = header.lump[i].nLength;
-		memcpy(state.lumps[i], lumps[i], header.lump[i].nLength);
+		int len = header.lump[i].nLength;
+		state.lumpLen[i] = len;
+
+		// lumps can be edited in-place, so a copy can only be shared if the contents still match
+		std::shared_ptr<byte> lastCopy = lumpCopies[i].lock();
+		if (lastCopy && lumpCopyLens[i] == len && memcmp(lastCopy.get(), lumps[i], len) == 0) {
+			state.lumps[i] = lastCopy;
+			continue;
+		}
+
+		state.lumps[i] = std::shared_ptr<byte>(new byte[len], std::default_delete<byte[]>());
+		memcpy(state.lumps[i].get(), lumps[i], len);
+		lumpCopies[i] = state.lumps[i];
+		lumpCopyLens[i] = len;
 	}
 
 	return state;
@@ -1221,10 +1242,12 @@ void Bsp::replace_lumps(LumpState& state) {
 			continue;
 		}
 
-		delete[] lumps[i];
+		free_lump(i);
 		lumps[i] = new byte[state.lumpLen[i]];
-		memcpy(lumps[i], state.lumps[i], state.lumpLen[i]);
+		memcpy(lumps[i], state.lumps[i].get(), state.lumpLen[i]);
 		header.lump[i].nLength = state.lumpLen[i];
+		lumpCopies[i] = state.lumps[i];
+		lumpCopyLens[i] = state.lumpLen[i];
 
 		if (i == LUMP_ENTITIES) {
 			load_ents();
@@ -1234,6 +1257,46 @@ void Bsp::replace_lumps(LumpState& state) {
 	update_lump_pointers();
 }
 
+bool Bsp::apply_lump_deltas(LumpDelta* deltas, bool reverse) {
+	byte* newLumps[HEADER_LUMPS] = { NULL };
+	int newLens[HEADER_LUMPS] = { 0 };
+
+	// build every new lump before replacing any, so a mismatch leaves the map untouched
+	for (int i = 0; i < HEADER_LUMPS; i++) {
+		if (deltas[i].isEmpty()) {
+			continue;
+		}
+
+		if (i == LUMP_ENTITIES) {
+			update_ent_lump();
+		}
+
+		newLumps[i] = deltas[i].apply(lumps[i], header.lump[i].nLength, reverse, newLens[i]);
+		if (!newLumps[i]) {
+			logf("Failed to %s %s lump. The map doesn't match the undo history.\n", reverse ? "undo" : "redo", g_lump_names[i]);
+
+			for (int k = 0; k < i; k++) {
+				delete[] newLumps[k];
+			}
+			return false;
+		}
+	}
+
+	for (int i = 0; i < HEADER_LUMPS; i++) {
+		if (!newLumps[i]) {
+			continue;
+		}
+
+		replace_lump(i, newLumps[i], newLens[i]);
+
+		if (i == LUMP_ENTITIES) {
+			load_ents();
+		}
+	}
+
+	return true;
+}
+
 int Bsp::remove_unused_structs(int lumpIdx, bool* usedStructs, int* remappedIndexes) {
 	int structSize = 0;
 
@@ -1448,7 +1511,7 @@ int Bsp::remove_unused_visdata(STRUCTREMAP* remap, BSPLEAF* oldLeaves, int oldLe
 	return oldVisLength - newVisLen;
 }
 
-STRUCTCOUNT Bsp::remove_unused_model_structures(bool deleteModels) {
+STRUCTCOUNT Bsp::remove_unused_model_structures(bool deleteModels, bool printTiming) {
 	int oldVisLeafCount = 0;
 	count_leaves(models[0].iHeadnodes[0], oldVisLeafCount);
 	//oldVisLeafCount = models[0].nVisLeafs;
@@ -1467,14 +1530,13 @@ STRUCTCOUNT Bsp::remove_unused_model_structures(bool deleteModels) {
 	}
 
 	int deletedModels = 0;
-	// reversed so models can be deleted without shifting the next delete index
- 	for (int i = modelCount-1; i >= 0; i--) { 
-		if (!usedModels[i] && deleteModels) {
-			delete_model(i);
-			deletedModels++;
-		}
-		else {
-			mark_model_structures(i, &usedStructures, false);
+	if (deleteModels) {
+		// reversed so models can be deleted without shifting the next delete index
+		for (int i = modelCount - 1; i >= 0; i--) {
+			if (!usedModels[i]) {
+				delete_model(i);
+				deletedModels++;
+			}
 		}
 	}
 
@@ -1484,27 +1546,46 @@ STRUCTCOUNT Bsp::remove_unused_model_structures(bool deleteModels) {
 	STRUCTCOUNT removeCount;
 	memset(&removeCount, 0, sizeof(STRUCTCOUNT));
 
-	usedStructures.edges[0] = true; // first edge is never used but maps break without it?
-
 	byte* oldLeaves = new byte[header.lump[LUMP_LEAVES].nLength];
 	memcpy(oldLeaves, lumps[LUMP_LEAVES], header.lump[LUMP_LEAVES].nLength);
 
+	int threadCount = getJobThreadCount();
+
+	// Each compaction task replaces its own lump and only reads the usage arrays, so they can run at
+	// the same time once marking is done. Lightmap sizes are calculated from face geometry, so the
+	// lumps that faces use are compacted after the lightmaps.
+	TaskGraph tasks;
+	int mark = tasks.add("mark", [&] {
+		mark_all_model_structures(&usedStructures, threadCount);
+		usedStructures.edges[0] = true; // first edge is never used but maps break without it?
+	});
+
+	int lighting = -1;
 	if (lightDataLength) {
-		removeCount.lightstyles = remove_unused_lightstyles();
-		removeCount.lightdata = remove_unused_lightmaps(usedStructures.faces);
-	}
-
-	removeCount.planes = remove_unused_structs(LUMP_PLANES, usedStructures.planes, remap.planes);
-	removeCount.clipnodes = remove_unused_structs(LUMP_CLIPNODES, usedStructures.clipnodes, remap.clipnodes);
-	removeCount.nodes = remove_unused_structs(LUMP_NODES, usedStructures.nodes, remap.nodes);
-	removeCount.leaves = remove_unused_structs(LUMP_LEAVES, usedStructures.leaves, remap.leaves);
-	removeCount.markSurfs = remove_unused_structs(LUMP_MARKSURFACES, usedStructures.markSurfs, remap.markSurfs);
-	removeCount.faces = remove_unused_structs(LUMP_FACES, usedStructures.faces, remap.faces);
-	removeCount.surfEdges = remove_unused_structs(LUMP_SURFEDGES, usedStructures.surfEdges, remap.surfEdges);
-	removeCount.texInfos = remove_unused_structs(LUMP_TEXINFO, usedStructures.texInfo, remap.texInfo);
-	removeCount.edges = remove_unused_structs(LUMP_EDGES, usedStructures.edges, remap.edges);
-	removeCount.verts = remove_unused_structs(LUMP_VERTICES, usedStructures.verts, remap.verts);
-	removeCount.textures = remove_unused_textures(usedStructures.textures, remap.textures);
+		lighting = tasks.add("lightmaps", [&] {
+			removeCount.lightstyles = remove_unused_lightstyles();
+			removeCount.lightdata = remove_unused_lightmaps(usedStructures.faces);
+		}, { mark });
+	}
+
+	tasks.add("planes", [&] { removeCount.planes = remove_unused_structs(LUMP_PLANES, usedStructures.planes, remap.planes); }, { mark });
+	tasks.add("clipnodes", [&] { removeCount.clipnodes = remove_unused_structs(LUMP_CLIPNODES, usedStructures.clipnodes, remap.clipnodes); }, { mark });
+	tasks.add("nodes", [&] { removeCount.nodes = remove_unused_structs(LUMP_NODES, usedStructures.nodes, remap.nodes); }, { mark });
+	tasks.add("leaves", [&] { removeCount.leaves = remove_unused_structs(LUMP_LEAVES, usedStructures.leaves, remap.leaves); }, { mark });
+	tasks.add("marksurfaces", [&] { removeCount.markSurfs = remove_unused_structs(LUMP_MARKSURFACES, usedStructures.markSurfs, remap.markSurfs); }, { mark });
+	tasks.add("faces", [&] { removeCount.faces = remove_unused_structs(LUMP_FACES, usedStructures.faces, remap.faces); }, { mark, lighting });
+	tasks.add("surfedges", [&] { removeCount.surfEdges = remove_unused_structs(LUMP_SURFEDGES, usedStructures.surfEdges, remap.surfEdges); }, { mark, lighting });
+	tasks.add("texinfo", [&] { removeCount.texInfos = remove_unused_structs(LUMP_TEXINFO, usedStructures.texInfo, remap.texInfo); }, { mark, lighting });
+	tasks.add("edges", [&] { removeCount.edges = remove_unused_structs(LUMP_EDGES, usedStructures.edges, remap.edges); }, { mark, lighting });
+	tasks.add("vertices", [&] { removeCount.verts = remove_unused_structs(LUMP_VERTICES, usedStructures.verts, remap.verts); }, { mark, lighting });
+	tasks.add("textures", [&] { removeCount.textures = remove_unused_textures(usedStructures.textures, remap.textures); }, { mark });
+
+	tasks.run(threadCount);
+
+	if (printTiming) {
+		tasks.print_timing();
+	}
+
 	removeCount.models = deletedModels;
 
 	STRUCTCOUNT newCounts(this);
@@ -1573,6 +1654,7 @@ STRUCTCOUNT Bsp::remove_unused_model_structures(bool deleteModels) {
 			int newIndex = remap.texInfo[oldIndex];
 
 			// from VHLT loadtextures.cpp
+			textureIndex.clear();
 			tex->szName[5] = '0' + (newIndex / 10000) % 10; // store the original texinfo
 			tex->szName[6] = '0' + (newIndex / 1000) % 10;
 			tex->szName[7] = '0' + (newIndex / 100) % 10;
@@ -1737,7 +1819,7 @@ STRUCTCOUNT Bsp::delete_unused_hulls(bool noProgress) {
 		for (int k = 0; k < usageEnts.size(); k++) {
 			string cname = usageEnts[k]->getClassname();
 			string tname = usageEnts[k]->getTargetname();
-			int spawnflags = atoi(usageEnts[k]->getKeyvalue("spawnflags").c_str());
+			int spawnflags = atoi(usageEnts[k]->getKeyvalue(Entity::KEY_SPAWNFLAGS).c_str());
 
 			if (k != 0) {
 				uses += ", ";
@@ -2427,7 +2509,7 @@ void Bsp::delete_box_data(vec3 clipMins, vec3 clipMaxs) {
 			}
 		}
 		else {
-			bool isCullEnt = ents[i]->hasKey("classname") && ents[i]->getClassname() == "cull";
+			bool isCullEnt = ents[i]->hasKey(Entity::KEY_CLASSNAME) && ents[i]->getClassname() == "cull";
 			if (!pointInBox(v, clipMins, clipMaxs) || isCullEnt) {
 				newEnts.push_back(ents[i]);
 			}
@@ -2591,6 +2673,41 @@ int Bsp::deduplicate_models(bool allowTextureShift, bool dryrun) {
 
 	map<int, ModelIdxRemap> modelRemap;
 
+	// textures only need to match if the model is used by an entity that can be seen
+	vector<bool> modelVisible(modelCount);
+	EntityIndex& entIndex = get_ent_index();
+	for (int i = 1; i < modelCount; i++) {
+		for (int entIdx : entIndex.findModel(i)) {
+			if (ents[entIdx]->isEverVisible()) {
+				modelVisible[i] = true;
+				break;
+			}
+		}
+	}
+
+	// Similar models have the same face count and sizes within epsilon of each other, so models
+	// are bucketed by face count and size rounded down to a multiple of epsilon. A similar model
+	// is always in the same bucket or a neighboring one.
+	vector<vec3> modelMins(modelCount);
+	vector<vec3> modelMaxs(modelCount);
+	vector<array<int, 3>> sizeCells(modelCount);
+	unordered_map<uint64_t, vector<int>> buckets;
+
+	auto bucket_key = [](int nFaces, int x, int y, int z) {
+		int key[4] = { nFaces, x, y, z };
+		return hashBytes(key, sizeof(key));
+	};
+
+	for (int i = 1; i < modelCount; i++) {
+		if (models[i].nFaces == 0)
+			continue;
+
+		get_model_vertex_bounds(i, modelMins[i], modelMaxs[i]);
+		vec3 size = modelMaxs[i] - modelMins[i];
+		sizeCells[i] = { (int)floorf(size.x / epsilon), (int)floorf(size.y / epsilon), (int)floorf(size.z / epsilon) };
+		buckets[bucket_key(models[i].nFaces, sizeCells[i][0], sizeCells[i][1], sizeCells[i][2])].push_back(i);
+	}
+
 	for (int i = 1; i < modelCount; i++) {
 		BSPMODEL& modelA = models[i];
 
@@ -2601,19 +2718,21 @@ int Bsp::deduplicate_models(bool allowTextureShift, bool dryrun) {
 			continue;
 		}
 
-		bool shouldCompareTextures = false;
-		string modelKeyA = "*" + to_string(i);
-
-		for (Entity* ent : ents) {
-			if (ent->hasKey("model") && ent->getKeyvalue("model") == modelKeyA) {
-				if (ent->isEverVisible()) {
-					shouldCompareTextures = true;
-					break;
+		vector<int> candidates;
+		array<int, 3>& cell = sizeCells[i];
+		for (int x = -1; x <= 1; x++) {
+			for (int y = -1; y <= 1; y++) {
+				for (int z = -1; z <= 1; z++) {
+					auto bucket = buckets.find(bucket_key(modelA.nFaces, cell[0] + x, cell[1] + y, cell[2] + z));
+					if (bucket != buckets.end()) {
+						candidates.insert(candidates.end(), bucket->second.begin(), bucket->second.end());
+					}
 				}
 			}
 		}
+		sort(candidates.begin(), candidates.end());
 
-		for (int k = 1; k < modelCount; k++) {
+		for (int k : candidates) {
 			if (i == k)
 				continue;
 
@@ -2622,29 +2741,17 @@ int Bsp::deduplicate_models(bool allowTextureShift, bool dryrun) {
 			if (modelA.nFaces != modelB.nFaces)
 				continue;
 
-			vec3 minsA, maxsA, minsB, maxsB;
-			get_model_vertex_bounds(i, minsA, maxsA);
-			get_model_vertex_bounds(k, minsB, maxsB);
+			vec3& minsA = modelMins[i];
+			vec3& minsB = modelMins[k];
 
-			vec3 sizeA = maxsA - minsA;
-			vec3 sizeB = maxsB - minsB;
+			vec3 sizeA = modelMaxs[i] - minsA;
+			vec3 sizeB = modelMaxs[k] - minsB;
 
 			if ((sizeB - sizeA).length() > epsilon) {
 				continue;
 			}
 
-			if (!shouldCompareTextures) {
-				string modelKeyB = "*" + to_string(k);
-
-				for (Entity* ent : ents) {
-					if (ent->hasKey("model") && ent->getKeyvalue("model") == modelKeyB) {
-						if (ent->isEverVisible()) {
-							shouldCompareTextures = true;
-							break;
-						}
-					}
-				}
-			}
+			bool shouldCompareTextures = modelVisible[i] || modelVisible[k];
 
 			bool similarFaces = true;
 			for (int fa = 0; fa < modelA.nFaces; fa++) {
@@ -2773,13 +2880,13 @@ int Bsp::deduplicate_models(bool allowTextureShift, bool dryrun) {
 	unordered_set<int> newUniqueModels;
 
 	for (Entity* ent : ents) {
-		if (!ent->hasKey("model")) {
+		if (!ent->hasKey(Entity::KEY_MODEL)) {
 			continue;
 		}
 		if (ent->hidden)
 			continue;
 
-		string model = ent->getKeyvalue("model");
+		string model = ent->getKeyvalue(Entity::KEY_MODEL);
 
 		if (model[0] != '*')
 			continue;
@@ -3567,11 +3674,65 @@ int Bsp::get_default_texture_idx() {
 }
 
 bool Bsp::downscale_texture(int textureId, int newWidth, int newHeight, int resampleMode) {
+	RESAMPLED_TEXTURE resampled;
+	if (!resample_texture(textureId, newWidth, newHeight, resampleMode, resampled)) {
+		return false;
+	}
+
+	return apply_resampled_texture(textureId, resampled);
+}
+
+bool Bsp::resample_texture(int textureId, int newWidth, int newHeight, int resampleMode, RESAMPLED_TEXTURE& out,
+	int threadCount) {
 	if ((newWidth % 16 != 0) || (newHeight % 16 != 0) || newWidth <= 0 || newHeight <= 0) {
 		logf("Invalid downscale dimensions: %dx%d\n", newWidth, newHeight);
 		return false;
 	}
 
+	BSPMIPTEX* tex = get_texture(textureId);
+	if (!tex || tex->nOffsets[0] == 0) {
+		return false;
+	}
+
+	int32_t texOffset = ((int32_t*)textures)[textureId + 1];
+
+	int oldWidth = tex->nWidth;
+	int oldHeight = tex->nHeight;
+
+	int lastMipSize = (oldWidth >> 3) * (oldHeight >> 3);
+	byte* palette = (byte*)(textures + texOffset + tex->nOffsets[3] + lastMipSize);
+	COLOR3* paletteColors = (COLOR3*)(palette + 2); // skip color count
+
+	byte* srcPixels = (byte*)(textures + texOffset + tex->nOffsets[0]);
+	COLOR3* srcColors = new COLOR3[oldWidth * oldHeight];
+	for (int i = 0; i < oldWidth * oldHeight; i++) {
+		srcColors[i] = paletteColors[srcPixels[i]];
+	}
+
+	COLOR3* dstColors = new COLOR3[newWidth * newHeight];
+	vector<COLOR3> newColors = Texture::resample(srcColors, oldWidth, oldHeight, dstColors,
+		newWidth, newHeight, resampleMode, tex->szName[0] == '{', paletteColors[255], threadCount);
+	delete[] srcColors;
+
+	if (newColors.empty()) {
+		for (int i = newColors.size(); i < 256; i++) {
+			newColors.push_back(paletteColors[i]);
+		}
+	}
+
+	// convert pixels to palette indexes
+	out.width = newWidth;
+	out.height = newHeight;
+	out.pixels.resize(newWidth * newHeight);
+	out.palette = newColors;
+	PaletteLookup lookup(&newColors[0], newColors.size());
+	lookup.findAll(dstColors, &out.pixels[0], newWidth * newHeight);
+	delete[] dstColors;
+
+	return true;
+}
+
+bool Bsp::apply_resampled_texture(int textureId, const RESAMPLED_TEXTURE& resampled) {
 	BSPMIPTEX* tex = get_texture(textureId);
 	if (!tex) {
 		return false;
@@ -3581,14 +3742,14 @@ bool Bsp::downscale_texture(int textureId, int newWidth, int newHeight, int resa
 
 	int oldWidth = tex->nWidth;
 	int oldHeight = tex->nHeight;
+	int newWidth = resampled.width;
+	int newHeight = resampled.height;
 
 	tex->nWidth = newWidth;
 	tex->nHeight = newHeight;
 
 	int lastMipSize = (oldWidth >> 3) * (oldHeight >> 3);
-	byte* pixels = (byte*)(textures + texOffset + tex->nOffsets[0]);
 	byte* palette = (byte*)(textures + texOffset + tex->nOffsets[3] + lastMipSize);
-	COLOR3* paletteColors = (COLOR3*)(palette + 2); // skip color count
 
 	int newWidths[4];
 	int newHeights[4];
@@ -3605,36 +3766,9 @@ bool Bsp::downscale_texture(int textureId, int newWidth, int newHeight, int resa
 		}
 	}
 
-	float srcScaleX = (float)oldWidth / tex->nWidth;
-	float srcScaleY = (float)oldHeight / tex->nHeight;
-
-	byte* srcPixels = (byte*)(textures + texOffset + tex->nOffsets[0]);
-	COLOR3* srcColors = new COLOR3[oldWidth * oldHeight];
-	for (int i = 0; i < oldWidth * oldHeight; i++) {
-		srcColors[i] = paletteColors[srcPixels[i]];
-	}
-
-	COLOR3* dstColors = new COLOR3[newWidth * newHeight];
-	vector<COLOR3> newColors = Texture::resample(srcColors, oldWidth, oldHeight, dstColors,
-		newWidth, newHeight, resampleMode, tex->szName[0] == '{', paletteColors[255]);
-
-	if (newColors.empty()) {
-		for (int i = newColors.size(); i < 256; i++) {
-			newColors.push_back(paletteColors[i]);
-		}
-	}
-
-	// convert pixels to palette indexes
+	// the new mip0 is smaller than the old one, so it fits where the old one started
 	byte* mip0 = (byte*)(textures + texOffset + newOffset[0]);
-	for (int i = 0; i < newWidth * newHeight; i++) {
-		for (int k = 0; k < newColors.size(); k++) {
-			if (newColors[k] == dstColors[i]) {
-				mip0[i] = k;
-				break;
-			}
-		}
-	}
-	delete[] dstColors;
+	memcpy(mip0, &resampled.pixels[0], newWidth * newHeight);
 
 	// nearest neighbor mipmap resize
 	byte* srcData = (byte*)(textures + texOffset + newOffset[0]);
@@ -3654,7 +3788,7 @@ bool Bsp::downscale_texture(int textureId, int newWidth, int newHeight, int resa
 	byte* newPalette = (byte*)(textures + texOffset + newOffset[3] + newWidths[3] * newHeights[3]);
 	memcpy(newPalette, palette, 2);
 	memset(newPalette + 2, 0, sizeof(COLOR3) * 256);
-	memcpy(newPalette + 2, &newColors[0], sizeof(COLOR3) * newColors.size());
+	memcpy(newPalette + 2, &resampled.palette[0], sizeof(COLOR3) * resampled.palette.size());
 
 	for (int i = 0; i < 4; i++) {
 		tex->nOffsets[i] = newOffset[i];
@@ -3899,9 +4033,8 @@ bool Bsp::embed_texture(int textureId, vector<Wad*>& wads) {
 
 	bool embedded = false;
 	for (int k = 0; k < wads.size(); k++) {
-		if (wads[k]->hasTexture(tex->szName)) {
-			WADTEX* wadTex = wads[k]->readTexture(tex->szName);
-
+		WADTEX* wadTex = wads[k]->readTexture(tex->szName);
+		if (wadTex) {
 			if (tex->nHeight != wadTex->nHeight || tex->nWidth != wadTex->nWidth) {
 				logf("Failed to embed texture %s from wad %s (dimensions don't match)\n", tex->szName, wads[k]->filename.c_str());
 				delete wadTex;
@@ -3936,7 +4069,7 @@ bool Bsp::embed_texture(int textureId, vector<Wad*>& wads) {
 			logf("Embedded texture %s from wad %s\n", tex->szName, wads[k]->filename.c_str());
 
 			delete wadTex;
-			delete[] lumps[LUMP_TEXTURES];
+			free_lump(LUMP_TEXTURES);
 			lumps[LUMP_TEXTURES] = newTexData;
 			header.lump[LUMP_TEXTURES].nLength += texDataSz;
 			update_lump_pointers();
@@ -3978,20 +4111,18 @@ int Bsp::unembed_texture(int textureId, vector<Wad*>& wads, bool force, bool qui
 	bool wasResized = false;
 	bool isInWad = false;
 	for (int k = 0; k < wads.size(); k++) {
-		if (wads[k]->hasTexture(tex->szName)) {
-			WADTEX* wadTex = wads[k]->readTexture(tex->szName);
-
-			if (tex->nWidth != wadTex->nWidth || tex->nHeight != wadTex->nHeight) {
+		WADTEX wadTex;
+		if (wads[k]->viewTexture(wads[k]->findTexture(tex->szName), wadTex)) {
+			if (tex->nWidth != wadTex.nWidth || tex->nHeight != wadTex.nHeight) {
 				int oldWidth = tex->nWidth;
 				int oldHeight = tex->nHeight;
-				tex->nWidth = wadTex->nWidth;
-				tex->nHeight = wadTex->nHeight;
+				tex->nWidth = wadTex.nWidth;
+				tex->nHeight = wadTex.nHeight;
 				adjust_resized_texture_coordinates(textureId, oldWidth, oldHeight);
 				wasResized = true;
 			}
 
 			isInWad = true;
-			delete wadTex;
 			break;
 		}
 	}
@@ -4018,7 +4149,7 @@ int Bsp::unembed_texture(int textureId, vector<Wad*>& wads, bool force, bool qui
 
 	if (!quiet)
 		logf("Unembedded texture %s\n", tex->szName);
-	delete[] lumps[LUMP_TEXTURES];
+	free_lump(LUMP_TEXTURES);
 	lumps[LUMP_TEXTURES] = newTexData;
 	header.lump[LUMP_TEXTURES].nLength -= texDataSz;
 	update_lump_pointers();
@@ -4065,7 +4196,7 @@ int Bsp::add_texture_from_wad(WADTEX* tex) {
 
 	memcpy(dstData, &newTex, sizeof(BSPMIPTEX));
 
-	delete[] lumps[LUMP_TEXTURES];
+	free_lump(LUMP_TEXTURES);
 	lumps[LUMP_TEXTURES] = newTexData;
 	header.lump[LUMP_TEXTURES].nLength += addedSz;
 	update_lump_pointers();
@@ -4092,7 +4223,7 @@ WADTEX Bsp::load_texture(int textureIdx) {
 
 	if (tex->nOffsets[0] != 0) {
 		// embedded texture
-		memcpy(out.data, ((byte*)&tex) + tex->nOffsets[0], sz);
+		memcpy(out.data, ((byte*)tex) + tex->nOffsets[0], sz);
 	}
 	else {
 		// try loading from WAD
@@ -4102,25 +4233,22 @@ WADTEX Bsp::load_texture(int textureIdx) {
 		bool foundTex = false;
 
 		for (int k = 0; k < wads.size(); k++) {
-			if (wads[k]->hasTexture(tex->szName)) {
-				
-				WADTEX* wadtex = wads[k]->readTexture(tex->szName);
-
+			int dirIndex = wads[k]->findTexture(tex->szName);
+			if (dirIndex != -1) {
+				std::shared_ptr<const CachedTexture> wadtex = g_textureCache.get(wads[k], dirIndex);
 				if (!wadtex) {
-					logf("Failed to read texture %s from WAD: %s\n", wads[k]->filename.c_str());
+					logf("Failed to read texture %s from WAD: %s\n", tex->szName, wads[k]->filename.c_str());
 					continue;
 				}
 
-				if (wadtex->nHeight != out.nHeight || wadtex->nWidth != out.nWidth) {
+				if (wadtex->tex.nHeight != out.nHeight || wadtex->tex.nWidth != out.nWidth) {
 					debugf("Not using texture %s from wad because dimensions don't match: %s\n",
 						tex->szName, wads[k]->filename.c_str());
-					delete wadtex;
 					continue;
 				}
 
-				memcpy(&out, wadtex, sizeof(BSPMIPTEX));
-				memcpy(out.data, wadtex->data, sz);
-				delete wadtex;
+				memcpy(&out, &wadtex->tex, sizeof(BSPMIPTEX));
+				memcpy(out.data, wadtex->tex.data, sz);
 				foundTex = true;
 				break;
 			}
@@ -4143,6 +4271,7 @@ bool Bsp::replace_texture(int textureIdx, WADTEX& newtex) {
 
 	memcpy(newtex.szName, tex->szName, MAXTEXTURENAME);
 	tex->szName[0] = 0;
+	textureIndex.clear();
 
 	int newIdx = add_texture(newtex);
 
@@ -4216,6 +4345,8 @@ void Bsp::adjust_resized_texture_coordinates(int textureId, int oldWidth, int ol
 
 int Bsp::downscale_invalid_textures(vector<Wad*>& wads) {
 	int count = 0;
+	vector<int> textureIds;
+	vector<RESAMPLED_TEXTURE> resampled;
 
 	for (int i = 0; i < textureCount; i++) {
 		BSPMIPTEX* tex = get_texture(i);
@@ -4260,9 +4391,36 @@ int Bsp::downscale_invalid_textures(vector<Wad*>& wads) {
 				}
 			}
 
-			downscale_texture(i, newWidth, newHeight, KernelTypeLanczos3);
-			count++;
+			RESAMPLED_TEXTURE dims;
+			dims.width = newWidth;
+			dims.height = newHeight;
+			textureIds.push_back(i);
+			resampled.push_back(dims);
+		}
+	}
+
+	// Textures are resampled in parallel, since that only reads the texture lump. Resizing moves
+	// the textures that come after, so the results are written back one at a time.
+	// The threads are split between the textures, so quantizing doesn't start more threads of its own
+	// unless there are fewer textures than threads.
+	int threadCount = getJobThreadCount();
+	int quantizeThreads = std::max(1, threadCount / std::max(1, (int)textureIds.size()));
+	vector<char> resampledOk(textureIds.size(), 0);
+	TaskGraph tasks;
+	for (int i = 0; i < textureIds.size(); i++) {
+		tasks.add("resample", [this, i, quantizeThreads, &textureIds, &resampled, &resampledOk] {
+			RESAMPLED_TEXTURE& tex = resampled[i];
+			resampledOk[i] = resample_texture(textureIds[i], tex.width, tex.height, KernelTypeLanczos3, tex,
+				quantizeThreads);
+		});
+	}
+	tasks.run(threadCount);
+
+	for (int i = 0; i < textureIds.size(); i++) {
+		if (resampledOk[i]) {
+			apply_resampled_texture(textureIds[i], resampled[i]);
 		}
+		count++;
 	}
 
 	logf("Downscaled %d textures\n", count);
@@ -4284,6 +4442,7 @@ bool Bsp::rename_texture(const char* oldName, const char* newName) {
 		
 		if (!strncmp(tex->szName, oldName, 16)) {
 			strncpy(tex->szName, newName, 16);
+			textureIndex.clear();
 			logf("Renamed texture '%s' -> '%s'\n", oldName, newName);
 			return true;
 		}
@@ -4453,31 +4612,31 @@ bool Bsp::is_invisible_solid(Entity* ent) {
 			return false; // assume it will affect the brush since it can be moved anywhere
 		}
 		else if (cname == "env_render_individual") {
-			if (ents[i]->getKeyvalue("target") == tname) {
+			if (ents[i]->getKeyvalue(Entity::KEY_TARGET) == tname) {
 				return false; // assume it's making the ent visible
 			}
 		}
 		else if (cname == "trigger_changevalue") {
-			if (ents[i]->getKeyvalue("target") == tname) {
+			if (ents[i]->getKeyvalue(Entity::KEY_TARGET) == tname) {
 				if (renderKeys.find(ents[i]->getKeyvalue("m_iszValueName")) != renderKeys.end()) {
 					return false; // assume it's making the ent visible
 				}
 			}
 		}
 		else if (cname == "trigger_copyvalue") {
-			if (ents[i]->getKeyvalue("target") == tname) {
+			if (ents[i]->getKeyvalue(Entity::KEY_TARGET) == tname) {
 				if (renderKeys.find(ents[i]->getKeyvalue("m_iszDstValueName")) != renderKeys.end()) {
 					return false; // assume it's making the ent visible
 				}
 			}
 		}
 		else if (cname == "trigger_createentity") {
-			if (ents[i]->getKeyvalue("+model") == tname || ents[i]->getKeyvalue("-model") == ent->getKeyvalue("model")) {
+			if (ents[i]->getKeyvalue("+model") == tname || ents[i]->getKeyvalue("-model") == ent->getKeyvalue(Entity::KEY_MODEL)) {
 				return false; // assume this new ent will be visible at some point
 			}
 		}
 		else if (cname == "trigger_changemodel") {
-			if (ents[i]->getKeyvalue("model") == ent->getKeyvalue("model")) {
+			if (ents[i]->getKeyvalue(Entity::KEY_MODEL) == ent->getKeyvalue(Entity::KEY_MODEL)) {
 				return false; // assume the target is visible
 			}
 		}
@@ -4552,7 +4711,10 @@ void Bsp::get_lightmap_shift(const LIGHTMAP& oldLightmap, const LIGHTMAP& newLig
 }
 
 void Bsp::update_ent_lump(bool stripNodes) {
-	stringstream ent_data;
+	// entity text is cached until an entity is edited, so most of it is copied as-is
+	vector<const string*> entTexts(ents.size(), NULL); // NULL for stripped entities
+	size_t len = 0;
+	int writeCount = 0;
 
 	for (int i = 0; i < ents.size(); i++) {
 		if (stripNodes) {
@@ -4562,26 +4724,34 @@ void Bsp::update_ent_lump(bool stripNodes) {
 			}
 		}
 
-		ent_data << "{\n";
+		entTexts[i] = &ents[i]->getLumpText();
+		len += entTexts[i]->size();
+		writeCount++;
+	}
+	len += max(writeCount - 1, 0) + 1; // newlines between entities and null terminator
+
+	byte* newEntData = new byte[len];
+	byte* writePtr = newEntData;
 
-		for (int k = 0; k < ents[i]->keyOrder.size(); k++) {
-			string key = ents[i]->keyOrder[k];
-			ent_data << "\"" << key << "\" \"" << ents[i]->getKeyvalue(key) << "\"\n";
+	bool first = true;
+	for (int i = 0; i < ents.size(); i++) {
+		if (!entTexts[i]) {
+			continue;
 		}
 
-		ent_data << "}";
-		if (i < ents.size() - 1) {
-			ent_data << "\n"; // trailing newline crashes sven, and only sven, and only sometimes
+		// newlines only go between entities. A trailing newline crashes sven, and only sven, and only sometimes
+		if (!first) {
+			*writePtr++ = '\n';
 		}
-	}
+		first = false;
 
-	string str_data = ent_data.str();
+		memcpy(writePtr, entTexts[i]->c_str(), entTexts[i]->size());
+		writePtr += entTexts[i]->size();
+	}
 
-	byte* newEntData = new byte[str_data.size() + 1];
-	memcpy(newEntData, str_data.c_str(), str_data.size());
-	newEntData[str_data.size()] = 0; // null terminator required too(?)
+	*writePtr++ = 0; // null terminator required too(?)
 
-	replace_lump(LUMP_ENTITIES, newEntData, str_data.size()+1);	
+	replace_lump(LUMP_ENTITIES, newEntData, writePtr - newEntData);
 }
 
 vec3 Bsp::get_model_center(int modelIdx) {
@@ -4811,6 +4981,9 @@ void Bsp::write(string path) {
 		offset += header.lump[i].nLength;
 	}
 
+	// the output may be the mapped source file, which can't be truncated while lumps still point into it
+	materialize_lumps();
+
 	ofstream file(path, ios::out | ios::binary | ios::trunc);
 	if (!file.is_open()) {
 		logf("Failed to open BSP file for writing:\n%s\n", path.c_str());
@@ -4876,25 +5049,126 @@ bool Bsp::load_lumps(string fpath)
 	return valid;
 }
 
+bool Bsp::load_mapped_lumps(string fpath)
+{
+	mappedFile = new MappedFile();
+	if (!mappedFile->open(fpath)) {
+		// fall back to reading the whole file (e.g. mapping not supported by the filesystem)
+		delete mappedFile;
+		mappedFile = NULL;
+		return load_lumps(fpath);
+	}
+
+	byte* fileData = mappedFile->data();
+	size_t size = mappedFile->size();
+
+	if (size < sizeof(BSPHEADER) + sizeof(BSPLUMP)*HEADER_LUMPS)
+		return false;
+
+	memcpy(&header, fileData, sizeof(BSPHEADER));
+	debugf("Bsp version: %d\n", header.nVersion);
+
+	lumps = new byte*[HEADER_LUMPS];
+	memset(lumps, 0, sizeof(byte*)*HEADER_LUMPS);
+
+	bool valid = true;
+
+	for (int i = 0; i < HEADER_LUMPS; i++)
+	{
+		BSPLUMP& lump = header.lump[i];
+		debugf("Read lump id: %d. Len: %d. Offset %d.\n", i, lump.nLength, lump.nOffset);
+
+		if (lump.nLength == 0) {
+			lumps[i] = NULL;
+			continue;
+		}
+
+		if (lump.nOffset < 0 || lump.nLength < 0 || (size_t)lump.nOffset + (size_t)lump.nLength > size) {
+			logf("FAILED TO READ BSP LUMP %d\n", i);
+			valid = false;
+			continue;
+		}
+
+		if (lump.nOffset % 4 != 0) {
+			// structs are accessed directly through the lump pointers, so keep them aligned
+			lumps[i] = new byte[lump.nLength];
+			memcpy(lumps[i], fileData + lump.nOffset, lump.nLength);
+		}
+		else {
+			// The mapping is copy-on-write, so in-place edits only copy the touched pages.
+			// replace_lump/append_lump move the lump into owned memory.
+			lumps[i] = fileData + lump.nOffset;
+		}
+	}
+
+	return valid;
+}
+
+bool Bsp::is_lump_mapped(int lumpIdx) {
+	return mappedFile && lumps[lumpIdx] && mappedFile->contains(lumps[lumpIdx]);
+}
+
+void Bsp::free_lump(int lumpIdx) {
+	if (!is_lump_mapped(lumpIdx)) {
+		delete[] lumps[lumpIdx];
+	}
+	lumps[lumpIdx] = NULL;
+
+	if (lumpIdx == LUMP_TEXTURES) {
+		textureIndex.clear();
+	}
+	if (lumpIdx == LUMP_VISIBILITY || lumpIdx == LUMP_LEAVES) {
+		pvsCache.clear();
+	}
+}
+
+void Bsp::materialize_lumps() {
+	if (!mappedFile) {
+		return;
+	}
+
+	for (int i = 0; i < HEADER_LUMPS; i++) {
+		if (!is_lump_mapped(i)) {
+			continue;
+		}
+
+		byte* ownedLump = new byte[header.lump[i].nLength];
+		memcpy(ownedLump, lumps[i], header.lump[i].nLength);
+		lumps[i] = ownedLump;
+	}
+
+	delete mappedFile;
+	mappedFile = NULL;
+	textureIndex.clear();
+	pvsCache.clear();
+
+	update_lump_pointers();
+}
+
 void Bsp::load_ents()
 {
 	for (int i = 0; i < ents.size(); i++)
 		delete ents[i];
 	ents.clear();
+	entsLoaded = true;
 
-	bool verbose = true;
-	membuf sbuf((char*)lumps[LUMP_ENTITIES], header.lump[LUMP_ENTITIES].nLength);
-	istream in(&sbuf);
+	const char* dat = (const char*)lumps[LUMP_ENTITIES];
+	int len = header.lump[LUMP_ENTITIES].nLength;
 
 	int lineNum = 0;
 	int lastBracket = -1;
 	Entity* ent = NULL;
 
-	string line = "";
-	while (getline(in, line))
+	string key, value;
+	for (int lineStart = 0; lineStart < len; )
 	{
+		const char* line = dat + lineStart;
+		const char* lineEnd = (const char*)memchr(line, '\n', len - lineStart);
+		int lineLen = lineEnd ? lineEnd - line : len - lineStart;
+		lineStart += lineLen + 1;
+
 		lineNum++;
-		if (line.length() < 1 || line[0] == '\n')
+		if (lineLen < 1)
 			continue;
 
 		if (line[0] == '{')
@@ -4919,14 +5193,14 @@ void Bsp::load_ents()
 			if (ent == NULL)
 				continue;
 
-			if (ent->hasKey("classname"))
+			if (ent->hasKey(Entity::KEY_CLASSNAME))
 				ents.push_back(ent);
 			else
 				logf("Found unknown classname entity. Skip it.\n");
 			ent = NULL;
 
 			// you can end/start an ent on the same line, you know
-			if (line.find("{") != string::npos)
+			if (memchr(line, '{', lineLen))
 			{
 				ent = new Entity();
 				lastBracket = 0;
@@ -4934,9 +5208,15 @@ void Bsp::load_ents()
 		}
 		else if (lastBracket == 0 && ent != NULL) // currently defining an entity
 		{
-			Keyvalue k(line);
-			if (k.key.length() && k.value.length())
-				ent->setOrAddKeyvalue(k.key, k.value);
+			const char* k;
+			const char* v;
+			int keyLen, valueLen;
+			if (Keyvalue::parse(line, lineLen, k, keyLen, v, valueLen) && valueLen)
+			{
+				key.assign(k, keyLen);
+				value.assign(v, valueLen);
+				ent->setOrAddKeyvalue(key, value);
+			}
 		}
 	}
 
@@ -5413,8 +5693,8 @@ bool Bsp::validate() {
 		if (fabs(ori.x) > oob || fabs(ori.y) > oob || fabs(ori.z) > oob) {
 			/*
 			logf("Entity '%s' (%s) outside map boundary at (%d %d %d)\n",
-				ent->hasKey("targetname") ? ent->getKeyvalue("targetname").c_str() : "",
-				ent->hasKey("classname") ? ent->getKeyvalue("classname").c_str() : "",
+				ent->hasKey(Entity::KEY_TARGETNAME) ? ent->getKeyvalue(Entity::KEY_TARGETNAME).c_str() : "",
+				ent->hasKey(Entity::KEY_CLASSNAME) ? ent->getKeyvalue(Entity::KEY_CLASSNAME).c_str() : "",
 				(int)ori.x, (int)ori.y, (int)ori.z);
 				*/
 			oobCount++;
@@ -5479,8 +5759,6 @@ vector<STRUCTUSAGE*> Bsp::get_sorted_model_infos(int sortMode) {
 }
 
 void Bsp::print_info(bool perModelStats, int perModelLimit, int sortMode) {
-	int entCount = ents.size();
-
 	if (perModelStats) {
 		g_sort_mode = sortMode;
 
@@ -5526,26 +5804,175 @@ void Bsp::print_info(bool perModelStats, int perModelLimit, int sortMode) {
 		}
 	}
 	else {
-		logf(" Data Type     Current / Max       Fullness\n");
-		logf("------------  -------------------  --------\n");
-		print_stat("AllocBlock", calc_allocblock_usage(), g_limits.max_allocblocks, false);
-		print_stat("models", modelCount, g_limits.max_models, false);
-		print_stat("planes", planeCount, g_limits.max_planes, false);
-		print_stat("vertexes", vertCount, g_limits.max_vertexes, false);
-		print_stat("nodes", nodeCount, g_limits.max_nodes, false);
-		print_stat("texinfos", texinfoCount, g_limits.max_texinfos, false);
-		print_stat("faces", faceCount, g_limits.max_faces, false);
-		print_stat("clipnodes", clipnodeCount, g_limits.max_clipnodes, false);
-		print_stat("leaves", leafCount, g_limits.max_leaves, false);
-		print_stat("marksurfaces", marksurfCount, g_limits.max_marksurfaces, false);
-		print_stat("surfedges", surfedgeCount, g_limits.max_surfedges, false);
-		print_stat("edges", edgeCount, g_limits.max_edges, false);
-		print_stat("textures", textureCount, g_limits.max_textures, false);
-		print_stat("lightstyles", lightstyle_count(), g_limits.max_lightstyles, false);
-		print_stat("lightdata", lightDataLength, g_limits.max_lightdata, true);
-		print_stat("visdata", visDataLength, g_limits.max_visdata, true);
-		print_stat("entities", entCount, g_limits.max_entities, false);
+		BSPLIMITSTATS stats = get_limit_stats();
+		print_limit_stats(stats);
+		print_texture_duplicates();
+	}
+}
+
+void Bsp::print_texture_duplicates() {
+	TextureIndex index;
+	index.build(textures, texDataLength);
+	vector<vector<int>> groups = index.findPixelDuplicates();
+
+	if (groups.empty()) {
+		return;
+	}
+
+	int dupeCount = 0;
+	int wastedBytes = 0;
+
+	logf("\nEmbedded textures with identical pixels:\n");
+	for (int i = 0; i < groups.size(); i++) {
+		string names;
+		for (int k = 0; k < groups[i].size(); k++) {
+			BSPMIPTEX* tex = get_texture(groups[i][k]);
+			names += (k > 0 ? ", " : "") + string(tex->szName, strnlen(tex->szName, MAXTEXTURENAME));
+			if (k > 0) {
+				wastedBytes += getBspTextureSize(tex) - sizeof(BSPMIPTEX);
+				dupeCount++;
+			}
+		}
+		logf("    %s\n", names.c_str());
+	}
+
+	logf("%d duplicate textures could save %.2f KB of texture data\n", dupeCount, wastedBytes / 1024.0f);
+}
+
+// counts entities and finds the highest light style by scanning the entity lump text,
+// without creating Entity objects. Follows the same rules as load_ents.
+static void scan_ent_lump(const char* dat, int len, int& entCount, int& maxStyle) {
+	bool inEnt = false;
+	bool hasClassname = false;
+	bool isLight = false;
+	int style = 0;
+	string key;
+	int tokenIdx = 0; // even = key, odd = value
+
+	for (int i = 0; i < len && dat[i]; i++) {
+		char c = dat[i];
+
+		if (c == '{') {
+			if (!inEnt) {
+				hasClassname = isLight = false;
+				style = tokenIdx = 0;
+			}
+			inEnt = true;
+		}
+		else if (c == '}') {
+			if (inEnt && hasClassname) {
+				entCount++;
+				if (isLight)
+					maxStyle = max(maxStyle, style);
+			}
+			inEnt = false;
+		}
+		else if (c == '"' && inEnt) {
+			int start = ++i;
+			while (i < len && dat[i] != '"' && dat[i] != '\n' && dat[i])
+				i++;
+
+			if (tokenIdx++ % 2 == 0) {
+				key = string(dat + start, i - start);
+			}
+			else if (i > start) {
+				if (key == "classname") {
+					hasClassname = true;
+					isLight = strncmp(dat + start, "light", 5) == 0;
+				}
+				else if (key == "style") {
+					style = atoi(string(dat + start, i - start).c_str());
+				}
+			}
+		}
+		else if (c == '\n') {
+			tokenIdx = 0;
+		}
+	}
+}
+
+BSPLIMITSTATS Bsp::get_limit_stats() {
+	BSPLIMITSTATS stats;
+	stats.counts = STRUCTCOUNT(this);
+	stats.allocblocks = calc_allocblock_usage();
+	stats.entdata = header.lump[LUMP_ENTITIES].nLength;
+
+	if (entsLoaded) {
+		stats.entities = ents.size();
+		stats.counts.lightstyles = lightstyle_count();
+	}
+	else {
+		int maxStyle = TOGGLED_LIGHT_STYLE_OFFSET - 1;
+		stats.entities = 0;
+		scan_ent_lump((const char*)lumps[LUMP_ENTITIES], header.lump[LUMP_ENTITIES].nLength, stats.entities, maxStyle);
+		stats.counts.lightstyles = maxStyle - (TOGGLED_LIGHT_STYLE_OFFSET - 1);
 	}
+
+	return stats;
+}
+
+bool Bsp::read_limit_stats(string fpath, BSPLIMITSTATS& stats) {
+	ifstream fin(fpath, ios::binary | ios::ate);
+	if (!fin.is_open()) {
+		return false;
+	}
+
+	int size = fin.tellg();
+	if (size < sizeof(BSPHEADER)) {
+		return false;
+	}
+
+	BSPHEADER header;
+	fin.seekg(0, fin.beg);
+	fin.read((char*)&header, sizeof(BSPHEADER));
+
+	int32_t textureCount = 0;
+	BSPLUMP& texLump = header.lump[LUMP_TEXTURES];
+	if (texLump.nLength >= (int)sizeof(int32_t) && texLump.nOffset >= 0 && texLump.nOffset + sizeof(int32_t) <= size) {
+		fin.seekg(texLump.nOffset);
+		fin.read((char*)&textureCount, sizeof(int32_t));
+	}
+
+	if (!fin.good()) {
+		return false;
+	}
+
+	stats.counts = STRUCTCOUNT(header, textureCount);
+	stats.counts.lightstyles = -1;
+	stats.allocblocks = -1;
+	stats.entities = -1;
+	stats.entdata = header.lump[LUMP_ENTITIES].nLength;
+
+	return true;
+}
+
+void Bsp::print_limit_stats(BSPLIMITSTATS& stats) {
+	STRUCTCOUNT& c = stats.counts;
+
+	logf(" Data Type     Current / Max       Fullness\n");
+	logf("------------  -------------------  --------\n");
+	if (stats.allocblocks >= 0)
+		print_stat("AllocBlock", stats.allocblocks, g_limits.max_allocblocks, false);
+	print_stat("models", c.models, g_limits.max_models, false);
+	print_stat("planes", c.planes, g_limits.max_planes, false);
+	print_stat("vertexes", c.verts, g_limits.max_vertexes, false);
+	print_stat("nodes", c.nodes, g_limits.max_nodes, false);
+	print_stat("texinfos", c.texInfos, g_limits.max_texinfos, false);
+	print_stat("faces", c.faces, g_limits.max_faces, false);
+	print_stat("clipnodes", c.clipnodes, g_limits.max_clipnodes, false);
+	print_stat("leaves", c.leaves, g_limits.max_leaves, false);
+	print_stat("marksurfaces", c.markSurfs, g_limits.max_marksurfaces, false);
+	print_stat("surfedges", c.surfEdges, g_limits.max_surfedges, false);
+	print_stat("edges", c.edges, g_limits.max_edges, false);
+	print_stat("textures", c.textures, g_limits.max_textures, false);
+	if (c.lightstyles >= 0)
+		print_stat("lightstyles", c.lightstyles, g_limits.max_lightstyles, false);
+	print_stat("lightdata", c.lightdata, g_limits.max_lightdata, true);
+	print_stat("visdata", c.visdata, g_limits.max_visdata, true);
+	if (stats.entities >= 0)
+		print_stat("entities", stats.entities, g_limits.max_entities, false);
+	else
+		print_stat("entdata", stats.entdata, g_limits.max_entdata, true);
 }
 
 void Bsp::print_model_bsp(int modelIdx) {
@@ -5597,20 +6024,19 @@ void Bsp::print_model_hull(int modelIdx, int hull_number) {
 }
 
 string Bsp::get_model_usage(int modelIdx) {
-	for (int i = 0; i < ents.size(); i++) {
-		if (ents[i]->getBspModelIdx() == modelIdx) {
-			return "\"" + ents[i]->getTargetname() + "\" (" + ents[i]->getClassname() + ")";
-		}
+	const vector<int>& uses = get_ent_index().findModel(modelIdx);
+	if (uses.empty()) {
+		return "(unused)";
 	}
-	return "(unused)";
+
+	Entity* ent = ents[uses[0]];
+	return "\"" + ent->getTargetname() + "\" (" + ent->getClassname() + ")";
 }
 
 vector<Entity*> Bsp::get_model_ents(int modelIdx) {
 	vector<Entity*> uses;
-	for (int i = 0; i < ents.size(); i++) {
-		if (ents[i]->getBspModelIdx() == modelIdx) {
-			uses.push_back(ents[i]);
-		}
+	for (int entIdx : get_ent_index().findModel(modelIdx)) {
+		uses.push_back(ents[entIdx]);
 	}
 	return uses;
 }
@@ -5922,89 +6348,44 @@ int Bsp::get_leaf_from_face(int faceIdx) {
 }
 
 bool Bsp::is_leaf_visible(int ileaf, vec3 pos) {
-	int ipvsLeaf = get_leaf(pos, 0);
-	BSPLEAF& pvsLeaf = leaves[ipvsLeaf];
-
-	int p = pvsLeaf.nVisOffset; // pvs offset
-	byte* pvs = lumps[LUMP_VISIBILITY];
-	
-	bool isVisible = false;
-	int numVisible = 0;
-
-	if (!pvs) {
+	if (!lumps[LUMP_VISIBILITY]) {
 		return true;
 	}
 
-	//logf("leaf %d can see:", ipvsLeaf);
-
-	for (int lf = 1; lf < leafCount && p < header.lump[LUMP_VISIBILITY].nLength; p++)
-	{
-		if (pvs[p] == 0) { // prepare to skip leafs
-			if (p + 1 >= header.lump[LUMP_VISIBILITY].nLength) {
-				logf("Failed to read VIS data\n");
-				break;
-			}
-			lf += 8 * pvs[++p]; // next byte holds number of leafs to skip
-		}
-		else
-		{
-			for (byte bit = 1; bit != 0; bit *= 2, lf++)
-			{
-				if ((pvs[p] & bit) && lf < leafCount) // leaf is flagged as visible
-				{
-					numVisible++;
-					//logf(" %d", lf);
-					if (lf == ileaf) {
-						isVisible = true;
-					}
-				}
-			}
-		}
-	}
-
-	//logf("\n");
-
-	return isVisible;
+	return get_pvs_cache().isVisible(get_leaf(pos, 0), ileaf);
 }
 
 vector<int> Bsp::get_pvs(int ileaf) {
-	BSPLEAF& pvsLeaf = leaves[ileaf];
 	vector<int> pvsLeaves;
 
-	int p = pvsLeaf.nVisOffset; // pvs offset
-	byte* pvs = lumps[LUMP_VISIBILITY];
-
-	bool isVisible = false;
-	int numVisible = 0;
-
-	if (!pvs) {
+	if (!lumps[LUMP_VISIBILITY]) {
 		return pvsLeaves;
 	}
 
-	for (int lf = 1; lf < leafCount && p < header.lump[LUMP_VISIBILITY].nLength; p++)
-	{
-		if (pvs[p] == 0) { // prepare to skip leafs
-			if (p + 1 >= header.lump[LUMP_VISIBILITY].nLength) {
-				logf("Failed to read VIS data\n");
-				break;
-			}
-			lf += 8 * pvs[++p]; // next byte holds number of leafs to skip
-		}
-		else
-		{
-			for (byte bit = 1; bit != 0; bit *= 2, lf++)
-			{
-				if ((pvs[p] & bit) && lf < leafCount && lf < models[0].nVisLeafs) // leaf is flagged as visible
-				{
-					pvsLeaves.push_back(lf);
-				}
-			}
-		}
-	}
+	get_pvs_cache().forEachVisible(ileaf, [&](int lf) {
+		pvsLeaves.push_back(lf);
+	});
 
 	return pvsLeaves;
 }
 
+PvsCache& Bsp::get_pvs_cache() {
+	int visLeafCount = modelCount > 0 ? models[0].nVisLeafs : 0;
+	byte* visLump = lumps[LUMP_VISIBILITY];
+	int visLength = header.lump[LUMP_VISIBILITY].nLength;
+
+	if (!pvsCache.matches(leaves, leafCount, visLeafCount, visLump, visLength)) {
+		pvsCache.init(leaves, leafCount, visLeafCount, visLump, visLength);
+	}
+
+	return pvsCache;
+}
+
+EntityIndex& Bsp::get_ent_index() {
+	entIndex.update(ents);
+	return entIndex;
+}
+
 vector<int> Bsp::get_connected_leaves(LeafNavMesh* mesh, const vector<int>& ileaves, const unordered_set<int>& ignoreLeaves) {
 	unordered_set<int> visited;
 	queue<int> searchNodes;
@@ -6369,46 +6750,26 @@ bool Bsp::is_face_visible(int faceIdx, vec3 pos, vec3 angles) {
 
 int Bsp::count_visible_polys(vec3 pos, vec3 angles) {
 	int ipvsLeaf = get_leaf(pos, 0);
-	BSPLEAF& pvsLeaf = leaves[ipvsLeaf];
-
-	int p = pvsLeaf.nVisOffset; // pvs offset
-	byte* pvs = lumps[LUMP_VISIBILITY];
-
-	bool isVisible = false;
-	int numVisible = 0;
 
-	if (ipvsLeaf == 0) {
+	if (ipvsLeaf == 0 || !lumps[LUMP_VISIBILITY]) {
 		return faceCount;
 	}
 
 	memset(pvsFaces, 0, pvsFaceCount*sizeof(bool));
 	int renderFaceCount = 0;
 
-	for (int lf = 1; lf < leafCount; p++)
-	{
-		if (pvs[p] == 0) // prepare to skip leafs
-			lf += 8 * pvs[++p]; // next byte holds number of leafs to skip
-		else
-		{
-			for (byte bit = 1; bit != 0; bit *= 2, lf++)
-			{
-				if ((pvs[p] & bit) && lf < leafCount) // leaf is flagged as visible
-				{
-					numVisible++;
-					BSPLEAF& leaf = leaves[lf];
-
-					for (int i = 0; i < leaf.nMarkSurfaces; i++) {
-						int faceIdx = marksurfs[leaf.iFirstMarkSurface + i];
-						if (!pvsFaces[faceIdx]) {
-							pvsFaces[faceIdx] = true;
-							if (is_face_visible(faceIdx, pos, angles))
-								renderFaceCount++;
-						}
-					}
-				}
+	get_pvs_cache().forEachVisible(ipvsLeaf, [&](int lf) {
+		BSPLEAF& leaf = leaves[lf];
+
+		for (int i = 0; i < leaf.nMarkSurfaces; i++) {
+			int faceIdx = marksurfs[leaf.iFirstMarkSurface + i];
+			if (!pvsFaces[faceIdx]) {
+				pvsFaces[faceIdx] = true;
+				if (is_face_visible(faceIdx, pos, angles))
+					renderFaceCount++;
 			}
 		}
-	}
+	});
 
 	return renderFaceCount;
 }
@@ -6498,6 +6859,52 @@ void Bsp::mark_model_structures(int modelIdx, STRUCTUSAGE* usage, bool skipLeave
 	}
 }
 
+void Bsp::mark_all_model_structures(STRUCTUSAGE* usage, int threadCount) {
+	threadCount = max(1, min(threadCount, modelCount));
+
+	if (threadCount == 1) {
+		for (int i = 0; i < modelCount; i++) {
+			mark_model_structures(i, usage, false);
+		}
+		return;
+	}
+
+	// models are handed out one at a time because worldspawn is usually much larger than the rest
+	vector<STRUCTUSAGE*> threadUsage(threadCount);
+	atomic<int> nextModel(0);
+	vector<thread> threads;
+
+	for (int t = 0; t < threadCount; t++) {
+		threadUsage[t] = new STRUCTUSAGE(this);
+		threads.push_back(thread([this, t, &threadUsage, &nextModel]() {
+			for (int i = nextModel++; i < modelCount; i = nextModel++) {
+				mark_model_structures(i, threadUsage[t], false);
+			}
+		}));
+	}
+
+	for (int t = 0; t < threadCount; t++) {
+		threads[t].join();
+	}
+
+	STRUCTCOUNT& count = usage->count;
+	for (int t = 0; t < threadCount; t++) {
+		STRUCTUSAGE* src = threadUsage[t];
+		for (int i = 0; i < count.nodes; i++) usage->nodes[i] |= src->nodes[i];
+		for (int i = 0; i < count.clipnodes; i++) usage->clipnodes[i] |= src->clipnodes[i];
+		for (int i = 0; i < count.leaves; i++) usage->leaves[i] |= src->leaves[i];
+		for (int i = 0; i < count.planes; i++) usage->planes[i] |= src->planes[i];
+		for (int i = 0; i < count.verts; i++) usage->verts[i] |= src->verts[i];
+		for (int i = 0; i < count.texInfos; i++) usage->texInfo[i] |= src->texInfo[i];
+		for (int i = 0; i < count.faces; i++) usage->faces[i] |= src->faces[i];
+		for (int i = 0; i < count.textures; i++) usage->textures[i] |= src->textures[i];
+		for (int i = 0; i < count.markSurfs; i++) usage->markSurfs[i] |= src->markSurfs[i];
+		for (int i = 0; i < count.surfEdges; i++) usage->surfEdges[i] |= src->surfEdges[i];
+		for (int i = 0; i < count.edges; i++) usage->edges[i] |= src->edges[i];
+		delete src;
+	}
+}
+
 void Bsp::unlink_model_leaf_faces(int modelIdx) {
 	BSPMODEL& model = models[modelIdx];
 
@@ -6718,15 +7125,11 @@ int Bsp::find_texture(const char* name) {
 	if (!name || name[0] == '\0')
 		return -1;
 
-	for (int i = 0; i < textureCount; i++) {
-		int32_t oldOffset = ((int32_t*)textures)[i + 1];
-		BSPMIPTEX* oldTex = (BSPMIPTEX*)(textures + oldOffset);
-		if (strcasecmp(name, oldTex->szName) == 0) {
-			return i;
-		}
+	if (!textureIndex.isBuilt()) {
+		textureIndex.build(textures, texDataLength);
 	}
 
-	return -1;
+	return textureIndex.findName(name);
 }
 
 int Bsp::add_texture(const char* texname, byte* data, int width, int height) {
@@ -6750,6 +7153,7 @@ int Bsp::add_texture(const char* texname, byte* data, int width, int height) {
 	COLOR3 palette[256];
 	memset(&palette, 0, sizeof(COLOR3) * 256);
 	int colorCount = 0;
+	unordered_map<COLOR3, int> paletteIndexes;
 
 	// create pallete and full-rez mipmap
 	byte* mip[MIPLEVELS];
@@ -6757,13 +7161,8 @@ int Bsp::add_texture(const char* texname, byte* data, int width, int height) {
 	COLOR3* src = (COLOR3*)data;
 	for (int y = 0; y < height; y++) {
 		for (int x = 0; x < width; x++) {
-			int paletteIdx = -1;
-			for (int k = 0; k < colorCount; k++) {
-				if (*src == palette[k]) {
-					paletteIdx = k;
-					break;
-				}
-			}
+			auto existing = paletteIndexes.find(*src);
+			int paletteIdx = existing != paletteIndexes.end() ? existing->second : -1;
 			if (paletteIdx == -1) {
 				if (colorCount >= 256) {
 					logf("Too many colors");
@@ -6771,6 +7170,7 @@ int Bsp::add_texture(const char* texname, byte* data, int width, int height) {
 					return -1;
 				}
 				palette[colorCount] = *src;
+				paletteIndexes[*src] = colorCount;
 				paletteIdx = colorCount;
 				colorCount++;
 			}
@@ -8616,11 +9016,11 @@ int Bsp::merge_models(Entity* enta, Entity* entb) {
 	modelIdxB = duplicate_model(modelIdxB);
 
 	g_progress.hide = true;
-	if (enta->hasKey("origin")) {
+	if (enta->hasKey(Entity::KEY_ORIGIN)) {
 		move(enta->getOrigin(), modelIdxA);
 		enta->removeKeyvalue("origin");
 	}
-	if (entb->hasKey("origin")) {
+	if (entb->hasKey(Entity::KEY_ORIGIN)) {
 		move(entb->getOrigin(), modelIdxB);
 		entb->removeKeyvalue("origin");
 	}
@@ -9523,6 +9923,7 @@ int16 Bsp::regenerate_clipnodes_from_nodes(int iNode, int hullIdx) {
 		}
 	}
 
+	// each clipnode gets its own plane, so editing this model's planes in-place can't affect other models
 	BSPPLANE& nodePlane = planes[node.iPlane];
 	BSPPLANE& clipnodePlane = planes[clipnodes[newClipnodeIdx].iPlane];
 	clipnodePlane = nodePlane;
@@ -9643,10 +10044,11 @@ void Bsp::write_csg_outputs(string path) {
 		flipped.fDist = -flipped.fDist;
 		newPlanes[numPlanes + i] = flipped;
 	}
-	delete [] lumps[LUMP_PLANES];
+	free_lump(LUMP_PLANES);
 	lumps[LUMP_PLANES] = (byte*)newPlanes;
 	numPlanes *= 2;
 	header.lump[LUMP_PLANES].nLength = numPlanes * sizeof(BSPPLANE);
+	update_lump_pointer(LUMP_PLANES);
 	thisPlanes = newPlanes;
 
 	ofstream pln_file(path + name + ".pln", ios::out | ios::binary | ios::trunc);
@@ -9784,70 +10186,103 @@ void Bsp::print_leaf(int leafidx) {
 }
 
 void Bsp::update_lump_pointers() {
-	planes = (BSPPLANE*)lumps[LUMP_PLANES];
-	texinfos = (BSPTEXTUREINFO*)lumps[LUMP_TEXINFO];
-	leaves = (BSPLEAF*)lumps[LUMP_LEAVES];
-	models = (BSPMODEL*)lumps[LUMP_MODELS];
-	nodes = (BSPNODE*)lumps[LUMP_NODES];
-	clipnodes = (BSPCLIPNODE*)lumps[LUMP_CLIPNODES];
-	faces = (BSPFACE*)lumps[LUMP_FACES];
-	verts = (vec3*)lumps[LUMP_VERTICES];
-	lightdata = lumps[LUMP_LIGHTING];
-	surfedges = (int32_t*)lumps[LUMP_SURFEDGES];
-	edges = (BSPEDGE*)lumps[LUMP_EDGES];
-	marksurfs = (uint16*)lumps[LUMP_MARKSURFACES];
-	visdata = lumps[LUMP_VISIBILITY];
-	textures = lumps[LUMP_TEXTURES];
-
-	planeCount = header.lump[LUMP_PLANES].nLength / sizeof(BSPPLANE);
-	texinfoCount = header.lump[LUMP_TEXINFO].nLength / sizeof(BSPTEXTUREINFO);
-	leafCount = header.lump[LUMP_LEAVES].nLength / sizeof(BSPLEAF);
-	modelCount = header.lump[LUMP_MODELS].nLength / sizeof(BSPMODEL);
-	nodeCount = header.lump[LUMP_NODES].nLength / sizeof(BSPNODE);
-	vertCount = header.lump[LUMP_VERTICES].nLength / sizeof(vec3);
-	faceCount = header.lump[LUMP_FACES].nLength / sizeof(BSPFACE);
-	clipnodeCount = header.lump[LUMP_CLIPNODES].nLength / sizeof(BSPCLIPNODE);
-	marksurfCount = header.lump[LUMP_MARKSURFACES].nLength / sizeof(uint16_t);
-	surfedgeCount = header.lump[LUMP_SURFEDGES].nLength / sizeof(int32_t);
-	edgeCount = header.lump[LUMP_EDGES].nLength / sizeof(BSPEDGE);
-	textureCount = *((int32_t*)(lumps[LUMP_TEXTURES]));
-	texDataLength = header.lump[LUMP_TEXTURES].nLength;
-	lightDataLength = header.lump[LUMP_LIGHTING].nLength;
-	visDataLength = header.lump[LUMP_VISIBILITY].nLength;
-
-	if (!g_app) {
-		if (planeCount > g_limits.max_planes) logf("Overflowed Planes !!!\n");
-		if (texinfoCount > g_limits.max_texinfos) logf("Overflowed texinfos !!!\n");
-		if (leafCount > g_limits.max_leaves) logf("Overflowed leaves !!!\n");
-		if (modelCount > g_limits.max_models) logf("Overflowed models !!!\n");
-		if (texinfoCount > g_limits.max_texinfos) logf("Overflowed texinfos !!!\n");
-		if (nodeCount > g_limits.max_nodes) logf("Overflowed nodes !!!\n");
-		if (vertCount > g_limits.max_vertexes) logf("Overflowed verts !!!\n");
-		if (faceCount > g_limits.max_faces) logf("Overflowed faces !!!\n");
-		if (clipnodeCount > g_limits.max_clipnodes) logf("Overflowed clipnodes !!!\n");
-		if (marksurfCount > g_limits.max_marksurfaces) logf("Overflowed marksurfs !!!\n");
-		if (surfedgeCount > g_limits.max_surfedges) logf("Overflowed surfedges !!!\n");
-		if (edgeCount > g_limits.max_edges) logf("Overflowed edges !!!\n");
-		if (textureCount > g_limits.max_textures) logf("Overflowed textures !!!\n");
-		if (lightDataLength > g_limits.max_lightdata) logf("Overflowed lightdata !!!\n");
-		if (visDataLength > g_limits.max_visdata) logf("Overflowed visdata !!!\n");
-	}
-
-	if (pvsFaceCount != faceCount) {
-		pvsFaceCount = faceCount;
-
-		if (pvsFaces) {
-			delete[] pvsFaces;
-		}
-		pvsFaces = new bool[pvsFaceCount];
+	for (int i = 0; i < HEADER_LUMPS; i++) {
+		update_lump_pointer(i);
+	}
+}
+
+void Bsp::update_lump_pointer(int lumpIdx) {
+	switch (lumpIdx) {
+	case LUMP_PLANES:
+		planes = (BSPPLANE*)lumps[LUMP_PLANES];
+		planeCount = header.lump[LUMP_PLANES].nLength / sizeof(BSPPLANE);
+		if (!g_app && planeCount > g_limits.max_planes) logf("Overflowed Planes !!!\n");
+		break;
+	case LUMP_TEXINFO:
+		texinfos = (BSPTEXTUREINFO*)lumps[LUMP_TEXINFO];
+		texinfoCount = header.lump[LUMP_TEXINFO].nLength / sizeof(BSPTEXTUREINFO);
+		if (!g_app && texinfoCount > g_limits.max_texinfos) logf("Overflowed texinfos !!!\n");
+		break;
+	case LUMP_LEAVES:
+		leaves = (BSPLEAF*)lumps[LUMP_LEAVES];
+		leafCount = header.lump[LUMP_LEAVES].nLength / sizeof(BSPLEAF);
+		if (!g_app && leafCount > g_limits.max_leaves) logf("Overflowed leaves !!!\n");
+		break;
+	case LUMP_MODELS:
+		models = (BSPMODEL*)lumps[LUMP_MODELS];
+		modelCount = header.lump[LUMP_MODELS].nLength / sizeof(BSPMODEL);
+		if (!g_app && modelCount > g_limits.max_models) logf("Overflowed models !!!\n");
+		break;
+	case LUMP_NODES:
+		nodes = (BSPNODE*)lumps[LUMP_NODES];
+		nodeCount = header.lump[LUMP_NODES].nLength / sizeof(BSPNODE);
+		if (!g_app && nodeCount > g_limits.max_nodes) logf("Overflowed nodes !!!\n");
+		break;
+	case LUMP_CLIPNODES:
+		clipnodes = (BSPCLIPNODE*)lumps[LUMP_CLIPNODES];
+		clipnodeCount = header.lump[LUMP_CLIPNODES].nLength / sizeof(BSPCLIPNODE);
+		if (!g_app && clipnodeCount > g_limits.max_clipnodes) logf("Overflowed clipnodes !!!\n");
+		break;
+	case LUMP_FACES:
+		faces = (BSPFACE*)lumps[LUMP_FACES];
+		faceCount = header.lump[LUMP_FACES].nLength / sizeof(BSPFACE);
+		if (!g_app && faceCount > g_limits.max_faces) logf("Overflowed faces !!!\n");
+
+		if (pvsFaceCount != faceCount) {
+			pvsFaceCount = faceCount;
+
+			if (pvsFaces) {
+				delete[] pvsFaces;
+			}
+			pvsFaces = new bool[pvsFaceCount];
+		}
+		break;
+	case LUMP_VERTICES:
+		verts = (vec3*)lumps[LUMP_VERTICES];
+		vertCount = header.lump[LUMP_VERTICES].nLength / sizeof(vec3);
+		if (!g_app && vertCount > g_limits.max_vertexes) logf("Overflowed verts !!!\n");
+		break;
+	case LUMP_LIGHTING:
+		lightdata = lumps[LUMP_LIGHTING];
+		lightDataLength = header.lump[LUMP_LIGHTING].nLength;
+		if (!g_app && lightDataLength > g_limits.max_lightdata) logf("Overflowed lightdata !!!\n");
+		break;
+	case LUMP_SURFEDGES:
+		surfedges = (int32_t*)lumps[LUMP_SURFEDGES];
+		surfedgeCount = header.lump[LUMP_SURFEDGES].nLength / sizeof(int32_t);
+		if (!g_app && surfedgeCount > g_limits.max_surfedges) logf("Overflowed surfedges !!!\n");
+		break;
+	case LUMP_EDGES:
+		edges = (BSPEDGE*)lumps[LUMP_EDGES];
+		edgeCount = header.lump[LUMP_EDGES].nLength / sizeof(BSPEDGE);
+		if (!g_app && edgeCount > g_limits.max_edges) logf("Overflowed edges !!!\n");
+		break;
+	case LUMP_MARKSURFACES:
+		marksurfs = (uint16*)lumps[LUMP_MARKSURFACES];
+		marksurfCount = header.lump[LUMP_MARKSURFACES].nLength / sizeof(uint16_t);
+		if (!g_app && marksurfCount > g_limits.max_marksurfaces) logf("Overflowed marksurfs !!!\n");
+		break;
+	case LUMP_VISIBILITY:
+		visdata = lumps[LUMP_VISIBILITY];
+		visDataLength = header.lump[LUMP_VISIBILITY].nLength;
+		if (!g_app && visDataLength > g_limits.max_visdata) logf("Overflowed visdata !!!\n");
+		break;
+	case LUMP_TEXTURES:
+		textures = lumps[LUMP_TEXTURES];
+		textureCount = *((int32_t*)(lumps[LUMP_TEXTURES]));
+		texDataLength = header.lump[LUMP_TEXTURES].nLength;
+		if (!g_app && textureCount > g_limits.max_textures) logf("Overflowed textures !!!\n");
+		break;
+	default:
+		break;
 	}
 }
 
 void Bsp::replace_lump(int lumpIdx, void* newData, int newLength) {
-	delete[] lumps[lumpIdx];
+	free_lump(lumpIdx);
 	lumps[lumpIdx] = (byte*)newData;
 	header.lump[lumpIdx].nLength = newLength;
-	update_lump_pointers();
+	update_lump_pointer(lumpIdx);
 }
 
 void Bsp::append_lump(int lumpIdx, void* newData, int appendLength) {
@@ -12,6 +12,11 @@
 #include <unordered_set>
 #include "colors.h"
 #include "Wad.h"
+#include "MappedFile.h"
+#include "TextureIndex.h"
+#include "PvsCache.h"
+#include "EntityIndex.h"
+#include "LumpDelta.h"
 
 class Entity;
 class Wad;
@@ -38,6 +43,22 @@ enum BspguyDataTypes {
 	BSPGUY_BSP_MODEL
 };
 
+// values the info command compares against the map limits
+struct BSPLIMITSTATS {
+	STRUCTCOUNT counts;
+	float allocblocks; // -1 if not computed
+	int entities; // -1 if not computed
+	int entdata; // size of the entity lump in bytes
+};
+
+// a texture's new mip0 pixels and palette, before they're written to the texture lump
+struct RESAMPLED_TEXTURE {
+	int width;
+	int height;
+	vector<byte> pixels;
+	vector<COLOR3> palette;
+};
+
 struct BspModelData {
 	vector<BSPPLANE> planes;
 	vector<vec3> verts;
@@ -111,7 +132,10 @@ public:
 
 	Bsp();
 	Bsp(const Bsp& other);
-	Bsp(std::string fname);
+	// mapped = memory-map the file and only copy lumps into owned memory once they are replaced.
+	// Loads faster but keeps the file open until the lumps are materialized or the map is deleted.
+	// loadEnts = parse the entity lump into Entity objects. Only skip this for read-only reports.
+	Bsp(std::string fname, bool mapped=false, bool loadEnts=true);
 	~Bsp();
 
 	// if modelIdx=0, the world is moved and all entities along with it
@@ -121,6 +145,20 @@ public:
 	void write(string path);
 
 	void print_info(bool perModelStats, int perModelLimit, int sortMode);
+
+	// gathers the values shown in the info summary. Entities are counted from the
+	// entity lump text if they weren't loaded.
+	BSPLIMITSTATS get_limit_stats();
+
+	// reads lump sizes and the texture count from the BSP header without loading the map.
+	// Allocblocks and entity counts are not computed.
+	static bool read_limit_stats(string fpath, BSPLIMITSTATS& stats);
+
+	static void print_limit_stats(BSPLIMITSTATS& stats);
+
+	// lists embedded textures that have the same pixels as another texture, and the lump space they waste
+	void print_texture_duplicates();
+
 	void print_model_hull(int modelIdx, int hull);
 	void print_clipnode_tree(int iNode, int depth);
 	void recurse_node(int16_t node, int depth);
@@ -136,6 +174,12 @@ public:
 	// return PVS of the given leaf (leaf indexes which are potentially visible)
 	vector<int> get_pvs(int ileaf);
 
+	// decompressed PVS rows for the world leaves, (re)initialized if the vis data changed since the last call
+	PvsCache& get_pvs_cache();
+
+	// entity lookups by classname, targetname, target, and model, updated for any entity edits since the last call
+	EntityIndex& get_ent_index();
+
 	// select all leaves connected to the given leaves
 	// ignoreLeaves will not be connected thru
 	vector<int> get_connected_leaves(LeafNavMesh* mesh, const vector<int>& ileaves, const unordered_set<int>& ignoreLeaves);
@@ -245,8 +289,10 @@ public:
 	bool isValid(); // check if any lumps are overflowed
 	bool isWritable(); // check if any lumps are overflowed which would corrupt the file
 
-	// delete structures not used by the map (needed after deleting models/hulls)
-	STRUCTCOUNT remove_unused_model_structures(bool deleteModels=true);
+	// delete structures not used by the map (needed after deleting models/hulls).
+	// Marking and compacting run on the job's threads (see getJobThreadCount). printTiming logs how long
+	// each step took.
+	STRUCTCOUNT remove_unused_model_structures(bool deleteModels=true, bool printTiming=false);
 	void delete_model(int modelIdx);
 
 	// conditionally deletes hulls for entities that aren't using them
@@ -306,6 +352,15 @@ public:
 
 	bool downscale_texture(int textureId, int newWidth, int newHeight, int resampleMode);
 
+	// resamples and quantizes a texture without modifying the texture lump, so it's safe to call
+	// from multiple threads. Only embedded textures can be resampled.
+	// threadCount limits the threads used for quantizing (0 = one per core).
+	bool resample_texture(int textureId, int newWidth, int newHeight, int resampleMode, RESAMPLED_TEXTURE& out,
+		int threadCount=0);
+
+	// replaces a texture with one from resample_texture and adjusts face scales to match
+	bool apply_resampled_texture(int textureId, const RESAMPLED_TEXTURE& resampled);
+
 	bool rename_texture(const char* oldName, const char* newName);
 
 	bool embed_texture(int textureId, vector<Wad*>& wads);
@@ -408,6 +463,12 @@ public:
 	void replace_lump(int lumpIdx, void* newData, int newLength);
 	void append_lump(int lumpIdx, void* newData, int appendLength);
 
+	// true if the lump data still points into the memory-mapped file
+	bool is_lump_mapped(int lumpIdx);
+
+	// copies all memory-mapped lumps into owned memory and closes the file mapping
+	void materialize_lumps();
+
 	bool is_invisible_solid(Entity* ent);
 
 	// replace a model's clipnode hull with a axis-aligned bounding box
@@ -505,21 +566,40 @@ public:
 	// true if the model is sharing planes/clipnodes with other models
 	bool does_model_use_shared_structures(int modelIdx);
 
-	// returns the current lump contents
+	// returns the current lump contents. Lumps that haven't changed since the last copy share its buffer.
 	LumpState duplicate_lumps(int targets);
 
 	void replace_lumps(LumpState& state);
 
+	// changes lumps to the new (or old, if reverse=true) versions stored in the deltas. If any lump doesn't
+	// match the version the deltas were made from, no lumps are changed and false is returned.
+	bool apply_lump_deltas(LumpDelta* deltas, bool reverse);
+
 	int delete_embedded_textures();
 
 	int find_texture(const char* name);
 
 	void update_lump_pointers();
 
+	// updates the pointer and count for a single lump. Other lumps aren't touched, so different lumps
+	// can be replaced from different threads.
+	void update_lump_pointer(int lumpIdx);
+
 private:
 	bool* pvsFaces = NULL; // flags which faces are marked for rendering in the PVS
 	int pvsFaceCount = 0;
 
+	MappedFile* mappedFile = NULL; // source file, if the lumps were loaded in mapped mode
+	bool entsLoaded = false; // false if the entity lump was never parsed into ents
+
+	TextureIndex textureIndex; // cleared when the texture lump is replaced or a texture is renamed
+	PvsCache pvsCache; // cleared when the vis or leaf lump is replaced
+	EntityIndex entIndex;
+
+	// the most recent copy of each lump made by duplicate_lumps, if any state still holds it
+	std::weak_ptr<byte> lumpCopies[HEADER_LUMPS];
+	int lumpCopyLens[HEADER_LUMPS] = { 0 };
+
 	int remove_unused_lightmaps(bool* usedFaces);
 	int remove_unused_visdata(STRUCTREMAP* remap, BSPLEAF* oldLeaves, int oldLeafCount, int oldWorldspawnLeafCount); // called after removing unused leaves
 	int remove_unused_textures(bool* usedTextures, int* remappedIndexes);
@@ -528,6 +608,10 @@ private:
 	void resize_lightmaps(LIGHTMAP* oldLightmaps, LIGHTMAP* newLightmaps);
 
 	bool load_lumps(string fname);
+	bool load_mapped_lumps(string fname);
+
+	// deletes the lump data unless it belongs to the memory-mapped file
+	void free_lump(int lumpIdx);
 
 	// lightmaps that are resized due to precision errors should not be stretched to fit the new canvas.
 	// Instead, the texture should be shifted around, depending on which parts of the canvas is "lit" according
@@ -537,7 +621,7 @@ private:
 	void print_model_bsp(int modelIdx);
 	void print_leaf(int leafidx);
 	void print_node(int nodeidx);
-	void print_stat(string name, uint val, uint max, bool isMem);
+	static void print_stat(string name, uint val, uint max, bool isMem);
 	void print_model_stat(STRUCTUSAGE* modelInfo, uint val, uint max, bool isMem);
 
 	string get_model_usage(int modelIdx);
@@ -548,6 +632,10 @@ private:
 	// marks all structures that this model uses
 	// TODO: don't mark faces in submodel leaves (unused)
 	void mark_model_structures(int modelIdx, STRUCTUSAGE* STRUCTUSAGE, bool skipLeaves);
+
+	// marks the structures of every model. Threads mark whole models into their own arrays,
+	// which are merged into usage afterwards.
+	void mark_all_model_structures(STRUCTUSAGE* usage, int threadCount);
 	void mark_face_structures(int iFace, STRUCTUSAGE* usage);
 	void mark_node_structures(int iNode, STRUCTUSAGE* usage, bool skipLeaves);
 	void mark_clipnode_structures(int iNode, STRUCTUSAGE* usage);
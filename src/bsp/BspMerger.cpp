@@ -7,11 +7,81 @@
 #include "globals.h"
 #include <algorithm>
 #include <float.h>
+#include "TaskGraph.h"
+#include "StructIndex.h"
+
+// Splits threads between merges that can run at the same time. Merges are grouped by their depth in
+// the dependency graph, and the merges at each depth share the threads equally.
+struct MergeThreadSplit {
+	vector<int> taskDepth;
+	vector<int> depthWidth; // number of merges at each depth
+
+	// call once per task, in the order the tasks are added. Returns the task's depth.
+	int add(const vector<int>& deps) {
+		int depth = 0;
+		for (int dep : deps) {
+			if (dep >= 0) {
+				depth = max(depth, taskDepth[dep] + 1);
+			}
+		}
+		taskDepth.push_back(depth);
+		if (depthWidth.size() <= depth) {
+			depthWidth.resize(depth + 1, 0);
+		}
+		depthWidth[depth]++;
+		return depth;
+	}
 
-BspMerger::BspMerger() {
+	// threads for a merge at the given depth. Only valid after all tasks are added.
+	int threads(int depth, int threadCount) const {
+		int parallel = max(1, min(threadCount, depthWidth[depth]));
+		return max(1, threadCount / parallel);
+	}
+};
 
+// runs a merge and holds back its log until it finishes, so merges running at the same time don't interleave
+static void run_merge_task(const std::function<void()>& func) {
+	string log;
+	string* parentLog = g_job_log;
+	g_job_log = &log;
+	func();
+	g_job_log = parentLog;
+	logText(log);
 }
 
+BspMerger::BspMerger() {
+	threadCount = std::thread::hardware_concurrency();
+	memoryBudget = (size_t)2048 * 1024 * 1024;
+}
+
+// approximate memory used by a map or group of merged maps, for scheduling merges within a memory budget
+struct MergeFootprint {
+	size_t lumpBytes;
+	size_t leaves;
+
+	MergeFootprint() : lumpBytes(0), leaves(0) {}
+
+	MergeFootprint(Bsp* map) {
+		lumpBytes = 0;
+		for (int i = 0; i < HEADER_LUMPS; i++) {
+			lumpBytes += map->header.lump[i].nLength;
+		}
+		leaves = map->header.lump[LUMP_LEAVES].nLength / sizeof(BSPLEAF);
+	}
+
+	// memory needed while merging: the original and merged copy of every lump, plus the decompressed vis data
+	size_t merge_cost(const MergeFootprint& other) const {
+		size_t totalLeaves = leaves + other.leaves;
+		size_t visRowSize = ((totalLeaves + 63) & ~63) >> 3;
+		return (lumpBytes + other.lumpBytes) * 2 + totalLeaves * visRowSize;
+	}
+
+	void absorb(const MergeFootprint& other) {
+		lumpBytes += other.lumpBytes;
+		leaves += other.leaves;
+	}
+};
+
 MergeResult BspMerger::merge(vector<Bsp*> maps, vec3 gap, string output_name, bool noripent, bool noscript, bool nomove, bool forcemove, int max_dim) {
 	MergeResult result;
 	result.fpath = "";
@@ -67,57 +137,89 @@ MergeResult BspMerger::merge(vector<Bsp*> maps, vec3 gap, string output_name, bo
 
 	// Merge order matters. 
 	// The bounding box of a merged map is expanded to contain both maps, and bounding boxes cannot overlap.
-	// TODO: Don't merge linearly. Merge gradually bigger chunks to minimize BSP tree depth.
-	//       Not worth it until more than 27 maps are merged together (merge cube bigger than 3x3x3)
+	// Each group of maps is merged as a balanced tree (0+1, 2+3, then 01+23) to keep the BSP tree shallow
+	// and so that merges which don't share a map can run at the same time.
 
 	logf("\nMerging %d maps:\n", maps.size());
 
+	TaskGraph mergeTasks;
+	MergeThreadSplit threadSplit;
+	unordered_map<MAPBLOCK*, int> lastMerge; // last task that merged into a block
+	unordered_map<MAPBLOCK*, MergeFootprint> footprints;
+	int mergeCount = 1;
+
+	auto add_merge = [&](MAPBLOCK* dst, MAPBLOCK* src, string merge_name) {
+		merge_name = ++mergeCount < maps.size() ? merge_name : "result";
+
+		for (MAPBLOCK* block : { dst, src }) {
+			if (!footprints.count(block)) {
+				footprints[block] = MergeFootprint(block->map);
+				lastMerge[block] = -1;
+			}
+		}
+
+		vector<int> deps = { lastMerge[dst], lastMerge[src] };
+		int depth = threadSplit.add(deps);
+		int task = mergeTasks.add(merge_name, [this, dst, src, merge_name, depth, &threadSplit] {
+			run_merge_task([&] {
+				BspMerger merger;
+				merger.threadCount = threadSplit.threads(depth, threadCount);
+				merger.merge(*dst, *src, merge_name);
+			});
+		}, deps, footprints[dst].merge_cost(footprints[src]));
+
+		lastMerge[dst] = lastMerge[src] = task;
+		footprints[dst].absorb(footprints[src]);
+	};
+
+	auto add_merge_tree = [&](vector<MAPBLOCK*> group, string merge_name) {
+		for (int step = 1; step < group.size(); step *= 2) {
+			for (int i = 0; i + step < group.size(); i += step * 2) {
+				add_merge(group[i], group[i + step], merge_name);
+			}
+		}
+	};
+
 	// merge maps along X axis to form rows of maps
 	int rowId = 0;
-	int mergeCount = 1;
 	for (int z = 0; z < blocks.size(); z++) {
 		for (int y = 0; y < blocks[z].size(); y++) {
-			MAPBLOCK& rowStart = blocks[z][y][0];
+			vector<MAPBLOCK*> row;
 			for (int x = 0; x < blocks[z][y].size(); x++) {
-				MAPBLOCK& block = blocks[z][y][x];
-
-				if (x != 0) {
-					//logf("Merge %d,%d,%d -> %d,%d,%d\n", x, y, z, 0, y, z);
-					string merge_name = ++mergeCount < maps.size() ? "row_" + to_string(rowId) : "result";
-					merge(rowStart, block, merge_name);
-				}
+				row.push_back(&blocks[z][y][x]);
 			}
-			rowId++;
+			add_merge_tree(row, "row_" + to_string(rowId++));
 		}
 	}
 
 	// merge the rows along the Y axis to form layers of maps
 	int colId = 0;
 	for (int z = 0; z < blocks.size(); z++) {
-		MAPBLOCK& colStart = blocks[z][0][0];
+		vector<MAPBLOCK*> col;
 		for (int y = 0; y < blocks[z].size(); y++) {
-			MAPBLOCK& block = blocks[z][y][0];
-
-			if (y != 0) {
-				//logf("Merge %d,%d,%d -> %d,%d,%d\n", 0, y, z, 0, 0, z);
-				string merge_name = ++mergeCount < maps.size() ? "layer_" + to_string(colId) : "result";
-				merge(colStart, block, merge_name);
-			}
+			col.push_back(&blocks[z][y][0]);
 		}
-		colId++;
+		add_merge_tree(col, "layer_" + to_string(colId++));
 	}
 
 	// merge the layers to form a cube of maps
-	MAPBLOCK& layerStart = blocks[0][0][0];
+	vector<MAPBLOCK*> layers;
 	for (int z = 0; z < blocks.size(); z++) {
-		MAPBLOCK& block = blocks[z][0][0];
+		layers.push_back(&blocks[z][0][0]);
+	}
+	add_merge_tree(layers, "result");
 
-		if (z != 0) {
-			//logf("Merge %d,%d,%d -> %d,%d,%d\n", 0, 0, z, 0, 0, 0);
-			merge(layerStart, block, "result");
-		}
+	if (threadCount > 1)
+		g_progress.update("Merging maps", mergeTasks.size());
+	mergeTasks.run(threadCount, memoryBudget);
+	g_progress.clear();
+
+	if (g_verbose) {
+		logf("\nMap merge timing:\n");
+		mergeTasks.print_timing();
 	}
 
+	MAPBLOCK& layerStart = blocks[0][0][0];
 	Bsp* output = layerStart.map;
 	output->zero_entity_origins("func_water");
 	output->zero_entity_origins("func_ladder");
@@ -144,7 +246,7 @@ void BspMerger::preprocessMaps(vector<Bsp*> maps, bool optimize, bool nohull2) {
 		logf("Preprocessing %s:\n", maps[i]->name.c_str());
 
 		logf("    Deleting unused data...\n");
-		STRUCTCOUNT removed = maps[i]->remove_unused_model_structures();
+		STRUCTCOUNT removed = maps[i]->remove_unused_model_structures(true, g_verbose);
 		g_progress.clear();
 		removed.print_delete_stats(2);
 
@@ -163,7 +265,8 @@ void BspMerger::preprocessMaps(vector<Bsp*> maps, bool optimize, bool nohull2) {
 	}
 }
 
-MergeResult BspMerger::createMergedMap(vector<string> fpaths, string output_name, bool optimize, bool nohull2, int ripentmode) {
+MergeResult BspMerger::createMergedMap(vector<string> fpaths, string output_name, bool optimize, bool nohull2, int ripentmode,
+	const BspMerger& settings) {
 	vector<Bsp*> maps;
 
 	MergeResult result;
@@ -190,6 +293,8 @@ MergeResult BspMerger::createMergedMap(vector<string> fpaths, string output_name
 	int max_dim = g_settings.mapsize_max;
 
 	BspMerger merger;
+	merger.threadCount = settings.threadCount;
+	merger.memoryBudget = settings.memoryBudget;
 	result = merger.merge(maps, gap, output_name,
 		ripentmode == 0, ripentmode == 2, false, true, max_dim);
 	Bsp* mergedMap = result.map;
@@ -203,7 +308,7 @@ MergeResult BspMerger::createMergedMap(vector<string> fpaths, string output_name
 }
 
 Bsp* BspMerger::createMergedMap(vector<Bsp*> maps, vector<MapMergeOp> merge_opts, bool optimize,
-	bool nohull2, int ripentmode) {
+	bool nohull2, int ripentmode, const BspMerger& settings) {
 
 	preprocessMaps(maps, optimize, nohull2);
 
@@ -239,14 +344,50 @@ Bsp* BspMerger::createMergedMap(vector<Bsp*> maps, vector<MapMergeOp> merge_opts
 		}
 	}
 
+	// operations that don't share a map are run at the same time
+	TaskGraph mergeTasks;
+	MergeThreadSplit threadSplit;
+	unordered_map<Bsp*, int> lastMerge; // last task that merged into or out of a map
+	unordered_map<Bsp*, MergeFootprint> footprints;
+
 	Bsp* lastMergeMap = NULL;
 	for (MapMergeOp& op : merge_opts) {
-		logf("\nMerging map %s into %s\n", op.mapb->name.c_str(), op.mapa->name.c_str());
-		BspMerger merger;
-		merger.merge(*op.mapa, *op.mapb);
+		for (Bsp* map : { op.mapa, op.mapb }) {
+			if (!footprints.count(map)) {
+				footprints[map] = MergeFootprint(map);
+				lastMerge[map] = -1;
+			}
+		}
+
+		Bsp* mapa = op.mapa;
+		Bsp* mapb = op.mapb;
+		vector<int> deps = { lastMerge[mapa], lastMerge[mapb] };
+		int depth = threadSplit.add(deps);
+		int threadCount = settings.threadCount;
+		int task = mergeTasks.add(mapa->name + " + " + mapb->name, [mapa, mapb, depth, threadCount, &threadSplit] {
+			run_merge_task([&] {
+				logf("\nMerging map %s into %s\n", mapb->name.c_str(), mapa->name.c_str());
+				BspMerger merger;
+				merger.threadCount = threadSplit.threads(depth, threadCount);
+				merger.merge(*mapa, *mapb);
+			});
+		}, deps, footprints[mapa].merge_cost(footprints[mapb]));
+
+		lastMerge[mapa] = lastMerge[mapb] = task;
+		footprints[mapa].absorb(footprints[mapb]);
 		lastMergeMap = op.mapa;
 	}
 
+	if (settings.threadCount > 1)
+		g_progress.update("Merging maps", mergeTasks.size());
+	mergeTasks.run(settings.threadCount, settings.memoryBudget);
+	g_progress.clear();
+
+	if (g_verbose) {
+		logf("\nMap merge timing:\n");
+		mergeTasks.print_timing();
+	}
+
 	if (ripentmode != 0) {
 		logf("\nUpdating map series entity logic:\n");
 		BspMerger merger;
@@ -440,7 +581,7 @@ vector<vector<vector<MAPBLOCK>>> BspMerger::separate(vector<Bsp*>& maps, vec3 ga
 		vector<MAPBLOCK> row;
 		for (const MAPBLOCK& block : blocks) {
 			row.push_back(block);
-			if (block.map->ents[0]->hasKey("origin")) {
+			if (block.map->ents[0]->hasKey(Entity::KEY_ORIGIN)) {
 				// apply the transform move in the GUI
 				block.map->move(block.map->ents[0]->getOrigin());
 				block.map->ents[0]->removeKeyvalue("origin");
@@ -685,7 +826,7 @@ void BspMerger::update_map_series_entity_logic(Bsp* mergedMap, vector<MAPBLOCK>&
 		string cname = ent->getClassname();
 		string tname = ent->getTargetname();
 		string source_map = ent->getKeyvalue("$s_bspguy_map_source");
-		int spawnflags = atoi(ent->getKeyvalue("spawnflags").c_str());
+		int spawnflags = atoi(ent->getKeyvalue(Entity::KEY_SPAWNFLAGS).c_str());
 		bool isInFirstMap = toLowerCase(source_map) == toLowerCase(firstMapName);
 		vec3 origin;
 
@@ -694,8 +835,8 @@ void BspMerger::update_map_series_entity_logic(Bsp* mergedMap, vector<MAPBLOCK>&
 			continue;
 		}
 
-		if (ent->hasKey("origin")) {
-			origin = Keyvalue("origin", ent->getKeyvalue("origin")).getVector();
+		if (ent->hasKey(Entity::KEY_ORIGIN)) {
+			origin = Keyvalue("origin", ent->getKeyvalue(Entity::KEY_ORIGIN)).getVector();
 		}
 		if (ent->isBspModel()) {
 			origin = mergedMap->get_model_center(ent->getBspModelIdx());
@@ -824,9 +965,9 @@ void BspMerger::update_map_series_entity_logic(Bsp* mergedMap, vector<MAPBLOCK>&
 				logf("\nWarning: use-only trigger_changelevel has no targetname\n");
 
 			if (!(spawnflags & 2)) {
-				string model = ent->getKeyvalue("model");
+				string model = ent->getKeyvalue(Entity::KEY_MODEL);
 
-				string oldOrigin = ent->getKeyvalue("origin");
+				string oldOrigin = ent->getKeyvalue(Entity::KEY_ORIGIN);
 				ent->clearAllKeyvalues();
 				ent->setOrAddKeyvalue("origin", oldOrigin);
 				ent->setOrAddKeyvalue("model", model);
@@ -1111,8 +1252,16 @@ int BspMerger::force_unique_ent_names_per_map(Bsp* mergedMap) {
 
 			//logf << "\nRenaming " << *it2 << " to " << newName << endl;
 
-			for (int i = 0; i < mergedMap->ents.size(); i++) {
-				Entity* ent = mergedMap->ents[i];
+			// only entities that use the name as a targetname or target can have keys to rename
+			EntityIndex& entIndex = mergedMap->get_ent_index();
+			vector<int> renameEnts = entIndex.findTargetname(oldName);
+			const vector<int>& callers = entIndex.findTarget(oldName);
+			renameEnts.insert(renameEnts.end(), callers.begin(), callers.end());
+			sort(renameEnts.begin(), renameEnts.end());
+			renameEnts.erase(unique(renameEnts.begin(), renameEnts.end()), renameEnts.end());
+
+			for (int entIdx : renameEnts) {
+				Entity* ent = mergedMap->ents[entIdx];
 				if (ent->getKeyvalue("$s_bspguy_map_source") != it->first)
 					continue;
 
@@ -1157,9 +1306,10 @@ bool BspMerger::merge(Bsp& mapA, Bsp& mapB) {
 		}
 		else if (!mapA.lumps[i]) {
 			logf("Replacing %s lump\n", g_lump_names[i]);
-			mapA.header.lump[i].nLength = mapB.header.lump[i].nLength;
-			mapA.lumps[i] = new byte[mapB.header.lump[i].nLength];
-			memcpy(mapA.lumps[i], mapB.lumps[i], mapB.header.lump[i].nLength);
+			int lumpLen = mapB.header.lump[i].nLength;
+			byte* lumpCopy = new byte[lumpLen];
+			memcpy(lumpCopy, mapB.lumps[i], lumpLen);
+			mapA.replace_lump(i, lumpCopy, lumpLen); // also clears caches of the old lump
 
 			// process the lump here (TODO: faster to just copy wtv needs copying)
 			switch (i) {
@@ -1181,51 +1331,66 @@ bool BspMerger::merge(Bsp& mapA, Bsp& mapB) {
 		logf("Lightstyles overflowed! The output map will have broken lighting.\n");
 	}
 
+	// Each task replaces its own lumps, and only reads lumps and remap tables from the tasks it depends on.
+	// Tasks that don't depend on each other can run at the same time.
+	TaskGraph tasks;
+	int planes = -1, textures = -1, verts = -1, edges = -1, surfedges = -1, texinfo = -1;
+	int faces = -1, marksurfs = -1, leaves = -1, headnodes = -1, nodes = -1, clipnodes = -1;
+
 	// base structures (they don't reference any other structures)
 	if (shouldMerge[LUMP_ENTITIES])
-		merge_ents(mapA, mapB);
+		tasks.add("entities", [&] { merge_ents(mapA, mapB); });
 	if (shouldMerge[LUMP_PLANES])
-		merge_planes(mapA, mapB);
+		planes = tasks.add("planes", [&] { merge_planes(mapA, mapB); });
 	if (shouldMerge[LUMP_TEXTURES])
-		merge_textures(mapA, mapB);
+		textures = tasks.add("textures", [&] { merge_textures(mapA, mapB); });
 	if (shouldMerge[LUMP_VERTICES])
-		merge_vertices(mapA, mapB);
+		verts = tasks.add("vertices", [&] { merge_vertices(mapA, mapB); });
 
-	if (shouldMerge[LUMP_EDGES])
-		merge_edges(mapA, mapB); // references verts
+	if (shouldMerge[LUMP_EDGES]) // references verts
+		edges = tasks.add("edges", [&] { merge_edges(mapA, mapB); }, { verts });
 
-	if (shouldMerge[LUMP_SURFEDGES])
-		merge_surfedges(mapA, mapB); // references edges
+	if (shouldMerge[LUMP_SURFEDGES]) // references edges
+		surfedges = tasks.add("surfedges", [&] { merge_surfedges(mapA, mapB); }, { edges });
 
-	if (shouldMerge[LUMP_TEXINFO])
-		merge_texinfo(mapA, mapB); // references textures
+	if (shouldMerge[LUMP_TEXINFO]) // references textures
+		texinfo = tasks.add("texinfo", [&] { merge_texinfo(mapA, mapB); }, { textures });
 
-	if (shouldMerge[LUMP_FACES])
-		merge_faces(mapA, mapB); // references planes, surfedges, and texinfo
+	if (shouldMerge[LUMP_FACES]) // references planes, surfedges, and texinfo
+		faces = tasks.add("faces", [&] { merge_faces(mapA, mapB); }, { planes, surfedges, texinfo });
 
-	if (shouldMerge[LUMP_MARKSURFACES])
-		merge_marksurfs(mapA, mapB); // references faces
+	if (shouldMerge[LUMP_MARKSURFACES]) // references faces
+		marksurfs = tasks.add("marksurfaces", [&] { merge_marksurfs(mapA, mapB); }, { faces });
 
-	if (shouldMerge[LUMP_LEAVES])
-		merge_leaves(mapA, mapB); // references vis data, and marksurfs
+	if (shouldMerge[LUMP_LEAVES]) // references vis data, and marksurfs
+		leaves = tasks.add("leaves", [&] { merge_leaves(mapA, mapB); }, { marksurfs });
 
 	if (shouldMerge[LUMP_NODES]) {
-		create_merge_headnodes(mapA, mapB, separationPlane);
-		merge_nodes(mapA, mapB);
-		merge_clipnodes(mapA, mapB);
+		// appends the separation plane to the merged planes
+		headnodes = tasks.add("headnodes", [&] { create_merge_headnodes(mapA, mapB, separationPlane); }, { planes });
+		nodes = tasks.add("nodes", [&] { merge_nodes(mapA, mapB); }, { headnodes, leaves, faces });
+		clipnodes = tasks.add("clipnodes", [&] { merge_clipnodes(mapA, mapB); }, { headnodes });
 	}
 
-	if (shouldMerge[LUMP_MODELS])
-		merge_models(mapA, mapB);
+	if (shouldMerge[LUMP_MODELS]) // references nodes, clipnodes, and faces
+		tasks.add("models", [&] { merge_models(mapA, mapB); }, { nodes, clipnodes, faces });
 
-	merge_lighting(mapA, mapB);
+	// updates face lightmap offsets
+	tasks.add("lighting", [&] { merge_lighting(mapA, mapB); }, { faces });
 
-	// doing this last because it takes way longer than anything else, and limit overflows should fail the
-	// merge as soon as possible. // TODO: fail fast if overflow detected in other merges? Kind ni
-	merge_vis(mapA, mapB);
+	// updates leaf vis offsets
+	tasks.add("visibility", [&] { merge_vis(mapA, mapB); }, { leaves });
+
+	if (threadCount > 1)
+		g_progress.update("Merging lumps", tasks.size());
+	tasks.run(threadCount);
 
 	g_progress.clear();
 
+	if (g_verbose) {
+		tasks.print_timing();
+	}
+
 	return true;
 }
 
@@ -1261,10 +1426,10 @@ void BspMerger::merge_ents(Bsp& mapA, Bsp& mapB)
 	// update model indexes since this map's models will be appended after the other map's models
 	int otherModelCount = (mapB.header.lump[LUMP_MODELS].nLength / sizeof(BSPMODEL)) - 1;
 	for (int i = 0; i < mapA.ents.size(); i++) {
-		if (!mapA.ents[i]->hasKey("model") || mapA.ents[i]->getKeyvalue("model")[0] != '*') {
+		if (!mapA.ents[i]->hasKey(Entity::KEY_MODEL) || mapA.ents[i]->getKeyvalue(Entity::KEY_MODEL)[0] != '*') {
 			continue;
 		}
-		string modelIdxStr = mapA.ents[i]->getKeyvalue("model").substr(1);
+		string modelIdxStr = mapA.ents[i]->getKeyvalue(Entity::KEY_MODEL).substr(1);
 
 		if (!isNumeric(modelIdxStr)) {
 			continue;
@@ -1347,16 +1512,17 @@ void BspMerger::merge_planes(Bsp& mapA, Bsp& mapB) {
 		mergedPlanes.push_back(mapA.planes[i]);
 		g_progress.tick();
 	}
+
+	// only map A planes are checked for duplicates
+	StructIndex<BSPPLANE> planeIndex;
+	planeIndex.build(mapA.planes, mapA.planeCount);
+
 	for (int i = 0; i < mapB.planeCount; i++) {
-		bool isUnique = true;
-		for (int k = 0; k < mapA.planeCount; k++) {
-			if (memcmp(&mapB.planes[i], &mapA.planes[k], sizeof(BSPPLANE)) == 0) {
-				isUnique = false;
-				planeRemap.push_back(k);
-				break;
-			}
+		int k = planeIndex.find(mapB.planes[i]);
+		if (k != -1) {
+			planeRemap.push_back(k);
 		}
-		if (isUnique) {
+		else {
 			planeRemap.push_back(mergedPlanes.size());
 			mergedPlanes.push_back(mapB.planes[i]);
 		}
@@ -1411,28 +1577,23 @@ void BspMerger::merge_textures(Bsp& mapA, Bsp& mapB) {
 		g_progress.tick();
 	}
 
+	// only map A textures are checked for duplicates
+	TextureIndex texIndex;
+	texIndex.build(mapA.textures, mapA.header.lump[LUMP_TEXTURES].nLength);
+
 	uint otherMergeSz = (mapB.textureCount + 1) * sizeof(int32_t);
 	for (int i = 0; i < mapB.textureCount; i++) {
 		int32_t offset = ((int32_t*)mapB.textures)[i + 1];
 		
 		if (offset != -1) {
-			bool isUnique = true;
 			BSPMIPTEX* tex = (BSPMIPTEX*)(mapB.textures + offset);
 			int sz = getBspTextureSize(tex);
 
-			for (int k = 0; k < mapA.textureCount; k++) {
-				if (mipTexOffsets[k] == -1) {
-					continue;
-				}
-				BSPMIPTEX* thisTex = (BSPMIPTEX*)(newMipTexData + mipTexOffsets[k]);
-				if (memcmp(tex, thisTex, sz) == 0) {
-					isUnique = false;
-					texRemap.push_back(k);
-					break;
-				}
+			int k = texIndex.findTexture(tex);
+			if (k != -1) {
+				texRemap.push_back(k);
 			}
-
-			if (isUnique) {
+			else {
 				mipTexOffsets[newTexCount] = (mipTexWritePtr - newMipTexData);
 				texRemap.push_back(newTexCount);
 				memcpy(mipTexWritePtr, tex, sz); // Note: won't work if pixel data isn't immediately after struct
@@ -1496,20 +1657,19 @@ void BspMerger::merge_texinfo(Bsp& mapA, Bsp& mapB) {
 		g_progress.tick();
 	}
 
+	// only map A texinfos are checked for duplicates
+	StructIndex<BSPTEXTUREINFO> texinfoIndex;
+	texinfoIndex.build(mapA.texinfos, mapA.texinfoCount);
+
 	for (int i = 0; i < mapB.texinfoCount; i++) {
 		BSPTEXTUREINFO info = mapB.texinfos[i];
 		info.iMiptex = texRemap[info.iMiptex];
 
-		bool isUnique = true;
-		for (int k = 0; k < mapA.texinfoCount; k++) {
-			if (memcmp(&info, &mapA.texinfos[k], sizeof(BSPTEXTUREINFO)) == 0) {
-				texInfoRemap.push_back(k);
-				isUnique = false;
-				break;
-			}
+		int k = texinfoIndex.find(info);
+		if (k != -1) {
+			texInfoRemap.push_back(k);
 		}
-
-		if (isUnique) {
+		else {
 			texInfoRemap.push_back(mergedInfo.size());
 			mergedInfo.push_back(info);
 		}
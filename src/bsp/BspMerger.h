@@ -53,6 +53,13 @@ class BspMerger {
 public:
 	BspMerger();
 
+	// number of threads used to merge lumps, and to merge maps that don't depend on each other.
+	// 1 merges one lump and one map at a time.
+	int threadCount;
+
+	// rough limit on the memory used by maps that are being merged at the same time, in bytes
+	size_t memoryBudget;
+
 	// merges all maps into one
 	// noripent - don't change any entity logic
 	// noscript - don't add support for the bspguy map script (worse performance + buggy, but simpler)
@@ -60,11 +67,12 @@ public:
 	// forcemove - increase map size cube if maps don't fit in the requested map size, but still set the failure flag
 	MergeResult merge(vector<Bsp*> maps, vec3 gap, string output_name, bool noripent, bool noscript, bool nomove, bool forcemove, int max_dim);
 
+	// settings provides the thread count and memory budget for the merge
 	static MergeResult createMergedMap(vector<string> fpaths, string output_name, bool optimize,
-		bool nohull2, int ripentmode);
+		bool nohull2, int ripentmode, const BspMerger& settings = BspMerger());
 
 	static Bsp* createMergedMap(vector<Bsp*> maps, vector<MapMergeOp> merge_opts, bool optimize,
-		bool nohull2, int ripentmode);
+		bool nohull2, int ripentmode, const BspMerger& settings = BspMerger());
 
 	// find a series of separation planes that will separate all BSPs
 	static int solveMerge(vector<Bsp*> maps, vector<MapMergeOp>& mergeOps);
@@ -7,10 +7,34 @@
 #include "globals.h"
 #include "Renderer.h"
 #include <unordered_set>
+#include <mutex>
+#include <atomic>
 #include "Fgd.h"
 
 using namespace std;
 
+static mutex g_keyNamesMutex;
+static atomic<uint32_t> g_keyNameCount(0); // changes whenever a new name is interned
+static atomic<uint64_t> g_lastEditStamp(0);
+
+static unordered_set<string>& keyNames() {
+	static unordered_set<string> names;
+	return names;
+}
+
+const string* const Entity::KEY_CLASSNAME = Entity::internKey("classname");
+const string* const Entity::KEY_TARGETNAME = Entity::internKey("targetname");
+const string* const Entity::KEY_TARGET = Entity::internKey("target");
+const string* const Entity::KEY_ORIGIN = Entity::internKey("origin");
+const string* const Entity::KEY_ANGLES = Entity::internKey("angles");
+const string* const Entity::KEY_ANGLE = Entity::internKey("angle");
+const string* const Entity::KEY_MODEL = Entity::internKey("model");
+const string* const Entity::KEY_SPAWNFLAGS = Entity::internKey("spawnflags");
+
+void EntEditStamp::next() {
+	val = ++g_lastEditStamp;
+}
+
 Entity::Entity(void)
 {
 }
@@ -24,88 +48,178 @@ Entity::~Entity(void)
 {
 }
 
+const string* Entity::internKey(const string& key) {
+	const string* found = findKey(key);
+	if (found) {
+		return found;
+	}
+
+	lock_guard<mutex> lock(g_keyNamesMutex);
+	auto inserted = keyNames().insert(key);
+	if (inserted.second) {
+		g_keyNameCount++;
+	}
+	return &*inserted.first;
+}
+
+const string* Entity::findKey(const string& key) {
+	struct FoundKey {
+		const string* key;
+		uint32_t nameCount; // g_keyNameCount when the lookup was done
+	};
+
+	// Interned names are never freed, so each thread remembers the names it has found and only locks
+	// for new ones. A missing name is remembered until another name is interned.
+	thread_local unordered_map<string, FoundKey> found;
+
+	uint32_t nameCount = g_keyNameCount;
+	auto cached = found.find(key);
+	if (cached != found.end() && (cached->second.key || cached->second.nameCount == nameCount)) {
+		return cached->second.key;
+	}
+
+	const string* interned = NULL;
+	{
+		lock_guard<mutex> lock(g_keyNamesMutex);
+		unordered_set<string>& names = keyNames();
+		auto it = names.find(key);
+		if (it != names.end()) {
+			interned = &*it;
+		}
+	}
+
+	FoundKey result = { interned, nameCount };
+	found[key] = result;
+	return interned;
+}
+
+uint64_t Entity::getEditStamp() {
+	return editStamp.val;
+}
+
+uint64_t Entity::getLastEditStamp() {
+	return g_lastEditStamp;
+}
+
+int Entity::findKeyIdx(const string* key) {
+	for (int i = 0; i < keyvalues.size(); i++) {
+		if (keyvalues[i].key == key) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+int Entity::findKeyIdx(const string& key) {
+	const string* interned = findKey(key);
+	return interned ? findKeyIdx(interned) : -1;
+}
+
 const string Entity::getKeyvalue(string key) {
-	auto found = keyvalues.find(key);
-	if (found == keyvalues.end()) {
+	int idx = findKeyIdx(key);
+	if (idx == -1) {
+		return "";
+	}
+	return keyvalues[idx].value;
+}
+
+const string Entity::getKeyvalue(const string* key) {
+	int idx = findKeyIdx(key);
+	if (idx == -1) {
 		return "";
 	}
-	return found->second;
+	return keyvalues[idx].value;
 }
 
 unordered_map<string, string> Entity::getAllKeyvalues() {
-	return keyvalues;
+	unordered_map<string, string> ret;
+	for (int i = 0; i < keyvalues.size(); i++) {
+		ret[*keyvalues[i].key] = keyvalues[i].value;
+	}
+	return ret;
 }
 
 void Entity::setOrAddKeyvalue(const std::string& key, const std::string& value) {
 	clearCache();
 
-	auto existing = keyvalues.find(key);
-	if (existing != keyvalues.end()) {
-		existing->second = value;
+	const string* interned = internKey(key);
+	int idx = findKeyIdx(interned);
+	if (idx != -1) {
+		keyvalues[idx].value = value;
 		return;
 	}
 
-	keyOrder.push_back(key);
-	keyvalues[key] = value;
+	KeyvalueEntry entry;
+	entry.key = interned;
+	entry.value = value;
+	keyvalues.push_back(entry);
+}
+
+int Entity::getKeyCount() {
+	return keyvalues.size();
+}
+
+const string& Entity::getKey(int idx) {
+	return *keyvalues[idx].key;
+}
+
+const string& Entity::getValue(int idx) {
+	return keyvalues[idx].value;
+}
+
+void Entity::swapKeys(int idxA, int idxB) {
+	std::swap(keyvalues[idxA], keyvalues[idxB]);
+	editStamp.next();
 }
 
 void Entity::removeKeyvalue(const std::string& key) {
-	if (!hasKey(key))
+	int idx = findKeyIdx(key);
+	if (idx == -1)
 		return;
-	auto it = find(keyOrder.begin(), keyOrder.end(), key);
-	if (it != keyOrder.end())
-		keyOrder.erase(it);
-	else {
-		logf("Desync between keyorder and keyvalues!\n");
-	}
-	keyvalues.erase(key);
+	keyvalues.erase(keyvalues.begin() + idx);
 	clearCache();
 }
 
 bool Entity::renameKey(string oldName, string newName) {
-	int hasKey = -1;
-	for (int i = 0; i < keyOrder.size(); i++) {
-		if (keyOrder[i] == oldName) {
-			hasKey = i;
-		}
-		if (keyOrder[i] == newName) {
-			return false;
-		}
+	if (newName.empty() || newName == oldName) {
+		return false;
 	}
-	if (hasKey == -1 || newName.empty() || newName == oldName) {
+
+	int idx = findKeyIdx(oldName);
+	if (idx == -1 || findKeyIdx(newName) != -1) {
 		return false;
 	}
-	
-	keyOrder[hasKey] = newName;
-	keyvalues[newName] = keyvalues[oldName];
-	keyvalues.erase(oldName);
+
+	keyvalues[idx].key = internKey(newName);
 	clearCache();
 	return true;
 }
 
 void Entity::clearAllKeyvalues() {
-	keyOrder.clear();
 	keyvalues.clear();
 	cachedModelIdx = -2;
+	editStamp.next();
 }
 
 void Entity::clearEmptyKeyvalues() {
-	vector<string> newKeyOrder;
-	unordered_map<string, string> newKeyvalues;
-	for (int i = 0; i < keyOrder.size(); i++) {
-		if (!keyvalues[keyOrder[i]].empty()) {
-			newKeyOrder.push_back(keyOrder[i]);
-			newKeyvalues[keyOrder[i]] = keyvalues[keyOrder[i]];
+	vector<KeyvalueEntry> newKeyvalues;
+	for (int i = 0; i < keyvalues.size(); i++) {
+		if (!keyvalues[i].value.empty()) {
+			newKeyvalues.push_back(keyvalues[i]);
 		}
 	}
-	keyOrder = newKeyOrder;
 	keyvalues = newKeyvalues;
 	clearCache();
 }
 
 bool Entity::hasKey(const std::string& key)
 {
-	return keyvalues.find(key) != keyvalues.end();
+	return findKeyIdx(key) != -1;
+}
+
+bool Entity::hasKey(const string* key)
+{
+	return findKeyIdx(key) != -1;
 }
 
 int Entity::getBspModelIdx() {
@@ -113,12 +227,13 @@ int Entity::getBspModelIdx() {
 		return cachedModelIdx;
 	}
 
-	if (!hasKey("model")) {
+	int kv = findKeyIdx(KEY_MODEL);
+	if (kv == -1) {
 		cachedModelIdx = -1;
 		return -1;
 	}
 
-	string model = getKeyvalue("model");
+	const string& model = keyvalues[kv].value;
 	if (model.size() <= 1 || model[0] != '*') {
 		cachedModelIdx = -1;
 		return -1;
@@ -138,7 +253,7 @@ bool Entity::isBspModel() {
 }
 
 bool Entity::isSprite() {
-	string model = getKeyvalue("model");
+	string model = getKeyvalue(KEY_MODEL);
 	int ext = model.find(".spr");
 	return ext != -1 && ext == model.size() - 4;
 }
@@ -148,12 +263,12 @@ string Entity::getTargetname() {
 		return cachedTargetname;
 	}
 
-	auto kv = keyvalues.find("targetname");
-	if (kv == keyvalues.end()) {
+	int kv = findKeyIdx(KEY_TARGETNAME);
+	if (kv == -1) {
 		return "";
 	}
 
-	cachedTargetname = kv->second;
+	cachedTargetname = keyvalues[kv].value;
 	hasCachedTargetname = true;
 
 	return cachedTargetname;
@@ -167,7 +282,7 @@ unordered_set<string> Entity::getAllTargetnames() {
 	unordered_set<string> tnameKeys = { "targetname" };
 	cachedTargetnames.clear();
 
-	FgdClass* fgd = g_app->mergedFgd ? g_app->mergedFgd->getFgdClass(getClassname()) : NULL;
+	FgdClass* fgd = g_app && g_app->mergedFgd ? g_app->mergedFgd->getFgdClass(getClassname()) : NULL;
 	if (fgd) {
 		for (KeyvalueDef& def : fgd->keyvalues) {
 			if (def.iType == FGD_KEY_TARGET_SRC) {
@@ -193,12 +308,12 @@ string Entity::getClassname() {
 		return cachedClassname;
 	}
 
-	auto kv = keyvalues.find("classname");
-	if (kv == keyvalues.end()) {
+	int kv = findKeyIdx(KEY_CLASSNAME);
+	if (kv == -1) {
 		return "";
 	}
 
-	cachedClassname = kv->second;
+	cachedClassname = keyvalues[kv].value;
 	hasCachedClassname = true;
 
 	return cachedClassname;
@@ -209,12 +324,12 @@ vec3 Entity::getOrigin() {
 		return cachedOrigin;
 	}
 
-	auto kv = keyvalues.find("origin");
-	if (kv == keyvalues.end()) {
+	int kv = findKeyIdx(KEY_ORIGIN);
+	if (kv == -1) {
 		cachedOrigin = vec3();
 	}
 	else {
-		cachedOrigin = parseVector(kv->second);
+		cachedOrigin = parseVector(keyvalues[kv].value);
 	}
 
 	hasCachedOrigin = true;
@@ -226,12 +341,12 @@ vec3 Entity::getAngles() {
 		return cachedAngles;
 	}
 
-	auto kv = keyvalues.find("angles");
-	cachedAngles = kv != keyvalues.end() ? parseVector(kv->second) : vec3();
+	int kv = findKeyIdx(KEY_ANGLES);
+	cachedAngles = kv != -1 ? parseVector(keyvalues[kv].value) : vec3();
 
-	kv = keyvalues.find("angle");
-	if (kv != keyvalues.end()) {
-		float angle = atof(kv->second.c_str());
+	kv = findKeyIdx(KEY_ANGLE);
+	if (kv != -1) {
+		float angle = atof(keyvalues[kv].value.c_str());
 
 		if (angle >= 0) {
 			cachedAngles.y = angle;
@@ -277,36 +392,36 @@ EntRenderOpts Entity::getRenderOpts() {
 		return cachedRenderOpts;
 	}
 
-	auto kv = keyvalues.find("rendermode");
-	cachedRenderOpts.rendermode = kv == keyvalues.end() ? 0 : atoi(kv->second.c_str());
+	int kv = findKeyIdx("rendermode");
+	cachedRenderOpts.rendermode = kv == -1 ? 0 : atoi(keyvalues[kv].value.c_str());
 
-	kv = keyvalues.find("renderamt");
-	cachedRenderOpts.renderamt = kv == keyvalues.end() ? 0 : atoi(kv->second.c_str());
+	kv = findKeyIdx("renderamt");
+	cachedRenderOpts.renderamt = kv == -1 ? 0 : atoi(keyvalues[kv].value.c_str());
 
-	kv = keyvalues.find("rendercolor");
-	cachedRenderOpts.rendercolor = kv == keyvalues.end() ? COLOR3(0,0,0) : parseColor(kv->second);
+	kv = findKeyIdx("rendercolor");
+	cachedRenderOpts.rendercolor = kv == -1 ? COLOR3(0,0,0) : parseColor(keyvalues[kv].value);
 
-	kv = keyvalues.find("framerate");
-	cachedRenderOpts.framerate = kv == keyvalues.end() ? 0.0f : atof(kv->second.c_str());
+	kv = findKeyIdx("framerate");
+	cachedRenderOpts.framerate = kv == -1 ? 0.0f : atof(keyvalues[kv].value.c_str());
 
-	kv = keyvalues.find("scale");
-	cachedRenderOpts.scale = kv == keyvalues.end() ? 1.0f : atof(kv->second.c_str());
+	kv = findKeyIdx("scale");
+	cachedRenderOpts.scale = kv == -1 ? 1.0f : atof(keyvalues[kv].value.c_str());
 
-	kv = keyvalues.find("vp_type");
-	cachedRenderOpts.vp_type = kv == keyvalues.end() ? 0 : atoi(kv->second.c_str());
+	kv = findKeyIdx("vp_type");
+	cachedRenderOpts.vp_type = kv == -1 ? 0 : atoi(keyvalues[kv].value.c_str());
 
-	kv = keyvalues.find("new_body");
-	cachedRenderOpts.body = kv == keyvalues.end() ? 0 : atoi(kv->second.c_str());
-	kv = keyvalues.find("body");
-	cachedRenderOpts.body = kv == keyvalues.end() ? cachedRenderOpts.body : atoi(kv->second.c_str());
+	kv = findKeyIdx("new_body");
+	cachedRenderOpts.body = kv == -1 ? 0 : atoi(keyvalues[kv].value.c_str());
+	kv = findKeyIdx("body");
+	cachedRenderOpts.body = kv == -1 ? cachedRenderOpts.body : atoi(keyvalues[kv].value.c_str());
 
-	kv = keyvalues.find("new_skin");
-	cachedRenderOpts.skin = kv == keyvalues.end() ? 0 : atoi(kv->second.c_str());
-	kv = keyvalues.find("skin");
-	cachedRenderOpts.skin = kv == keyvalues.end() ? cachedRenderOpts.skin : atoi(kv->second.c_str());
+	kv = findKeyIdx("new_skin");
+	cachedRenderOpts.skin = kv == -1 ? 0 : atoi(keyvalues[kv].value.c_str());
+	kv = findKeyIdx("skin");
+	cachedRenderOpts.skin = kv == -1 ? cachedRenderOpts.skin : atoi(keyvalues[kv].value.c_str());
 
-	kv = keyvalues.find("sequence");
-	cachedRenderOpts.sequence = kv == keyvalues.end() ? 0 : atoi(kv->second.c_str());
+	kv = findKeyIdx("sequence");
+	cachedRenderOpts.sequence = kv == -1 ? 0 : atoi(keyvalues[kv].value.c_str());
 
 	hasCachedRenderOpts = true;
 	return cachedRenderOpts;
@@ -413,7 +528,7 @@ bool Entity::canRotate() {
 	}
 
 	if (cname == "func_wall" || cname == "func_illusionary") {
-		int spawnflags = atoi(getKeyvalue("spawnflags").c_str());
+		int spawnflags = atoi(getKeyvalue(KEY_SPAWNFLAGS).c_str());
 		return spawnflags & 2; // "Use angles" key
 	}
 
@@ -433,7 +548,7 @@ bool Entity::shouldDisplayDirectionVector() {
 		// show if the FGD says the ent uses angles, or if the fgd is missing and the ent has angles,
 		// or if force angles are on
 		bool classUsesAngle = clazz ? (clazz->hasKey("angles") || clazz->hasKey("angle")) : false;
-		if (classUsesAngle || (!clazz && (hasKey("angles") || hasKey("angle"))) || g_app->forceAngleRotation) {
+		if (classUsesAngle || (!clazz && (hasKey(KEY_ANGLES) || hasKey(KEY_ANGLE))) || g_app->forceAngleRotation) {
 			return true;
 		}
 	}
@@ -675,7 +790,7 @@ unordered_set<string> Entity::getTargets() {
 		targetKeys.insert(potential_targetname_keys[i]);
 	}
 
-	FgdClass* fgd = g_app->mergedFgd ? g_app->mergedFgd->getFgdClass(getClassname()) : NULL;
+	FgdClass* fgd = g_app && g_app->mergedFgd ? g_app->mergedFgd->getFgdClass(getClassname()) : NULL;
 	if (fgd) {
 		for (KeyvalueDef& def : fgd->keyvalues) {
 			if (def.iType == FGD_KEY_TARGET_DST) {
@@ -691,10 +806,10 @@ unordered_set<string> Entity::getTargets() {
 		}
 	}
 
-	if (getKeyvalue("classname") == "multi_manager") {
+	if (getKeyvalue(KEY_CLASSNAME) == "multi_manager") {
 		// multi_manager is a special case where the targets are in the key names
-		for (int i = 0; i < keyOrder.size(); i++) {
-			string tname = keyOrder[i];
+		for (int i = 0; i < keyvalues.size(); i++) {
+			string tname = *keyvalues[i].key;
 			size_t hashPos = tname.find("#");
 			string suffix;
 
@@ -736,33 +851,32 @@ bool Entity::hasTarget(const unordered_set<string>& checkNames) {
 void Entity::renameTargetnameValues(string oldTargetname, string newTargetname) {
 	for (int i = 0; i < TOTAL_TARGETNAME_KEYS; i++) {
 		const char* key = potential_targetname_keys[i];
-		auto entkey = keyvalues.find(key);
-		if (entkey != keyvalues.end() && entkey->second == oldTargetname) {
-			keyvalues[key] = newTargetname;
+		int kv = findKeyIdx(key);
+		if (kv != -1 && keyvalues[kv].value == oldTargetname) {
+			keyvalues[kv].value = newTargetname;
 		}
 	}
 
-	if (getKeyvalue("classname") == "multi_manager") {
+	if (getKeyvalue(KEY_CLASSNAME) == "multi_manager") {
 		// multi_manager is a special case where the targets are in the key names
-		for (int i = 0; i < keyOrder.size(); i++) {
-			string tname = keyOrder[i];
+		for (int i = 0; i < keyvalues.size(); i++) {
+			string tname = *keyvalues[i].key;
 			size_t hashPos = tname.find("#");
 			string suffix;
 
 			// duplicate targetnames have a #X suffix to differentiate them
 			if (hashPos != string::npos) {
-				tname = keyOrder[i].substr(0, hashPos);
-				suffix = keyOrder[i].substr(hashPos);
+				suffix = tname.substr(hashPos);
+				tname = tname.substr(0, hashPos);
 			}
 
 			if (tname == oldTargetname) {
-				string newKey = newTargetname + suffix;
-				keyvalues[newKey] = keyvalues[keyOrder[i]];
-				keyvalues.erase(keyOrder[i]);
-				keyOrder[i] = newKey;
+				keyvalues[i].key = internKey(newTargetname + suffix);
 			}
 		}
 	}
+
+	clearCache();
 }
 
 int Entity::getMemoryUsage() {
@@ -771,19 +885,19 @@ int Entity::getMemoryUsage() {
 	for (string tar: cachedTargets) {
 		size += tar.size();
 	}
-	for (int i = 0; i < keyOrder.size(); i++) {
-		size += keyOrder[i].size();
-	}
-	for (const auto& entry : keyvalues) {
-		size += entry.first.size() + entry.second.size();
+	// key names are shared by all entities
+	size += keyvalues.capacity() * sizeof(KeyvalueEntry);
+	size += cachedLumpText.capacity();
+	for (int i = 0; i < keyvalues.size(); i++) {
+		size += keyvalues[i].value.size();
 	}
 
 	return size;
 }
 
 bool Entity::isEverVisible() {
-	string cname = getKeyvalue("classname");
-	string tname = getKeyvalue("targetname");
+	string cname = getKeyvalue(KEY_CLASSNAME);
+	string tname = getKeyvalue(KEY_TARGETNAME);
 
 	static set<string> invisibleEnts = {
 		"env_bubbles",
@@ -835,11 +949,8 @@ string Entity::serialize(bool serializeBspModel) {
 
 	int bspModel = getBspModelIdx();
 
-	for (int k = 0; k < keyOrder.size(); k++) {
-		string key = keyOrder[k];
-		string value = getKeyvalue(key);
-
-		ent_data << "\"" << key << "\" \"" << value << "\"\n";
+	for (int k = 0; k < keyvalues.size(); k++) {
+		ent_data << "\"" << *keyvalues[k].key << "\" \"" << keyvalues[k].value << "\"\n";
 	}
 
 	if (serializeBspModel && bspModel >= 0) {
@@ -852,6 +963,32 @@ string Entity::serialize(bool serializeBspModel) {
 	return ent_data.str();
 }
 
+const string& Entity::getLumpText() {
+	if (cachedLumpTextStamp == editStamp.val) {
+		return cachedLumpText;
+	}
+
+	size_t len = 3; // brackets and newline
+	for (int k = 0; k < keyvalues.size(); k++) {
+		len += keyvalues[k].key->size() + keyvalues[k].value.size() + 6; // quotes, space, and newline
+	}
+
+	cachedLumpText.clear();
+	cachedLumpText.reserve(len);
+	cachedLumpText += "{\n";
+	for (int k = 0; k < keyvalues.size(); k++) {
+		cachedLumpText += '"';
+		cachedLumpText += *keyvalues[k].key;
+		cachedLumpText += "\" \"";
+		cachedLumpText += keyvalues[k].value;
+		cachedLumpText += "\"\n";
+	}
+	cachedLumpText += '}';
+
+	cachedLumpTextStamp = editStamp.val;
+	return cachedLumpText;
+}
+
 bool Entity::deserialize() {
 	if (hasKey("bspguy_binary_data")) {
 		int modelIdx = g_app->mapRenderer->map->add_model(getKeyvalue("bspguy_binary_data"));
@@ -865,6 +1002,7 @@ bool Entity::deserialize() {
 }
 
 void Entity::clearCache() {
+	editStamp.next();
 	cachedModelIdx = -2;
 	targetsCached = false;
 	drawCached = false;
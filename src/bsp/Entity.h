@@ -28,10 +28,21 @@ struct EntRenderOpts {
 	int sequence;
 };
 
+// Changes whenever an entity's keyvalues might have changed, including when an entity is copied or
+// assigned. Stamps are unique across all entities, so an entity can be recognized as unedited by its stamp.
+struct EntEditStamp {
+	uint64_t val;
+
+	EntEditStamp() { next(); }
+	EntEditStamp(const EntEditStamp& other) { next(); }
+	EntEditStamp& operator=(const EntEditStamp& other) { next(); return *this; }
+
+	void next();
+};
+
 class Entity
 {
 public:
-	vector<string> keyOrder;
 	bool hidden = false; // hidden in the 3d view
 	bool highlighted = false; // temporary within a single render call only
 
@@ -54,6 +65,7 @@ public:
 	~Entity(void);
 
 	const string getKeyvalue(string key);
+	const string getKeyvalue(const string* key); // key must be interned
 	unordered_map<string, string> getAllKeyvalues();
 	void removeKeyvalue(const std::string& key);
 	bool renameKey(string oldName, string newName);
@@ -62,6 +74,32 @@ public:
 
 	void setOrAddKeyvalue(const std::string& key, const std::string& value);
 
+	// keys in the order they were added
+	int getKeyCount();
+	const string& getKey(int idx);
+	const string& getValue(int idx);
+	void swapKeys(int idxA, int idxB);
+
+	// Key names are interned so that entities share one copy of each name, and keys can be compared by
+	// pointer. Interned names are never freed. findKey returns NULL if no entity has used the name.
+	static const string* internKey(const string& key);
+	static const string* findKey(const string& key);
+
+	// frequently used key names, interned at startup so that looking them up only compares pointers
+	static const string* const KEY_CLASSNAME;
+	static const string* const KEY_TARGETNAME;
+	static const string* const KEY_TARGET;
+	static const string* const KEY_ORIGIN;
+	static const string* const KEY_ANGLES;
+	static const string* const KEY_ANGLE;
+	static const string* const KEY_MODEL;
+	static const string* const KEY_SPAWNFLAGS;
+
+	uint64_t getEditStamp();
+
+	// the most recent edit stamp given to any entity
+	static uint64_t getLastEditStamp();
+
 	// returns -1 for invalid idx
 	int getBspModelIdx();
 
@@ -94,6 +132,7 @@ public:
 	vec3 getHullOrigin(Bsp* map);
 
 	bool hasKey(const std::string& key);
+	bool hasKey(const string* key); // key must be interned
 
 	unordered_set<string> getTargets();
 
@@ -109,12 +148,28 @@ public:
 
 	string serialize(bool serializeBspModel=false);
 
+	// the entity as it's written to the entity lump, from the opening to the closing bracket.
+	// Cached until the entity is edited.
+	const string& getLumpText();
+
 	bool deserialize();
 
 	void clearCache();
 
 private:
-	unordered_map<string, string> keyvalues;
+	struct KeyvalueEntry {
+		const string* key; // interned
+		string value;
+	};
+	vector<KeyvalueEntry> keyvalues; // in key order
+	EntEditStamp editStamp;
+
+	string cachedLumpText;
+	uint64_t cachedLumpTextStamp = 0; // edit stamp the lump text was generated for
+
+	// returns the index into keyvalues, or -1
+	int findKeyIdx(const string* key);
+	int findKeyIdx(const string& key);
 
 	int cachedModelIdx = -2; // -2 = not cached
 	unordered_set<string> cachedTargets;
@@ -0,0 +1,183 @@
+#include "EntityIndex.h"
+#include "Entity.h"
+#include <algorithm>
+#include <string.h>
+
+using namespace std;
+
+static const vector<int> g_noEnts;
+
+// keeps lists sorted so that the first result is the first matching entity in the map
+static void addSorted(vector<int>& list, int idx) {
+	list.insert(lower_bound(list.begin(), list.end(), idx), idx);
+}
+
+template<typename K>
+static void removeSorted(unordered_map<K, vector<int>>& lists, const K& key, int idx) {
+	auto it = lists.find(key);
+	if (it == lists.end()) {
+		return;
+	}
+
+	vector<int>& list = it->second;
+	auto pos = lower_bound(list.begin(), list.end(), idx);
+	if (pos != list.end() && *pos == idx) {
+		list.erase(pos);
+	}
+	if (list.empty()) {
+		lists.erase(it);
+	}
+}
+
+template<typename K>
+static const vector<int>& findList(unordered_map<K, vector<int>>& lists, const K& key) {
+	auto it = lists.find(key);
+	return it != lists.end() ? it->second : g_noEnts;
+}
+
+EntityIndex::EntityIndex() {
+	clear();
+}
+
+void EntityIndex::update(const vector<Entity*>& ents) {
+	uint64_t editStamp = Entity::getLastEditStamp();
+
+	if (editStamp == lastEditStamp && ents.size() == indexedPtrs.size() &&
+		(ents.empty() || memcmp(&ents[0], &indexedPtrs[0], ents.size() * sizeof(Entity*)) == 0)) {
+		return;
+	}
+
+	vector<int> changed;
+	int commonCount = min(ents.size(), indexed.size());
+	for (int i = 0; i < commonCount; i++) {
+		if (indexed[i].ent != ents[i] || indexed[i].editStamp != ents[i]->getEditStamp()) {
+			changed.push_back(i);
+		}
+	}
+
+	// inserting or deleting near the start of the list moves every entity after it
+	int changeCount = changed.size() + abs((int)ents.size() - (int)indexed.size());
+	if (changeCount > (int)ents.size() / 4) {
+		rebuild(ents);
+	}
+	else {
+		for (int i = indexed.size() - 1; i >= commonCount; i--) {
+			removeEnt(i);
+		}
+		for (int idx : changed) {
+			removeEnt(idx);
+		}
+
+		indexed.resize(ents.size());
+		for (int idx : changed) {
+			addEnt(idx, ents[idx]);
+		}
+		for (int i = commonCount; i < ents.size(); i++) {
+			addEnt(i, ents[i]);
+		}
+	}
+
+	indexedPtrs = ents;
+	lastEditStamp = editStamp;
+}
+
+void EntityIndex::clear() {
+	indexed.clear();
+	indexedPtrs.clear();
+	lastEditStamp = 0;
+	classnames.clear();
+	targetnames.clear();
+	targets.clear();
+	models.clear();
+}
+
+const vector<int>& EntityIndex::findClassname(const string& classname) {
+	return findList(classnames, classname);
+}
+
+const vector<int>& EntityIndex::findTargetname(const string& targetname) {
+	return findList(targetnames, targetname);
+}
+
+const vector<int>& EntityIndex::findTarget(const string& targetname) {
+	return findList(targets, targetname);
+}
+
+const vector<int>& EntityIndex::findModel(int modelIdx) {
+	return findList(models, modelIdx);
+}
+
+vector<int> EntityIndex::getTargetsOf(int entIdx) {
+	if (entIdx < 0 || entIdx >= indexed.size()) {
+		return vector<int>();
+	}
+	return findAll(targetnames, indexed[entIdx].targets);
+}
+
+vector<int> EntityIndex::getCallersOf(int entIdx) {
+	if (entIdx < 0 || entIdx >= indexed.size()) {
+		return vector<int>();
+	}
+	return findAll(targets, indexed[entIdx].targetnames);
+}
+
+vector<int> EntityIndex::findAll(unordered_map<string, vector<int>>& lists, const vector<string>& names) {
+	vector<int> ret;
+	for (const string& name : names) {
+		const vector<int>& found = findList(lists, name);
+		ret.insert(ret.end(), found.begin(), found.end());
+	}
+
+	sort(ret.begin(), ret.end());
+	ret.erase(unique(ret.begin(), ret.end()), ret.end());
+	return ret;
+}
+
+void EntityIndex::rebuild(const vector<Entity*>& ents) {
+	clear();
+	indexed.resize(ents.size());
+	for (int i = 0; i < ents.size(); i++) {
+		addEnt(i, ents[i]);
+	}
+}
+
+void EntityIndex::addEnt(int idx, Entity* ent) {
+	IndexedEnt& entry = indexed[idx];
+	entry.ent = ent;
+	entry.editStamp = ent->getEditStamp();
+	entry.classname = ent->getClassname();
+	entry.model = ent->getBspModelIdx();
+
+	unordered_set<string> tnames = ent->getAllTargetnames();
+	unordered_set<string> targetSet = ent->getTargets();
+	entry.targetnames.assign(tnames.begin(), tnames.end());
+	entry.targets.assign(targetSet.begin(), targetSet.end());
+
+	addSorted(classnames[entry.classname], idx);
+	for (const string& name : entry.targetnames) {
+		addSorted(targetnames[name], idx);
+	}
+	for (const string& name : entry.targets) {
+		addSorted(targets[name], idx);
+	}
+	if (entry.model >= 0) {
+		addSorted(models[entry.model], idx);
+	}
+}
+
+void EntityIndex::removeEnt(int idx) {
+	IndexedEnt& entry = indexed[idx];
+
+	removeSorted(classnames, entry.classname, idx);
+	for (const string& name : entry.targetnames) {
+		removeSorted(targetnames, name, idx);
+	}
+	for (const string& name : entry.targets) {
+		removeSorted(targets, name, idx);
+	}
+	if (entry.model >= 0) {
+		removeSorted(models, entry.model, idx);
+	}
+
+	entry = IndexedEnt();
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <unordered_map>
+#include <vector>
+#include <string>
+#include <stdint.h>
+
+class Entity;
+
+// Finds entities by classname, targetname, target, or BSP model without scanning the entity list.
+// update() re-indexes only the entities that were edited, added, or moved since the last update,
+// which is detected with edit stamps and doesn't depend on how the entity list was modified.
+// Results are entity indexes in ascending order.
+class EntityIndex
+{
+public:
+	EntityIndex();
+
+	// brings the index up to date with the entity list. Costs a comparison of the entity pointers if
+	// nothing was edited since the last update.
+	void update(const std::vector<Entity*>& ents);
+
+	void clear();
+
+	const std::vector<int>& findClassname(const std::string& classname);
+
+	// entities with the given name in a targetname or FGD target_source key
+	const std::vector<int>& findTargetname(const std::string& targetname);
+
+	// entities that target the given name
+	const std::vector<int>& findTarget(const std::string& targetname);
+
+	const std::vector<int>& findModel(int modelIdx);
+
+	// Connections between entities, using the names stored for the entity when it was indexed.
+	// Cost is proportional to the number of connections rather than the number of entities.
+	std::vector<int> getTargetsOf(int entIdx); // entities triggered by the given entity
+	std::vector<int> getCallersOf(int entIdx); // entities that trigger the given entity
+
+private:
+	struct IndexedEnt {
+		Entity* ent;
+		uint64_t editStamp;
+		std::string classname;
+		std::vector<std::string> targetnames;
+		std::vector<std::string> targets;
+		int model;
+	};
+
+	std::vector<IndexedEnt> indexed; // same order as the entity list
+	std::vector<Entity*> indexedPtrs;
+	uint64_t lastEditStamp;
+
+	std::unordered_map<std::string, std::vector<int>> classnames;
+	std::unordered_map<std::string, std::vector<int>> targetnames;
+	std::unordered_map<std::string, std::vector<int>> targets;
+	std::unordered_map<int, std::vector<int>> models;
+
+	void rebuild(const std::vector<Entity*>& ents);
+	void addEnt(int idx, Entity* ent);
+	void removeEnt(int idx);
+
+	// sorted union of the entity lists for the given names
+	std::vector<int> findAll(std::unordered_map<std::string, std::vector<int>>& lists, const std::vector<std::string>& names);
+};
@@ -3,20 +3,30 @@
 
 Keyvalue::Keyvalue(string line)
 {
-	int begin = -1;
-	int end = -1;
+	const char* k;
+	const char* v;
+	int keyLen, valueLen;
+
+	parse(line.c_str(), line.length(), k, keyLen, v, valueLen);
+	key = string(k, keyLen);
+	value = string(v, valueLen);
+}
 
-	key = "";
-	value = "";
+bool Keyvalue::parse(const char* line, int len, const char*& key, int& keyLen, const char*& value, int& valueLen)
+{
+	int begin = -1;
 	int comment = 0;
 
-	for (uint i = 0; i < line.length(); i++)
+	key = value = line;
+	keyLen = valueLen = 0;
+
+	for (int i = 0; i < len; i++)
 	{
 		if (line[i] == '/' && begin == -1)
 		{
 			if (++comment >= 2)
 			{
-				key = value = "";
+				keyLen = valueLen = 0;
 				break;
 			}
 		}
@@ -28,20 +38,23 @@ Keyvalue::Keyvalue(string line)
 				begin = i + 1;
 			else
 			{
-				end = i;
-				if (key.length() == 0)
+				if (keyLen == 0)
 				{
-					key = line.substr(begin,end-begin);
-					begin = end = -1;
+					key = line + begin;
+					keyLen = i - begin;
 				}
 				else
 				{
-					value = line.substr(begin,end-begin);
+					value = line + begin;
+					valueLen = i - begin;
 					break;
 				}
+				begin = -1;
 			}
 		}
 	}
+
+	return keyLen > 0;
 }
 
 Keyvalue::Keyvalue(void)
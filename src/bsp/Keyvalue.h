@@ -13,6 +13,10 @@ public:
 	Keyvalue(void);
 	~Keyvalue(void);
 
+	// finds the quoted key and value in a line of entity text without copying them. A "//" comment
+	// before the first quote clears both. Returns false if the line has no key.
+	static bool parse(const char* line, int len, const char*& key, int& keyLen, const char*& value, int& valueLen);
+
 	vec3 getVector();
 };
 
@@ -0,0 +1,236 @@
+#include "LumpDelta.h"
+#include "util.h"
+#include "lzma_util.h"
+#include <string.h>
+
+// a separate range costs about this many bytes more than storing the equal bytes between two ranges
+#define DELTA_MIN_GAP ((int)sizeof(Range) / 2 + 1)
+
+#define DELTA_MIN_COMPRESS_SIZE 1024 // smaller deltas aren't worth compressing
+#define DELTA_LZMA_PRESET 1
+
+LumpDelta::LumpDelta() {
+	clear();
+}
+
+void LumpDelta::clear() {
+	ranges.clear();
+	data.clear();
+	compressedData.clear();
+	compressedDataSize = 0;
+	oldLen = 0;
+	newLen = 0;
+}
+
+bool LumpDelta::isEmpty() {
+	return ranges.empty();
+}
+
+void LumpDelta::addRange(const byte* oldLump, const byte* newLump, int offset, int oldCount, int newCount) {
+	Range range;
+	range.offset = offset;
+	range.oldLen = oldCount;
+	range.newLen = newCount;
+	range.dataOffset = data.size();
+	ranges.push_back(range);
+
+	data.insert(data.end(), oldLump + offset, oldLump + offset + oldCount);
+	data.insert(data.end(), newLump + offset, newLump + offset + newCount);
+}
+
+bool LumpDelta::create(const byte* a, int aLen, const byte* b, int bLen) {
+	clear();
+	oldLen = aLen;
+	newLen = bLen;
+
+	int minLen = aLen < bLen ? aLen : bLen;
+
+	int prefix = 0;
+	while (prefix + 64 <= minLen && memcmp(a + prefix, b + prefix, 64) == 0) {
+		prefix += 64;
+	}
+	while (prefix < minLen && a[prefix] == b[prefix]) {
+		prefix++;
+	}
+
+	if (prefix == minLen && aLen == bLen) {
+		return false;
+	}
+
+	int suffix = 0;
+	while (suffix < minLen - prefix && a[aLen - 1 - suffix] == b[bLen - 1 - suffix]) {
+		suffix++;
+	}
+
+	// Edits that insert or remove data in the middle of a lump only diff well as a single range between
+	// the common prefix and suffix. Edits that change records in place and/or append to the lump are
+	// better stored as several ranges over the common length, plus the tail.
+	int singleSize = (aLen - prefix - suffix) + (bLen - prefix - suffix) + sizeof(Range);
+
+	int end = aLen == bLen ? aLen - suffix : minLen;
+	int multiSize = 0;
+	vector<Range> multi;
+
+	for (int i = prefix; i < end; ) {
+		while (i + 64 <= end && memcmp(a + i, b + i, 64) == 0) {
+			i += 64;
+		}
+		while (i < end && a[i] == b[i]) {
+			i++;
+		}
+		if (i >= end) {
+			break;
+		}
+
+		// extend the range until enough equal bytes are found to make a new range worth it
+		int start = i;
+		int equalRun = 0;
+		while (i < end && equalRun < DELTA_MIN_GAP) {
+			equalRun = a[i] == b[i] ? equalRun + 1 : 0;
+			i++;
+		}
+
+		Range range;
+		range.offset = start;
+		range.oldLen = range.newLen = (i - equalRun) - start;
+		multi.push_back(range);
+		multiSize += range.oldLen * 2 + sizeof(Range);
+	}
+
+	if (aLen != bLen) {
+		if (!multi.empty() && multi.back().offset + multi.back().oldLen == minLen) {
+			Range& last = multi.back();
+			multiSize += (aLen - minLen) + (bLen - minLen);
+			last.oldLen += aLen - minLen;
+			last.newLen += bLen - minLen;
+		}
+		else {
+			Range range;
+			range.offset = minLen;
+			range.oldLen = aLen - minLen;
+			range.newLen = bLen - minLen;
+			multi.push_back(range);
+			multiSize += range.oldLen + range.newLen + sizeof(Range);
+		}
+	}
+
+	if (singleSize <= multiSize) {
+		addRange(a, b, prefix, aLen - prefix - suffix, bLen - prefix - suffix);
+	}
+	else {
+		ranges.reserve(multi.size());
+		data.reserve(multiSize);
+		for (int i = 0; i < multi.size(); i++) {
+			addRange(a, b, multi[i].offset, multi[i].oldLen, multi[i].newLen);
+		}
+	}
+
+	return true;
+}
+
+byte* LumpDelta::apply(const byte* src, int srcLen, bool reverse, int& outLen) {
+	int fromLen = reverse ? newLen : oldLen;
+	int toLen = reverse ? oldLen : newLen;
+
+	if (srcLen != fromLen || !decompress()) {
+		return NULL;
+	}
+
+	// the changed bytes in src must match what was stored for them
+	for (int i = 0; i < ranges.size(); i++) {
+		Range& range = ranges[i];
+		const byte* expected = data.data() + range.dataOffset + (reverse ? range.oldLen : 0);
+		int len = reverse ? range.newLen : range.oldLen;
+		if (len && memcmp(src + range.offset, expected, len) != 0) {
+			return NULL;
+		}
+	}
+
+	byte* out = new byte[toLen];
+	int srcPos = 0;
+	int outPos = 0;
+
+	for (int i = 0; i < ranges.size(); i++) {
+		Range& range = ranges[i];
+		int fromCount = reverse ? range.newLen : range.oldLen;
+		int toCount = reverse ? range.oldLen : range.newLen;
+		const byte* replacement = data.data() + range.dataOffset + (reverse ? 0 : range.oldLen);
+
+		memcpy(out + outPos, src + srcPos, range.offset - srcPos);
+		outPos += range.offset - srcPos;
+
+		if (toCount) {
+			memcpy(out + outPos, replacement, toCount);
+		}
+		outPos += toCount;
+		srcPos = range.offset + fromCount;
+	}
+
+	memcpy(out + outPos, src + srcPos, srcLen - srcPos);
+	outLen = toLen;
+
+	return out;
+}
+
+int LumpDelta::memoryUsage() {
+	return sizeof(LumpDelta) + ranges.size() * sizeof(Range) + data.size() + compressedData.size();
+}
+
+bool LumpDelta::compress() {
+	if (isCompressed() || data.size() < DELTA_MIN_COMPRESS_SIZE) {
+		return false;
+	}
+
+	vector<uint8_t> compressed;
+	if (!lzmaCompressMemory(data.data(), data.size(), compressed, DELTA_LZMA_PRESET) || compressed.size() >= data.size()) {
+		return false;
+	}
+
+	compressedDataSize = data.size();
+	compressedData.swap(compressed);
+	vector<byte>().swap(data);
+
+	return true;
+}
+
+bool LumpDelta::decompress() {
+	if (!isCompressed()) {
+		return true;
+	}
+
+	vector<uint8_t> decompressed;
+	decompressed.reserve(compressedDataSize);
+	if (!lzmaDecompress(compressedData.data(), compressedData.size(), decompressed) || decompressed.size() != compressedDataSize) {
+		logf("Failed to decompress lump delta\n");
+		return false;
+	}
+
+	data.swap(decompressed);
+	vector<byte>().swap(compressedData);
+	compressedDataSize = 0;
+
+	return true;
+}
+
+bool LumpDelta::isCompressed() {
+	return !compressedData.empty();
+}
+
+int LumpDelta::uncompressedSize() {
+	return compressedDataSize;
+}
+
+bool createLumpDeltas(LumpState& oldState, LumpState& newState, LumpDelta* deltas) {
+	bool anyDifference = false;
+
+	for (int i = 0; i < HEADER_LUMPS; i++) {
+		deltas[i].clear();
+
+		if (oldState.lumps[i] && newState.lumps[i]) {
+			anyDifference |= deltas[i].create(oldState.lumps[i].get(), oldState.lumpLen[i],
+				newState.lumps[i].get(), newState.lumpLen[i]);
+		}
+	}
+
+	return anyDifference;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include "bsptypes.h"
+#include <vector>
+
+// Differences between two versions of a lump, stored as the byte ranges that changed. Holds both sides of
+// each range, so it can rebuild either version from the other.
+class LumpDelta
+{
+public:
+	LumpDelta();
+
+	// stores the ranges that differ between the two versions, replacing anything stored before.
+	// Returns false if the versions are identical.
+	bool create(const byte* oldLump, int oldLen, const byte* newLump, int newLen);
+
+	void clear();
+
+	// true if there are no differences stored
+	bool isEmpty();
+
+	// returns a new buffer holding the new version of the lump, given the old version (or the reverse).
+	// Returns NULL if src doesn't match the version the delta was created from.
+	byte* apply(const byte* src, int srcLen, bool reverse, int& outLen);
+
+	// bytes used by the changed ranges and their headers
+	int memoryUsage();
+
+	// compresses the changed ranges. They're decompressed the next time the delta is applied.
+	// Returns false if the data is too small or doesn't compress.
+	bool compress();
+
+	bool isCompressed();
+
+	// size of the changed ranges before they were compressed, or 0 if they aren't compressed
+	int uncompressedSize();
+
+private:
+	struct Range {
+		int offset; // same in both versions, because ranges before it don't change the length
+		int oldLen;
+		int newLen;
+		int dataOffset; // old bytes, followed by new bytes
+	};
+
+	std::vector<Range> ranges;
+	std::vector<byte> data;
+	std::vector<byte> compressedData; // replaces data while compressed
+	int compressedDataSize; // size of data before compression
+	int oldLen;
+	int newLen;
+
+	void addRange(const byte* oldLump, const byte* newLump, int offset, int oldCount, int newCount);
+	bool decompress();
+};
+
+// creates deltas for lumps that are set in both states. Returns true if any lump differs.
+bool createLumpDeltas(LumpState& oldState, LumpState& newState, LumpDelta* deltas);
@@ -0,0 +1,150 @@
+#include "PvsCache.h"
+#include "util.h"
+
+PvsCache::PvsCache() {
+	initialized = false;
+	rowWords = 0;
+	cachedRows = 0;
+	clear();
+}
+
+PvsCache::~PvsCache() {
+	clear();
+}
+
+void PvsCache::init(BSPLEAF* leaves, int leafCount, int visLeafCount, byte* visLump, int visLength) {
+	clear();
+
+	this->leaves = leaves;
+	this->leafCount = leafCount;
+	this->visLeafCount = visLeafCount < leafCount ? visLeafCount : leafCount - 1;
+	this->visLump = visLump;
+	this->visLength = visLength;
+	initialized = true;
+
+	if (this->visLeafCount < 0) {
+		this->visLeafCount = 0;
+	}
+
+	rowWords = (this->visLeafCount + 63) / 64;
+	rows.resize(this->visLeafCount, NULL);
+	scratch.resize(rowWords);
+}
+
+bool PvsCache::matches(BSPLEAF* leaves, int leafCount, int visLeafCount, byte* visLump, int visLength) {
+	return initialized && this->leaves == leaves && this->leafCount == leafCount && this->visLump == visLump
+		&& this->visLength == visLength && this->visLeafCount == (visLeafCount < leafCount ? visLeafCount : leafCount - 1);
+}
+
+void PvsCache::clear() {
+	for (int i = 0; i < rows.size(); i++) {
+		delete[] rows[i];
+	}
+	rows.clear();
+	scratch.clear();
+
+	leaves = NULL;
+	leafCount = 0;
+	visLeafCount = 0;
+	visLump = NULL;
+	visLength = 0;
+	rowWords = 0;
+	cachedRows = 0;
+	initialized = false;
+}
+
+void PvsCache::buildAll() {
+	for (int i = 1; i <= visLeafCount; i++) {
+		if (!getRow(i) || !rows[i - 1]) {
+			break; // out of memory budget
+		}
+	}
+}
+
+bool PvsCache::isVisible(int leafA, int leafB) {
+	if (leafB < 1 || leafB > visLeafCount) {
+		return false;
+	}
+
+	const uint64_t* row = getRow(leafA);
+	if (!row) {
+		return false;
+	}
+
+	int bit = leafB - 1;
+	return (row[bit >> 6] >> (bit & 63)) & 1;
+}
+
+const uint64_t* PvsCache::getRow(int leaf) {
+	if (leaf < 1 || leaf > visLeafCount) {
+		return NULL;
+	}
+
+	uint64_t*& row = rows[leaf - 1];
+	if (row) {
+		return row;
+	}
+
+	size_t rowBytes = rowWords * sizeof(uint64_t);
+	if (memoryUsage() + rowBytes > memoryLimit) {
+		decompressRow(leaf, &scratch[0]);
+		return &scratch[0];
+	}
+
+	row = new uint64_t[rowWords];
+	decompressRow(leaf, row);
+	cachedRows++;
+
+	return row;
+}
+
+int PvsCache::countVisible(int leaf) {
+	const uint64_t* row = getRow(leaf);
+	if (!row) {
+		return 0;
+	}
+
+	int count = 0;
+	for (int w = 0; w < rowWords; w++) {
+		uint64_t bits = row[w];
+		while (bits) {
+			bits &= bits - 1;
+			count++;
+		}
+	}
+	return count;
+}
+
+size_t PvsCache::memoryUsage() {
+	return (size_t)cachedRows * rowWords * sizeof(uint64_t);
+}
+
+size_t PvsCache::fullMemoryUsage() {
+	return (size_t)visLeafCount * rowWords * sizeof(uint64_t);
+}
+
+int PvsCache::cachedRowCount() {
+	return cachedRows;
+}
+
+void PvsCache::decompressRow(int leaf, uint64_t* dest) {
+	size_t rowBytes = rowWords * sizeof(uint64_t);
+	int offset = leaves[leaf].nVisOffset;
+
+	if (!visLump || offset < 0 || offset >= visLength) {
+		// no vis data, so everything is visible
+		memset(dest, 0xff, rowBytes);
+	}
+	else {
+		memset(dest, 0, rowBytes);
+		if (!DecompressVis(visLump + offset, (byte*)dest, rowBytes, visLeafCount, visLump, visLength)) {
+			logf("Failed to decompress VIS for leaf %d\n", leaf);
+		}
+	}
+
+	// unused bits at the end of a row are sometimes set randomly
+	int usedBits = visLeafCount % 64;
+	if (usedBits) {
+		dest[rowWords - 1] &= (1ULL << usedBits) - 1;
+	}
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include "bsptypes.h"
+#include "vis.h"
+#include <vector>
+#include <stdint.h>
+
+// Decompressed PVS rows for the world leaves of a map. Each row is a bitset padded to a multiple of 64
+// leaves, where bit i is set if leaf i+1 is potentially visible (the shared solid leaf 0 has no bit).
+// Rows are decompressed on first use, or all at once with buildAll(). The cache points into the leaf
+// and vis lumps, so it must be cleared when either is replaced. Not thread-safe.
+class PvsCache
+{
+public:
+	// rows stop being cached once they would use more than this many bytes. Rows that don't fit are
+	// decompressed into a scratch row on each query instead.
+	size_t memoryLimit = 64 * 1024 * 1024;
+
+	PvsCache();
+	~PvsCache();
+
+	// sets the vis data that rows are decompressed from, freeing rows from any earlier data.
+	// visLeafCount should exclude the shared solid leaf 0
+	void init(BSPLEAF* leaves, int leafCount, int visLeafCount, byte* visLump, int visLength);
+
+	// true if init() was called with exactly these arguments, and the cache wasn't cleared since
+	bool matches(BSPLEAF* leaves, int leafCount, int visLeafCount, byte* visLump, int visLength);
+
+	void clear();
+
+	// decompresses every row that fits in the memory limit
+	void buildAll();
+
+	// true if leafB is in the PVS of leafA. False for leaves without vis data (solid leaf 0 or submodel leaves)
+	bool isVisible(int leafA, int leafB);
+
+	// returns the row for the given leaf, or NULL if it has no vis data. Scratch rows are only valid
+	// until the next query.
+	const uint64_t* getRow(int leaf);
+
+	// calls func(leafIdx) for each leaf in the PVS of the given leaf, in increasing order
+	template<typename F>
+	void forEachVisible(int leaf, F func) {
+		const uint64_t* row = getRow(leaf);
+		if (!row) {
+			return;
+		}
+
+		for (int w = 0; w < rowWords; w++) {
+			uint64_t bits = row[w];
+			while (bits) {
+				func(w * 64 + countTrailingZeros64(bits) + 1);
+				bits &= bits - 1; // clear lowest set bit
+			}
+		}
+	}
+
+	// number of leaves in the PVS of the given leaf
+	int countVisible(int leaf);
+
+	// bytes used by cached rows
+	size_t memoryUsage();
+
+	// bytes needed to cache every row
+	size_t fullMemoryUsage();
+
+	int cachedRowCount();
+
+private:
+	BSPLEAF* leaves;
+	int leafCount;
+	int visLeafCount;
+	byte* visLump;
+	int visLength;
+	bool initialized;
+
+	int rowWords; // 64-bit words per row
+	std::vector<uint64_t*> rows; // NULL until decompressed, indexed by leaf-1
+	std::vector<uint64_t> scratch;
+	int cachedRows;
+
+	void decompressRow(int leaf, uint64_t* dest);
+};
@@ -0,0 +1,82 @@
+#pragma once
+#include <unordered_map>
+#include <string.h>
+#include <stdint.h>
+
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+
+// 64-bit FNV-1a hash. Pass the result of a previous call as the seed to hash data in multiple parts.
+inline uint64_t hashBytes(const void* dat, size_t len, uint64_t seed=FNV_OFFSET_BASIS) {
+	const uint8_t* bytes = (const uint8_t*)dat;
+	uint64_t hash = seed;
+	for (size_t i = 0; i < len; i++) {
+		hash = (hash ^ bytes[i]) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+// Finds exact duplicates of BSP structs (planes, texinfos, etc.) in constant time.
+// Values are compared bit-for-bit like memcmp, so the struct must not contain padding.
+// When a value occurs more than once, the first index added for it is the one returned.
+template<typename T>
+class StructIndex
+{
+public:
+	// clears the index and adds every value in the array
+	void build(const T* vals, int count) {
+		clear();
+		index.reserve(count);
+		update(vals, count);
+	}
+
+	// adds values appended to the array since the last build/update.
+	// The index is rebuilt if the array has shrunk.
+	void update(const T* vals, int count) {
+		if (count < indexedCount) {
+			build(vals, count);
+			return;
+		}
+		for (int i = indexedCount; i < count; i++) {
+			index.insert(std::make_pair(vals[i], i));
+		}
+		indexedCount = count;
+	}
+
+	// adds a single value, unless an identical value was added before
+	void add(const T& val, int idx) {
+		index.insert(std::make_pair(val, idx));
+		if (idx >= indexedCount)
+			indexedCount = idx + 1;
+	}
+
+	// returns the index of an identical value, or -1 if there isn't one
+	int find(const T& val) const {
+		auto it = index.find(val);
+		return it != index.end() ? it->second : -1;
+	}
+
+	void clear() {
+		index.clear();
+		indexedCount = 0;
+	}
+
+	size_t size() const {
+		return index.size();
+	}
+
+private:
+	struct Hasher {
+		size_t operator()(const T& val) const {
+			return (size_t)hashBytes(&val, sizeof(T));
+		}
+	};
+
+	struct Equal {
+		bool operator()(const T& a, const T& b) const {
+			return memcmp(&a, &b, sizeof(T)) == 0;
+		}
+	};
+
+	std::unordered_map<T, int, Hasher, Equal> index;
+	int indexedCount = 0;
+};
@@ -0,0 +1,114 @@
+#include "TextureCache.h"
+#include "util.h"
+
+TextureCache g_textureCache(256 * 1024 * 1024);
+
+CachedTexture::CachedTexture() {
+	rgba = NULL;
+	size = 0;
+}
+
+CachedTexture::~CachedTexture() {
+	delete[] tex.data;
+	delete[] rgba;
+}
+
+TextureCache::TextureCache(size_t budget) {
+	this->budget = budget;
+}
+
+std::shared_ptr<const CachedTexture> TextureCache::get(Wad* wad, int dirIndex) {
+	if (dirIndex < 0 || dirIndex >= wad->numTex) {
+		return NULL;
+	}
+
+	WADDIRENTRY& entry = wad->dirEntries[dirIndex];
+	string name = toLowerCase(string(entry.szName, strnlen(entry.szName, MAXTEXTURENAME)));
+	string key = wad->filename + "\n" + to_string(wad->modifiedTime) + "\n" + name;
+
+	{
+		std::lock_guard<std::mutex> lk(lock);
+		auto it = entries.find(key);
+		if (it != entries.end()) {
+			lru.splice(lru.begin(), lru, it->second);
+			hits++;
+			return it->second->second;
+		}
+		misses++;
+	}
+
+	// decoded without holding the lock so that other threads aren't blocked by the read
+	WADTEX* wadTex = wad->readTexture(dirIndex);
+	if (!wadTex) {
+		return NULL;
+	}
+
+	CachedTexture* decoded = new CachedTexture();
+	decoded->tex = *wadTex;
+	delete wadTex;
+
+	int sz = decoded->tex.nWidth * decoded->tex.nHeight;
+	COLOR3* palette = decoded->tex.getPalette();
+	byte* src = decoded->tex.data;
+	bool hasAlpha = decoded->tex.szName[0] == '{';
+
+	decoded->rgba = new COLOR4[sz];
+	for (int i = 0; i < sz; i++) {
+		decoded->rgba[i] = COLOR4(palette[src[i]], 255);
+
+		if (hasAlpha && src[i] == 255)
+			decoded->rgba[i].a = 0;
+	}
+	decoded->size = decoded->tex.getDataSize() + 2 + sz * sizeof(COLOR4);
+
+	std::shared_ptr<const CachedTexture> tex(decoded);
+
+	std::lock_guard<std::mutex> lk(lock);
+	auto it = entries.find(key);
+	if (it != entries.end()) {
+		return it->second->second; // another thread decoded it first
+	}
+
+	lru.push_front(Entry(key, tex));
+	entries[key] = lru.begin();
+	bytes += decoded->size;
+	evict();
+
+	return tex;
+}
+
+void TextureCache::setBudget(size_t bytes) {
+	std::lock_guard<std::mutex> lk(lock);
+	budget = bytes;
+	evict();
+}
+
+void TextureCache::clear() {
+	std::lock_guard<std::mutex> lk(lock);
+	lru.clear();
+	entries.clear();
+	bytes = 0;
+}
+
+TextureCacheStats TextureCache::getStats() {
+	std::lock_guard<std::mutex> lk(lock);
+
+	TextureCacheStats stats;
+	stats.hits = hits;
+	stats.misses = misses;
+	stats.evictions = evictions;
+	stats.bytes = bytes;
+	stats.budget = budget;
+	stats.count = lru.size();
+	return stats;
+}
+
+void TextureCache::evict() {
+	while (bytes > budget && !lru.empty()) {
+		Entry& oldest = lru.back();
+		bytes -= oldest.second->size;
+		entries.erase(oldest.first);
+		lru.pop_back();
+		evictions++;
+	}
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include "Wad.h"
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// A WAD texture and its decoded pixels, shared by everything that loaded it from the cache
+struct CachedTexture
+{
+	WADTEX tex; // mip data and palette, owned by this object
+	COLOR4* rgba; // mip 0 expanded through the palette. Index 255 is transparent in masked ('{') textures.
+	size_t size; // bytes of pixel data held
+
+	CachedTexture();
+	~CachedTexture();
+};
+
+struct TextureCacheStats
+{
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	size_t bytes;
+	size_t budget;
+	int count;
+};
+
+// Keeps recently used WAD textures decoded in memory so that they aren't read and decoded again when
+// a map is reloaded or another map uses the same WADs. Textures are keyed by WAD path, WAD modified
+// time, and texture name, so edited WADs are never served from stale entries. The least recently used
+// textures are dropped once the cache grows past its byte budget. Safe to use from multiple threads.
+class TextureCache
+{
+public:
+	TextureCache(size_t budget);
+
+	// returns the texture at the given WAD directory index, decoding it if it isn't cached.
+	// Returns NULL if the WAD can't provide it. Entries stay valid after being evicted for as long
+	// as the returned pointer is held.
+	std::shared_ptr<const CachedTexture> get(Wad* wad, int dirIndex);
+
+	// evicts textures until the cache fits in the new budget
+	void setBudget(size_t bytes);
+
+	void clear();
+
+	TextureCacheStats getStats();
+
+private:
+	typedef std::pair<std::string, std::shared_ptr<const CachedTexture>> Entry;
+
+	std::mutex lock;
+	std::list<Entry> lru; // most recently used first
+	std::unordered_map<std::string, std::list<Entry>::iterator> entries;
+	size_t budget;
+	size_t bytes = 0;
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	uint64_t evictions = 0;
+
+	// drops least recently used textures until the cache is within budget. Must hold the lock.
+	void evict();
+};
+
+extern TextureCache g_textureCache;
@@ -0,0 +1,140 @@
+#include "TextureIndex.h"
+#include "StructIndex.h"
+#include "util.h"
+#include <algorithm>
+
+TextureIndex::TextureIndex() {
+	clear();
+}
+
+void TextureIndex::build(byte* textureLump, int textureLumpLen) {
+	clear();
+
+	lump = textureLump;
+	lumpLen = textureLumpLen;
+	texCount = textureLump && textureLumpLen >= (int)sizeof(int32_t) ? *((int32_t*)textureLump) : 0;
+	built = true;
+
+	names.reserve(texCount);
+	contents.reserve(texCount);
+
+	for (int i = 0; i < texCount; i++) {
+		BSPMIPTEX* tex = getTexture(i);
+		if (!tex) {
+			continue;
+		}
+
+		string name = toLowerCase(string(tex->szName, strnlen(tex->szName, MAXTEXTURENAME)));
+		names.insert(std::make_pair(name, i)); // keeps the first texture with this name
+
+		contents.insert(std::make_pair(hashBytes(tex, getBspTextureSize(tex)), i));
+	}
+}
+
+void TextureIndex::clear() {
+	lump = NULL;
+	lumpLen = 0;
+	texCount = 0;
+	built = false;
+	names.clear();
+	contents.clear();
+}
+
+bool TextureIndex::isBuilt() {
+	return built;
+}
+
+int TextureIndex::findName(const char* name) {
+	if (!name || name[0] == '\0')
+		return -1;
+
+	auto it = names.find(toLowerCase(name));
+	return it != names.end() ? it->second : -1;
+}
+
+int TextureIndex::findTexture(BSPMIPTEX* tex) {
+	int sz = getBspTextureSize(tex);
+	int bestIdx = -1;
+
+	auto range = contents.equal_range(hashBytes(tex, sz));
+	for (auto it = range.first; it != range.second; ++it) {
+		BSPMIPTEX* other = getTexture(it->second);
+		if (getBspTextureSize(other) == sz && memcmp(tex, other, sz) == 0) {
+			if (bestIdx == -1 || it->second < bestIdx) {
+				bestIdx = it->second;
+			}
+		}
+	}
+
+	return bestIdx;
+}
+
+vector<vector<int>> TextureIndex::findPixelDuplicates() {
+	unordered_map<uint64_t, vector<int>> buckets;
+
+	for (int i = 0; i < texCount; i++) {
+		BSPMIPTEX* tex = getTexture(i);
+		if (!tex || tex->nOffsets[0] == 0) {
+			continue; // not embedded
+		}
+
+		int pixelSz = getBspTextureSize(tex) - sizeof(BSPMIPTEX);
+		uint64_t hash = hashBytes(&tex->nWidth, sizeof(uint32_t) * 2);
+		hash = hashBytes((byte*)tex + sizeof(BSPMIPTEX), pixelSz, hash);
+		buckets[hash].push_back(i);
+	}
+
+	vector<vector<int>> groups;
+
+	for (auto it = buckets.begin(); it != buckets.end(); ++it) {
+		vector<int>& bucket = it->second;
+
+		// split hash collisions into groups of identical textures
+		while (bucket.size() > 1) {
+			BSPMIPTEX* first = getTexture(bucket[0]);
+			int pixelSz = getBspTextureSize(first) - sizeof(BSPMIPTEX);
+
+			vector<int> group;
+			vector<int> remaining;
+			group.push_back(bucket[0]);
+
+			for (int k = 1; k < bucket.size(); k++) {
+				BSPMIPTEX* tex = getTexture(bucket[k]);
+				if (tex->nWidth == first->nWidth && tex->nHeight == first->nHeight &&
+					memcmp((byte*)tex + sizeof(BSPMIPTEX), (byte*)first + sizeof(BSPMIPTEX), pixelSz) == 0) {
+					group.push_back(bucket[k]);
+				}
+				else {
+					remaining.push_back(bucket[k]);
+				}
+			}
+
+			if (group.size() > 1) {
+				groups.push_back(group);
+			}
+			bucket = remaining;
+		}
+	}
+
+	std::sort(groups.begin(), groups.end());
+
+	return groups;
+}
+
+BSPMIPTEX* TextureIndex::getTexture(int idx) {
+	if (idx < 0 || idx >= texCount || (idx + 2) * (int)sizeof(int32_t) > lumpLen) {
+		return NULL;
+	}
+
+	int32_t offset = ((int32_t*)lump)[idx + 1];
+	if (offset < 0 || offset + (int)sizeof(BSPMIPTEX) > lumpLen) {
+		return NULL;
+	}
+
+	BSPMIPTEX* tex = (BSPMIPTEX*)(lump + offset);
+	if (offset + getBspTextureSize(tex) > lumpLen) {
+		return NULL;
+	}
+
+	return tex;
+}
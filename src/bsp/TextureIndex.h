@@ -0,0 +1,44 @@
+#pragma once
+#include "bsptypes.h"
+#include <unordered_map>
+#include <vector>
+#include <string>
+
+// Looks up textures in a BSP texture lump by name or by content in constant time.
+// The index points into the lump, so it must be rebuilt after the lump is edited or freed.
+class TextureIndex
+{
+public:
+	TextureIndex();
+
+	// indexes all textures in the lump, replacing anything indexed before
+	void build(byte* textureLump, int lumpLen);
+
+	void clear();
+
+	// false until build() is called, or after clear()
+	bool isBuilt();
+
+	// returns the index of the first texture with the given name (case-insensitive), or -1
+	int findName(const char* name);
+
+	// returns the index of the first texture that's byte-identical to the given one
+	// (same name, dimensions, and embedded pixel data), or -1
+	int findTexture(BSPMIPTEX* tex);
+
+	// returns groups of embedded textures that have identical dimensions and pixel data, regardless
+	// of name. Each group is sorted by texture index.
+	std::vector<std::vector<int>> findPixelDuplicates();
+
+private:
+	byte* lump;
+	int lumpLen;
+	int texCount;
+	bool built;
+
+	std::unordered_map<std::string, int> names; // lowercase name -> first texture with that name
+	std::unordered_multimap<uint64_t, int> contents; // content hash -> texture
+
+	// returns NULL for missing textures or textures that extend past the end of the lump
+	BSPMIPTEX* getTexture(int idx);
+};
@@ -12,6 +12,7 @@
 
 Wad::Wad(void)
 {
+	numTex = -1;
 	dirEntries = NULL;
 }
 
@@ -23,9 +24,21 @@ Wad::Wad( const string& file )
 }
 
 Wad::~Wad(void)
+{
+	close();
+}
+
+void Wad::close()
 {
 	if (dirEntries)
 		delete [] dirEntries;
+	dirEntries = NULL;
+	numTex = 0;
+	nameIndex.clear();
+
+	if (file)
+		delete file;
+	file = NULL;
 }
 
 string Wad::getName() {
@@ -39,155 +52,166 @@ string Wad::getName() {
 
 bool Wad::readInfo()
 {
-	string file = filename;
+	close();
 
-	if (!fileExists(file))
+	if (!fileExists(filename))
 	{
 		logf("%s does not exist!\n", filename.c_str());
 		return false;
 	}
 
-	ifstream fin(file, ifstream::in|ios::binary);
-	if (!fin.good())
-		return false;
-
-	uint begin = fin.tellg();
-	fin.seekg (0, ios::end);
-	uint end = fin.tellg();
-	uint sz = end - begin;
-	fin.seekg(0, ios::beg);
+	modifiedTime = fileModifiedTime(filename);
 
-	if (sz < sizeof(WADHEADER))
+	file = new MappedFile();
+	if (!file->open(filename) || file->size() < sizeof(WADHEADER))
 	{
-		fin.close();
+		close();
 		return false;
 	}
 
+	byte* fileData = file->data();
+	size_t sz = file->size();
+
 	//
 	// WAD HEADER
 	//
-	fin.read((char*)&header, sizeof(WADHEADER)); 
+	memcpy(&header, fileData, sizeof(WADHEADER));
 
-	if (string(header.szMagic).find("WAD3") != 0)
+	if (memcmp(header.szMagic, "WAD3", 4) != 0 || header.nDirOffset < 0 || (size_t)header.nDirOffset >= sz)
 	{
-		fin.close();
-		return false;
-	}
-
-	if (header.nDirOffset >= sz)
-	{
-		fin.close();
+		close();
 		return false;
 	}
 
 	//
 	// WAD DIRECTORY ENTRIES
 	//
-	fin.seekg(header.nDirOffset);
 	numTex = header.nDir;
+	if (numTex < 0 || (size_t)header.nDirOffset + (size_t)numTex * sizeof(WADDIRENTRY) > sz)
+	{
+		logf("Unexpected end of WAD\n");
+		close();
+		return false;
+	}
+
 	dirEntries = new WADDIRENTRY[numTex];
+	memcpy(dirEntries, fileData + header.nDirOffset, numTex * sizeof(WADDIRENTRY));
 
 	bool usableTextures = false;
+	nameIndex.reserve(numTex);
 	for (int i = 0; i < numTex; i++)
 	{
-		if (fin.eof()) { logf("Unexpected end of WAD\n"); return false; }
-		fin.read((char*)&dirEntries[i], sizeof(WADDIRENTRY)); 
 		if (dirEntries[i].nType == 0x43) usableTextures = true;
+
+		string name = toLowerCase(string(dirEntries[i].szName, strnlen(dirEntries[i].szName, MAXTEXTURENAME)));
+		nameIndex.insert(std::make_pair(name, i)); // keeps the first entry with this name
 	}
-	fin.close();
 
 	if (!usableTextures)
 	{
-		delete [] dirEntries;
-		dirEntries = NULL;
+		close();
 		header.nDir = 0;
 		logf("%s contains no regular textures\n", filename.c_str());
 		return false; // we can't use these types of textures (see fonts.wad as an example)
 	}
-	
 
 	return true;
 }
 
-bool Wad::hasTexture(string name)
+bool Wad::hasTexture(const string& name)
 {
-	for (int d = 0; d < header.nDir; d++)
-		if (strcasecmp(name.c_str(), dirEntries[d].szName) == 0)
-			return true;
-	return false;
+	return findTexture(name) != -1;
 }
 
-WADTEX * Wad::readTexture( int dirIndex )
+int Wad::findTexture(const string& name)
 {
-	if (dirIndex < 0 || dirIndex >= numTex)
-	{
-		logf("invalid wad directory index\n");
-		return NULL;
-	}
-	//if (cache != NULL)
-		//return cache[dirIndex];
-	string name = string(dirEntries[dirIndex].szName);
-	return readTexture(name);
+	auto it = nameIndex.find(toLowerCase(name));
+	return it != nameIndex.end() ? it->second : -1;
 }
 
-WADTEX * Wad::readTexture( const string& texname )
+vector<int> Wad::findTextures(const vector<string>& names)
 {
-	string path = filename;
-	const char * file = (path.c_str());
+	vector<int> indexes(names.size(), -1);
+	if (nameIndex.empty())
+		return indexes;
 
-	ifstream fin(file, ifstream::in|ios::binary);
-	if (!fin.good())
-		return NULL;
-
-	int idx = -1;
-	for (int d = 0; d < header.nDir; d++)
+	string lowerName;
+	for (int i = 0; i < names.size(); i++)
 	{
-		if (strcasecmp(texname.c_str(), dirEntries[d].szName) == 0)
-		{
-			idx = d;
-			break;
-		}
-	}
+		lowerName.resize(names[i].size());
+		for (int k = 0; k < names[i].size(); k++)
+			lowerName[k] = tolower(names[i][k]);
 
-	if (idx < 0)
-	{
-		fin.close();
-		return NULL;
+		auto it = nameIndex.find(lowerName);
+		if (it != nameIndex.end())
+			indexes[i] = it->second;
 	}
-	if (dirEntries[idx].bCompression)
+
+	return indexes;
+}
+
+bool Wad::viewTexture(int dirIndex, WADTEX& out)
+{
+	if (!file || dirIndex < 0 || dirIndex >= numTex)
+		return false;
+
+	WADDIRENTRY& entry = dirEntries[dirIndex];
+	if (entry.bCompression)
 	{
 		logf("OMG texture is compressed. I'm too scared to load it :<\n");
-		return NULL;
+		return false;
 	}
-	fin.seekg(dirEntries[idx].nFilePos);
 
-	BSPMIPTEX mtex;
-	fin.read((char*)&mtex, sizeof(BSPMIPTEX));
+	size_t sz = file->size();
+	if (entry.nFilePos < 0 || (size_t)entry.nFilePos + sizeof(BSPMIPTEX) > sz)
+		return false;
 
-	int w = mtex.nWidth;
-	int h = mtex.nHeight;
-	int sz = w*h;	   // miptex 0
-	int sz2 = sz / 4;  // miptex 1
-	int sz3 = sz2 / 4; // miptex 2
-	int sz4 = sz3 / 4; // miptex 3
-	int szAll = sz + sz2 + sz3 + sz4 + 2 + 256*3 + 2;
+	BSPMIPTEX* mtex = (BSPMIPTEX*)(file->data() + entry.nFilePos);
 
-	byte * data = new byte[szAll];
-	fin.read((char*)data, szAll);		
-	
-	fin.close();
+	// mip data always follows the header, like the game reads it
+	uint64_t mipSz = (uint64_t)mtex->nWidth * mtex->nHeight;
+	uint64_t dataSz = mipSz + mipSz / 4 + mipSz / 16 + mipSz / 64 + 2 + 256 * 3;
+	if ((size_t)entry.nFilePos + sizeof(BSPMIPTEX) + dataSz > sz)
+		return false;
 
-	WADTEX * tex = new WADTEX;
 	for (int i = 0; i < MAXTEXTURENAME; i++)
-		tex->szName[i] = mtex.szName[i];
+		out.szName[i] = mtex->szName[i];
 	for (int i = 0; i < MIPLEVELS; i++)
-		tex->nOffsets[i] = mtex.nOffsets[i];
-	tex->nWidth = mtex.nWidth;
-	tex->nHeight = mtex.nHeight;
+		out.nOffsets[i] = mtex->nOffsets[i];
+	out.nWidth = mtex->nWidth;
+	out.nHeight = mtex->nHeight;
+	out.data = (byte*)mtex + sizeof(BSPMIPTEX);
+
+	return true;
+}
+
+WADTEX * Wad::readTexture( int dirIndex )
+{
+	WADTEX view;
+	if (!viewTexture(dirIndex, view))
+		return NULL;
+
+	// the copy has 2 bytes of padding after the palette, which may lie past the end of the file
+	size_t available = file->size() - (view.data - file->data());
+	int szAll = view.getDataSize() + 2;
+	int copySz = available < (size_t)szAll ? (int)available : szAll;
+
+	byte * data = new byte[szAll];
+	memcpy(data, view.data, copySz);
+	memset(data + copySz, 0, szAll - copySz);
+
+	WADTEX * tex = new WADTEX;
+	*tex = view;
 	tex->data = data;
 
 	return tex;
 }
+
+WADTEX * Wad::readTexture( const string& texname )
+{
+	return readTexture(findTexture(texname));
+}
+
 bool Wad::write(WADTEX* textures, int numTex)
 {
 	return write(filename, textures, numTex);
@@ -195,8 +219,13 @@ bool Wad::write(WADTEX* textures, int numTex)
 
 bool Wad::write( std::string filename, WADTEX* textures, int numTex )
 {
-	ofstream myFile(filename, ios::out | ios::binary | ios::trunc);
+	// the file is built in memory first, because the textures may be views of the file that's being replaced
+	vector<char> fileData;
+	auto append = [&fileData](const void* data, int len) {
+		fileData.insert(fileData.end(), (const char*)data, (const char*)data + len);
+	};
 
+	WADHEADER header;
 	header.szMagic[0] = 'W';
 	header.szMagic[1] = 'A';
 	header.szMagic[2] = 'D';
@@ -217,7 +246,7 @@ bool Wad::write( std::string filename, WADTEX* textures, int numTex )
 	}
 
 	header.nDirOffset = 12 + tSize;
-	myFile.write ((char*)&header, sizeof(WADHEADER));
+	append(&header, sizeof(WADHEADER));
 
 	for (int i = 0; i < numTex; i++)
 	{
@@ -239,8 +268,8 @@ bool Wad::write( std::string filename, WADTEX* textures, int numTex )
 		miptex.nOffsets[2] = sizeof(BSPMIPTEX) + sz + sz2;
 		miptex.nOffsets[3] = sizeof(BSPMIPTEX) + sz + sz2 + sz3;
 
-		myFile.write ((char*)&miptex, sizeof(BSPMIPTEX));
-		myFile.write ((char*)textures[i].data, szAll);
+		append(&miptex, sizeof(BSPMIPTEX));
+		append(textures[i].data, szAll);
 	}
 
 	int offset = 12;
@@ -264,11 +293,25 @@ bool Wad::write( std::string filename, WADTEX* textures, int numTex )
 			entry.szName[k] = textures[i].szName[k];
 		offset += szAll + sizeof(BSPMIPTEX);
 
-		myFile.write ((char*)&entry, sizeof(WADDIRENTRY));
+		append(&entry, sizeof(WADDIRENTRY));
 	}
 	
-	//myFile.write ((char*)textures[0]->data, szAll);
-	myFile.close();
+	// Other threads may be reading loaded WADs that map this file, so it's never truncated in place.
+	// The new file is written next to it and renamed over it. Existing mappings keep the old contents
+	// until those WADs are loaded again. Windows refuses to replace a file that's still mapped, in which
+	// case the original is left as it was.
+	string tempName = filename + ".tmp";
+	if (!writeFile(tempName, &fileData[0], fileData.size())) {
+		logf("Failed to write %s\n", tempName.c_str());
+		removeFile(tempName);
+		return false;
+	}
+
+	if (!replaceFile(tempName, filename)) {
+		logf("Failed to replace %s. It may be in use.\n", filename.c_str());
+		removeFile(tempName);
+		return false;
+	}
 
 	return true;
 }
@@ -2,7 +2,11 @@
 #include <string>
 #include "bsptypes.h"
 #include "colors.h"
+#include "MappedFile.h"
+#include "PaletteLookup.h"
 #include <cstring>
+#include <unordered_map>
+#include <vector>
 
 typedef unsigned char byte;
 typedef unsigned int uint;
@@ -96,15 +100,9 @@ struct WADTEX
 			pal[i] = palette[i];
 		}
 
-		uint8_t* mip0 = getMip(0);
-		memset(mip0, 0, w * h);
-		for (int i = 0; i < w * h; i++) {
-			for (int k = 0; k < 256; k++) {
-				if (pixels[i] == pal[k]) {
-					mip0[i] = k;
-				}
-			}
-		}
+		// colors missing from the palette are mapped to the nearest palette color
+		PaletteLookup lookup(pal, 256);
+		lookup.findAll(pixels, getMip(0), w * h);
 
 		uint16_t* palCount = (uint16_t*)((uint8_t*)pal - 2);
 		*palCount = 256;
@@ -131,6 +129,9 @@ struct WADTEX
 	}
 };
 
+// The file is mapped into memory by readInfo() and stays mapped until the Wad is deleted, so textures
+// can be read without reopening the file. Lookups don't modify the Wad and are safe to run on
+// multiple threads at once.
 class Wad
 {
 public:
@@ -138,6 +139,7 @@ public:
 	WADHEADER header = WADHEADER();
 	WADDIRENTRY * dirEntries;
 	int numTex;
+	uint64_t modifiedTime = 0; // of the file when it was loaded
 
 	Wad(const std::string& file);
 	Wad(void);
@@ -146,14 +148,33 @@ public:
 	string getName();
 
 	bool readInfo();
-	bool hasTexture(std::string name);
+	bool hasTexture(const std::string& name);
+
+	// returns the directory index of the first entry with the given name (case-insensitive), or -1
+	int findTexture(const std::string& name);
 
+	// looks up many names at once. Returns the directory index for each name, or -1 if it's missing.
+	std::vector<int> findTextures(const std::vector<std::string>& names);
+
+	// replaces the file instead of writing over it, so Wads that have it loaded keep reading the old
+	// contents until readInfo() is called again
 	bool write(std::string filename, WADTEX* textures, int numTex);
 	bool write(WADTEX* textures, int numTex);
 
+	// fills out with a view of the texture inside the mapped file. Nothing is copied, so out.data
+	// must not be freed or written to, and is only valid while this Wad exists.
+	// Returns false if the entry is missing, compressed, or extends past the end of the file.
+	bool viewTexture(int dirIndex, WADTEX& out);
 
+	// returns a copy of the texture which the caller owns, or NULL
 	WADTEX * readTexture(int dirIndex);
 	WADTEX * readTexture(const std::string& texname);
+
+private:
+	MappedFile* file = NULL;
+	std::unordered_map<std::string, int> nameIndex; // lowercase name -> first entry with that name
+
+	void close();
 };
 
 WADTEX loadTextureFromPng(const std::string& filename);
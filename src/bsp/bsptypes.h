@@ -2,6 +2,7 @@
 #include "types.h"
 #include "bsplimits.h"
 #include <vector>
+#include <memory>
 
 #define BSP_MODEL_BYTES 64 // size of a BSP model in bytes
 
@@ -112,9 +113,11 @@ struct BSPHEADER
 	BSPLUMP lump[HEADER_LUMPS]; // Stores the directory of lumps
 };
 
+// Read-only copies of lumps. Copying a LumpState shares the lump buffers instead of duplicating them,
+// and each buffer is freed when the last state using it is destroyed.
 struct LumpState {
-	byte* lumps[HEADER_LUMPS];
-	int lumpLen[HEADER_LUMPS];
+	std::shared_ptr<byte> lumps[HEADER_LUMPS];
+	int lumpLen[HEADER_LUMPS] = { 0 };
 };
 
 struct BSPPLANE {
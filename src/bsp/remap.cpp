@@ -5,21 +5,24 @@
 
 STRUCTCOUNT::STRUCTCOUNT() {}
 
-STRUCTCOUNT::STRUCTCOUNT(Bsp* map) {
-	planes = map->header.lump[LUMP_PLANES].nLength / sizeof(BSPPLANE);
-	texInfos = map->header.lump[LUMP_TEXINFO].nLength / sizeof(BSPTEXTUREINFO);
-	leaves = map->header.lump[LUMP_LEAVES].nLength / sizeof(BSPLEAF);
-	nodes = map->header.lump[LUMP_NODES].nLength / sizeof(BSPNODE);
-	clipnodes = map->header.lump[LUMP_CLIPNODES].nLength / sizeof(BSPCLIPNODE);
-	verts = map->header.lump[LUMP_VERTICES].nLength / sizeof(vec3);
-	faces = map->header.lump[LUMP_FACES].nLength / sizeof(BSPFACE);
-	textures = *((int32_t*)(map->lumps[LUMP_TEXTURES]));
-	markSurfs = map->header.lump[LUMP_MARKSURFACES].nLength / sizeof(uint16_t);
-	surfEdges = map->header.lump[LUMP_SURFEDGES].nLength / sizeof(int32_t);
-	edges = map->header.lump[LUMP_EDGES].nLength / sizeof(BSPEDGE);
-	models = map->header.lump[LUMP_MODELS].nLength / sizeof(BSPMODEL);
-	lightdata = map->header.lump[LUMP_LIGHTING].nLength;
-	visdata = map->header.lump[LUMP_VISIBILITY].nLength;
+STRUCTCOUNT::STRUCTCOUNT(Bsp* map) : STRUCTCOUNT(map->header, *((int32_t*)(map->lumps[LUMP_TEXTURES]))) {}
+
+STRUCTCOUNT::STRUCTCOUNT(const BSPHEADER& header, int textureCount) {
+	planes = header.lump[LUMP_PLANES].nLength / sizeof(BSPPLANE);
+	texInfos = header.lump[LUMP_TEXINFO].nLength / sizeof(BSPTEXTUREINFO);
+	leaves = header.lump[LUMP_LEAVES].nLength / sizeof(BSPLEAF);
+	nodes = header.lump[LUMP_NODES].nLength / sizeof(BSPNODE);
+	clipnodes = header.lump[LUMP_CLIPNODES].nLength / sizeof(BSPCLIPNODE);
+	verts = header.lump[LUMP_VERTICES].nLength / sizeof(vec3);
+	faces = header.lump[LUMP_FACES].nLength / sizeof(BSPFACE);
+	textures = textureCount;
+	markSurfs = header.lump[LUMP_MARKSURFACES].nLength / sizeof(uint16_t);
+	surfEdges = header.lump[LUMP_SURFEDGES].nLength / sizeof(int32_t);
+	edges = header.lump[LUMP_EDGES].nLength / sizeof(BSPEDGE);
+	models = header.lump[LUMP_MODELS].nLength / sizeof(BSPMODEL);
+	lightstyles = 0;
+	lightdata = header.lump[LUMP_LIGHTING].nLength;
+	visdata = header.lump[LUMP_VISIBILITY].nLength;
 }
 
 void STRUCTCOUNT::add(const STRUCTCOUNT& other) {
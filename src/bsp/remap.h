@@ -1,5 +1,6 @@
 #pragma once
 class Bsp;
+struct BSPHEADER;
 
 // excludes entities
 struct STRUCTCOUNT {
@@ -22,6 +23,9 @@ struct STRUCTCOUNT {
 	STRUCTCOUNT();
 	STRUCTCOUNT(Bsp* map);
 
+	// counts derived from lump sizes. The texture count is stored in the texture lump.
+	STRUCTCOUNT(const BSPHEADER& header, int textureCount);
+
 	void add(const STRUCTCOUNT& other);
 	void sub(const STRUCTCOUNT& other);
 	bool allZero();
@@ -12,12 +12,12 @@ CommandLine::CommandLine(int argc, char* argv[]) {
 		if (i == 1) {
 			command = larg;
 		}
-		if (i == 2) {
+		if (i == 2 && larg[0] != '-') {
 			bspfile = larg;
 		}
-		if (i > 2)
+		else if (i >= 2)
 		{
-			options.push_back(arg);
+			options.push_back(arg); // the map name can be omitted when using -batch
 		}
 
 		if ((i == 1 || i == 2) && larg.find("help") == 0 || larg.find("--help") == 0 || larg.find("-help") == 0) {
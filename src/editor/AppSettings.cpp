@@ -19,7 +19,8 @@ void AppSettings::loadDefault()
 	fontSize = 22;
 	gamedir = std::string();
 	valid = false;
-	undoLevels = 64;
+	undoMemoryLimit = 512;
+	textureCacheLimit = 256;
 	verboseLogs = false;
 
 	debug_open = false;
@@ -107,7 +108,8 @@ void AppSettings::load() {
 			else if (key == "rot_speed") { g_settings.rotSpeed = atof(val.c_str()); }
 			else if (key == "render_flags") { g_settings.render_flags = atoi(val.c_str()); }
 			else if (key == "font_size") { g_settings.fontSize = atoi(val.c_str()); }
-			else if (key == "undo_levels") { g_settings.undoLevels = atoi(val.c_str()); }
+			else if (key == "undo_memory_limit") { g_settings.undoMemoryLimit = atoi(val.c_str()); }
+			else if (key == "texture_cache_limit") { g_settings.textureCacheLimit = atoi(val.c_str()); }
 			else if (key == "gamedir") { g_settings.gamedir = val; }
 			else if (key == "fgd") { fgdPaths.push_back(val); }
 			else if (key == "res") { resPaths.push_back(val); }
@@ -215,7 +217,8 @@ void AppSettings::save() {
 	file << "rot_speed=" << g_settings.rotSpeed << endl;
 	file << "render_flags=" << g_settings.render_flags << endl;
 	file << "font_size=" << g_settings.fontSize << endl;
-	file << "undo_levels=" << g_settings.undoLevels << endl;
+	file << "undo_memory_limit=" << g_settings.undoMemoryLimit << endl;
+	file << "texture_cache_limit=" << g_settings.textureCacheLimit << endl;
 	file << "autoload_layout=" << g_settings.autoload_layout << endl;
 	file << "autoload_layout_width=" << g_settings.autoload_layout_width << endl;
 	file << "autoload_layout_height=" << g_settings.autoload_layout_height << endl;
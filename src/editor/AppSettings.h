@@ -18,7 +18,8 @@ struct AppSettings {
 	int engine;
 	std::string gamedir;
 	bool valid;
-	int undoLevels;
+	int undoMemoryLimit; // MB
+	int textureCacheLimit; // MB
 	bool verboseLogs;
 	bool autoload_layout;
 	int autoload_layout_width;
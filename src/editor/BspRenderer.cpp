@@ -15,6 +15,7 @@
 #include "NavMesh.h"
 #include "Entity.h"
 #include "Wad.h"
+#include "TextureCache.h"
 #include "util.h"
 #include "ShaderProgram.h"
 #include "globals.h"
@@ -85,10 +86,8 @@ BspRenderer::BspRenderer(Bsp* map, PointEntRenderer* pointEntRenderer) {
 		leavesThreadFinished = true;
 	}	
 
-	// cache ent targets so first selection doesn't lag
-	for (int i = 0; i < map->ents.size(); i++) {
-		map->ents[i]->getTargets();
-	}
+	// index ent connections so first selection doesn't lag
+	map->get_ent_index();
 
 	//write_obj_file();
 }
@@ -163,6 +162,19 @@ void BspRenderer::loadTextures() {
 	int missingCount = 0;
 	int embedCount = 0;
 
+	// look up all WAD textures in one pass per WAD. Their pixels are decoded once and kept in the texture cache.
+	vector<string> wadTexNames(map->textureCount);
+	for (int i = 0; i < map->textureCount; i++) {
+		BSPMIPTEX* tex = map->get_texture(i);
+		if (tex && tex->nOffsets[0] <= 0) {
+			wadTexNames[i] = string(tex->szName, strnlen(tex->szName, MAXTEXTURENAME));
+		}
+	}
+	vector<vector<int>> wadTexIndexes(wads.size());
+	for (int k = 0; k < wads.size(); k++) {
+		wadTexIndexes[k] = wads[k]->findTextures(wadTexNames);
+	}
+
 	glTexturesSwap = new Texture * [map->textureCount];
 	for (int i = 0; i < map->textureCount; i++) {
 		int32_t texOffset = ((int32_t*)map->textures)[i + 1];
@@ -178,7 +190,7 @@ void BspRenderer::loadTextures() {
 
 		COLOR3* palette = NULL;
 		byte* src = NULL;
-		WADTEX* wadTex = NULL;
+		std::shared_ptr<const CachedTexture> wadTex;
 
 		int lastMipSize = (tex->nWidth / 8) * (tex->nHeight / 8);
 
@@ -186,20 +198,16 @@ void BspRenderer::loadTextures() {
 
 			bool foundInWad = false;
 			for (int k = 0; k < wads.size(); k++) {
-				if (wads[k]->hasTexture(tex->szName)) {
-					wadTex = wads[k]->readTexture(tex->szName);
-
-					if (wadTex->nWidth != tex->nWidth || wadTex->nHeight != tex->nHeight) {
+				wadTex = g_textureCache.get(wads[k], wadTexIndexes[k][i]);
+				if (wadTex) {
+					if (wadTex->tex.nWidth != tex->nWidth || wadTex->tex.nHeight != tex->nHeight) {
 						debugf("Found a texture named %s in %s but the dimensions don't match. Skipping.\n",
 							tex->szName, wads[k]->filename.c_str());
-						delete wadTex;
 						wadTex = NULL;
 						continue;
 					}
 
 					foundInWad = true;
-					palette = (COLOR3*)(wadTex->data + wadTex->nOffsets[3] + lastMipSize + 2 - 40);
-					src = wadTex->data;
 
 					wadTexCount++;
 					break;
@@ -225,16 +233,16 @@ void BspRenderer::loadTextures() {
 		int sz = tex->nWidth * tex->nHeight;
 		bool hasAlpha = tex->szName[0] == '{';
 
-		for (int k = 0; k < sz; k++) {
-			imageData[k] = COLOR4(palette[src[k]], 255);
-
-			if (hasAlpha && src[k] == 255)
-				imageData[k].a = 0;
+		if (wadTex) {
+			memcpy(imageData, wadTex->rgba, sz * sizeof(COLOR4));
 		}
+		else {
+			for (int k = 0; k < sz; k++) {
+				imageData[k] = COLOR4(palette[src[k]], 255);
 
-		if (wadTex) {
-			delete[] wadTex->data;
-			delete wadTex;
+				if (hasAlpha && src[k] == 255)
+					imageData[k].a = 0;
+			}
 		}
 
 		// map->textures + texOffset + tex.nOffsets[0]
@@ -1954,11 +1962,8 @@ Texture* BspRenderer::uploadTexture(WADTEX* tex) {
 
 int BspRenderer::addTextureToMap(string textureName) {
 	WADTEX* tex = NULL;
-	for (int i = 0; i < wads.size(); i++) {
-		if (wads[i]->hasTexture(textureName)) {
-			tex = wads[i]->readTexture(textureName);
-			break;
-		}
+	for (int i = 0; i < wads.size() && !tex; i++) {
+		tex = wads[i]->readTexture(textureName);
 	}
 
 	if (!tex) {
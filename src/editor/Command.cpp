@@ -96,7 +96,7 @@ void EditEntitiesCommand::refresh() {
 	g_app->mapRenderer->preRenderEnts(); // in case a point entity lost/gained a model
 }
 
-int EditEntitiesCommand::memoryUsage() {
+int64_t EditEntitiesCommand::memoryUsage() {
 	int sz = sizeof(EditEntitiesCommand) + entIndexes.size()*(sizeof(int) + sizeof(Entity*)*2);
 	for (int i = 0; i < entIndexes.size(); i++) {
 		sz += oldEntData[i]->getMemoryUsage();
@@ -179,7 +179,7 @@ void DeleteEntitiesCommand::refresh() {
 	g_app->updateCullBox();
 }
 
-int DeleteEntitiesCommand::memoryUsage() {
+int64_t DeleteEntitiesCommand::memoryUsage() {
 	int sz = sizeof(DeleteEntitiesCommand);
 	for (Entity* ent : entData) {
 		sz += ent->getMemoryUsage();
@@ -240,7 +240,7 @@ void CreateEntitiesCommand::refresh() {
 	g_app->updateCullBox();
 }
 
-int CreateEntitiesCommand::memoryUsage() {
+int64_t CreateEntitiesCommand::memoryUsage() {
 	int sz = sizeof(CreateEntitiesCommand);
 	for (Entity* ent : entData) {
 		sz += ent->getMemoryUsage();
@@ -353,7 +353,7 @@ void CreateEntityFromTextCommand::refresh() {
 	g_app->updateCullBox();
 }
 
-int CreateEntityFromTextCommand::memoryUsage() {
+int64_t CreateEntityFromTextCommand::memoryUsage() {
 	return sizeof(CreateEntityFromTextCommand) + textData.size();
 }
 
@@ -365,27 +365,24 @@ EditBspModelCommand::EditBspModelCommand(string desc, PickInfo& pickInfo, LumpSt
 		vec3 oldOrigin) : Command(desc) {
 	this->modelIdx = pickInfo.getModelIndex();
 	this->entIdx = pickInfo.getEntIndex();
-	this->oldLumps = oldLumps;
-	this->newLumps = newLumps;
 	this->allowedDuringLoad = false;
 	this->oldOrigin = oldOrigin;
 	this->newOrigin = pickInfo.getOrigin();
+
+	createLumpDeltas(oldLumps, newLumps, lumpDeltas);
 }
 
 EditBspModelCommand::~EditBspModelCommand() {
-	for (int i = 0; i < HEADER_LUMPS; i++) {
-		if (oldLumps.lumps[i])
-			delete[] oldLumps.lumps[i];
-		if (newLumps.lumps[i])
-			delete[] newLumps.lumps[i];
-	}
 }
 
 void EditBspModelCommand::execute() {
 	Bsp* map = getBsp();
 	BspRenderer* renderer = getBspRenderer();
 
-	map->replace_lumps(newLumps);
+	failed = !map->apply_lump_deltas(lumpDeltas, false);
+	if (failed) {
+		return;
+	}
 	map->ents[entIdx]->setOrAddKeyvalue("origin", newOrigin.toKeyvalueString());
 	g_app->undoEntOrigin = newOrigin;
 
@@ -395,7 +392,10 @@ void EditBspModelCommand::execute() {
 void EditBspModelCommand::undo() {
 	Bsp* map = getBsp();
 	
-	map->replace_lumps(oldLumps);
+	failed = !map->apply_lump_deltas(lumpDeltas, true);
+	if (failed) {
+		return;
+	}
 	map->ents[entIdx]->setOrAddKeyvalue("origin", oldOrigin.toKeyvalueString());
 	g_app->undoEntOrigin = oldOrigin;
 
@@ -412,7 +412,7 @@ void EditBspModelCommand::refresh() {
 	renderer->refreshModel(modelIdx);
 	renderer->refreshEnt(entIdx);
 	g_app->gui->refresh();
-	g_app->saveLumpState(map, 0xffffff, true);
+	g_app->saveLumpState(map, 0xffffff);
 	g_app->updateEntityUndoState();
 
 	if (g_app->pickInfo.getEntIndex() == entIdx) {
@@ -420,16 +420,31 @@ void EditBspModelCommand::refresh() {
 	}
 }
 
-int EditBspModelCommand::memoryUsage() {
-	int size = sizeof(EditBspModelCommand);
+int64_t EditBspModelCommand::memoryUsage() {
+	int64_t size = sizeof(EditBspModelCommand);
 
 	for (int i = 0; i < HEADER_LUMPS; i++) {
-		size += oldLumps.lumpLen[i] + newLumps.lumpLen[i];
+		size += lumpDeltas[i].memoryUsage() - sizeof(LumpDelta);
 	}
 
 	return size;
 }
 
+void EditBspModelCommand::compress() {
+	for (int i = 0; i < HEADER_LUMPS; i++) {
+		lumpDeltas[i].compress();
+	}
+}
+
+void EditBspModelCommand::addCompressionStats(int64_t& compressedBytes, int64_t& uncompressedBytes) {
+	for (int i = 0; i < HEADER_LUMPS; i++) {
+		if (lumpDeltas[i].isCompressed()) {
+			compressedBytes += lumpDeltas[i].memoryUsage() - sizeof(LumpDelta);
+			uncompressedBytes += lumpDeltas[i].uncompressedSize();
+		}
+	}
+}
+
 
 //
 // A command that makes heavy modifations to the BSP and will need a full reload
@@ -439,51 +454,32 @@ LumpReplaceCommand::LumpReplaceCommand(string desc, bool norefresh) : Command(de
 	this->norefresh = norefresh;
 
 	Bsp* map = g_app->mapRenderer->map;
-	g_app->saveLumpState(map, 0xffffffff, true);
+	g_app->saveLumpState(map, 0xffffffff);
 	this->oldLumps = g_app->undoLumpState;
-	g_app->saveLumpState(map, 0xffffffff, false);
 }
 
 LumpReplaceCommand::~LumpReplaceCommand() {
-	for (int i = 0; i < HEADER_LUMPS; i++) {
-		if (oldLumps.lumps[i])
-			delete[] oldLumps.lumps[i];
-		if (newLumps.lumps[i])
-			delete[] newLumps.lumps[i];
-	}
 }
 
 void LumpReplaceCommand::execute() {
 	Bsp* map = getBsp();
-	map->replace_lumps(newLumps);
+	failed = !map->apply_lump_deltas(lumpDeltas, false);
+	if (failed) {
+		return;
+	}
 	refresh();
 }
 
 void LumpReplaceCommand::pushUndoState(bool norefresh) {
 	Bsp* map = g_app->mapRenderer->map;
 
-	this->newLumps = map->duplicate_lumps(0xffffffff);
-	memset(differences, 0, sizeof(bool) * HEADER_LUMPS);
+	LumpState newLumps = map->duplicate_lumps(0xffffffff);
+	createLumpDeltas(oldLumps, newLumps, lumpDeltas);
 
-	bool anyDifference = false;
 	for (int i = 0; i < HEADER_LUMPS; i++) {
-		if (newLumps.lumps[i] && oldLumps.lumps[i]) {
-			if (newLumps.lumpLen[i] != oldLumps.lumpLen[i] || memcmp(newLumps.lumps[i], oldLumps.lumps[i], newLumps.lumpLen[i]) != 0) {
-				anyDifference = true;
-				differences[i] = true;
-			}
-		}
-	}
-
-	// delete lumps that have no differences to save space
-	for (int i = 0; i < HEADER_LUMPS; i++) {
-		if (!differences[i]) {
-			delete[] oldLumps.lumps[i];
-			delete[] newLumps.lumps[i];
-			oldLumps.lumps[i] = newLumps.lumps[i] = NULL;
-			oldLumps.lumpLen[i] = newLumps.lumpLen[i] = 0;
-		}
+		differences[i] = !lumpDeltas[i].isEmpty();
 	}
+	oldLumps = LumpState(); // only the differences are kept
 
 	if (!norefresh)
 		refresh();
@@ -493,7 +489,10 @@ void LumpReplaceCommand::pushUndoState(bool norefresh) {
 
 void LumpReplaceCommand::undo() {
 	Bsp* map = getBsp();
-	map->replace_lumps(oldLumps);
+	failed = !map->apply_lump_deltas(lumpDeltas, true);
+	if (failed) {
+		return;
+	}
 	refresh();
 }
 
@@ -509,20 +508,35 @@ void LumpReplaceCommand::refresh() {
 
 	renderer->reload();
 	g_app->deselectObject();
-	g_app->saveLumpState(map, 0xffffffff, true);
+	g_app->saveLumpState(map, 0xffffffff);
 }
 
-int LumpReplaceCommand::memoryUsage() {
-	int size = sizeof(LumpReplaceCommand);
+int64_t LumpReplaceCommand::memoryUsage() {
+	int64_t size = sizeof(LumpReplaceCommand);
 
 	for (int i = 0; i < HEADER_LUMPS; i++) {
 		size += oldLumps.lumpLen[i];
-		size += newLumps.lumpLen[i];
+		size += lumpDeltas[i].memoryUsage() - sizeof(LumpDelta);
 	}
 
 	return size;
 }
 
+void LumpReplaceCommand::compress() {
+	for (int i = 0; i < HEADER_LUMPS; i++) {
+		lumpDeltas[i].compress();
+	}
+}
+
+void LumpReplaceCommand::addCompressionStats(int64_t& compressedBytes, int64_t& uncompressedBytes) {
+	for (int i = 0; i < HEADER_LUMPS; i++) {
+		if (lumpDeltas[i].isCompressed()) {
+			compressedBytes += lumpDeltas[i].memoryUsage() - sizeof(LumpDelta);
+			uncompressedBytes += lumpDeltas[i].uncompressedSize();
+		}
+	}
+}
+
 
 
 
@@ -538,7 +552,7 @@ void ModelEditCommand::refresh() {
 	g_app->gui->refresh();
 }
 
-int ModelEditCommand::memoryUsage() {
+int64_t ModelEditCommand::memoryUsage() {
 	return LumpReplaceCommand::memoryUsage() + sizeof(ModelEditCommand) - sizeof(LumpReplaceCommand);
 }
 
@@ -575,7 +589,7 @@ void FacesEditCommand::refresh() {
 	g_app->gui->refresh();
 }
 
-int FacesEditCommand::memoryUsage() {
+int64_t FacesEditCommand::memoryUsage() {
 	return LumpReplaceCommand::memoryUsage() + sizeof(FacesEditCommand) - sizeof(LumpReplaceCommand)
 		+ modelRefreshes.size()*sizeof(int);
 }
@@ -588,6 +602,6 @@ void LightmapsEditCommand::refresh() {
 	g_app->mapRenderer->reloadLightmaps();
 }
 
-int LightmapsEditCommand::memoryUsage() {
+int64_t LightmapsEditCommand::memoryUsage() {
 	return LumpReplaceCommand::memoryUsage() + sizeof(LightmapsEditCommand) - sizeof(LumpReplaceCommand);
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 #include "BspRenderer.h"
 #include "bsptypes.h"
+#include "LumpDelta.h"
 #include "unordered_set"
 
 // Undoable actions following the Command Pattern
@@ -9,12 +10,20 @@ class Command {
 public:
 	string desc;
 	bool allowedDuringLoad = false;
+	bool failed = false; // set by execute/undo if the map wasn't changed because it didn't match the command
 
 	Command(string desc);
 	virtual ~Command() {};
 	virtual void execute() = 0;
 	virtual void undo() = 0;
-	virtual int memoryUsage() = 0;
+	virtual int64_t memoryUsage() = 0;
+
+	// compresses data that's only needed to undo/redo, while the command is far back in the history.
+	// Called from a background thread. The data is decompressed when it's needed again.
+	virtual void compress() {}
+
+	// adds the size of the compressed data, and its size before compression
+	virtual void addCompressionStats(int64_t& compressedBytes, int64_t& uncompressedBytes) {}
 	
 	BspRenderer* getBspRenderer();
 	Bsp* getBsp();
@@ -34,7 +43,7 @@ public:
 	void undo();
 	Entity* getEntForIndex(int idx);
 	void refresh();
-	int memoryUsage();
+	int64_t memoryUsage();
 };
 
 
@@ -49,7 +58,7 @@ public:
 	void execute();
 	void undo();
 	void refresh();
-	int memoryUsage();
+	int64_t memoryUsage();
 };
 
 
@@ -63,7 +72,7 @@ public:
 	void execute();
 	void undo();
 	void refresh();
-	int memoryUsage();
+	int64_t memoryUsage();
 };
 
 
@@ -79,7 +88,7 @@ public:
 	void execute();
 	void undo();
 	void refresh();
-	int memoryUsage();
+	int64_t memoryUsage();
 };
 
 
@@ -89,24 +98,26 @@ public:
 	int entIdx;
 	vec3 oldOrigin;
 	vec3 newOrigin;
-	LumpState oldLumps = LumpState();
-	LumpState newLumps = LumpState();
+	LumpDelta lumpDeltas[HEADER_LUMPS];
 
+	// only the differences between the lump states are kept
 	EditBspModelCommand(string desc, PickInfo& pickInfo, LumpState oldLumps, LumpState newLumps, vec3 oldOrigin);
 	~EditBspModelCommand();
 
 	void execute();
 	void undo();
 	void refresh();
-	int memoryUsage();
+	int64_t memoryUsage();
+	void compress() override;
+	void addCompressionStats(int64_t& compressedBytes, int64_t& uncompressedBytes) override;
 };
 
 
 // works differently than other commands. Create the command, do your edits, then pushUndoState.
 class LumpReplaceCommand : public Command {
 public:
-	LumpState newLumps = LumpState();
-	LumpState oldLumps = LumpState();
+	LumpState oldLumps = LumpState(); // released once pushUndoState stores the differences
+	LumpDelta lumpDeltas[HEADER_LUMPS];
 	bool differences[HEADER_LUMPS];
 	bool norefresh;
 	vector<int> modelRefreshes;
@@ -118,7 +129,9 @@ public:
 	void pushUndoState(bool norefresh=false); // call after you've edited lumps. Not called by redo.
 	void undo();
 	virtual void refresh();
-	int memoryUsage();
+	int64_t memoryUsage();
+	void compress() override;
+	void addCompressionStats(int64_t& compressedBytes, int64_t& uncompressedBytes) override;
 };
 
 // refreshes sepcific models instead of the entire map
@@ -130,7 +143,7 @@ public:
 	ModelEditCommand(string desc, vector<int> modelIndexes);
 
 	void refresh() override;
-	int memoryUsage() override;
+	int64_t memoryUsage() override;
 };
 
 
@@ -144,7 +157,7 @@ public:
 	FacesEditCommand(string desc);
 
 	void refresh() override;
-	int memoryUsage() override;
+	int64_t memoryUsage() override;
 };
 
 
@@ -154,5 +167,5 @@ public:
 	LightmapsEditCommand(string desc);
 
 	void refresh() override;
-	int memoryUsage() override;
+	int64_t memoryUsage() override;
 };
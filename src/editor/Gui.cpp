@@ -8,6 +8,7 @@
 #include "Fgd.h"
 #include "Texture.h"
 #include "Wad.h"
+#include "TextureCache.h"
 #include "util.h"
 #include "globals.h"
 #include <fstream>
@@ -3731,6 +3732,10 @@ void Gui::drawDebugWidget() {
 						ImGui::Text("Leaf faces: %d", leaf.nMarkSurfaces);
 						ImGui::Text("Leaf first surf: %d", leaf.iFirstMarkSurface);
 						ImGui::Text("Leaf VIS offset: %d", leaf.nVisOffset);
+						PvsCache& pvsCache = map->get_pvs_cache();
+						ImGui::Text("Leaf PVS size: %d", pvsCache.countVisible(app->pickInfo.getLeafIndex()));
+						ImGui::Text("PVS cache: %d rows, %.2f / %.2f MB", pvsCache.cachedRowCount(),
+							pvsCache.memoryUsage() / (1024.0f * 1024.0f), pvsCache.fullMemoryUsage() / (1024.0f * 1024.0f));
 						ImGui::Text("Leaf ambient levels: %d %d %d %d", leaf.nAmbientLevels[0], leaf.nAmbientLevels[1], leaf.nAmbientLevels[2], leaf.nAmbientLevels[3]);
 						ImGui::Text("Leaf mins: %d %d %d", (int)leaf.nMins[0], (int)leaf.nMins[1], (int)leaf.nMins[2]);
 						ImGui::Text("Leaf maxs: %d %d %d", (int)leaf.nMaxs[0], (int)leaf.nMaxs[1], (int)leaf.nMaxs[2]);
@@ -3894,6 +3899,16 @@ void Gui::drawDebugWidget() {
 
 			float mb = app->undoMemoryUsage / (1024.0f * 1024.0f);
 			ImGui::Text("Undo Memory Usage: %.2f MB\n", mb);
+
+			float compressedMb = app->undoCompressedBytes / (1024.0f * 1024.0f);
+			float uncompressedMb = app->undoUncompressedBytes / (1024.0f * 1024.0f);
+			ImGui::Text("Undo Compressed: %.2f MB (%.2f MB uncompressed)\n", compressedMb, uncompressedMb);
+
+			TextureCacheStats texCache = g_textureCache.getStats();
+			ImGui::Text("Texture Cache: %d textures, %.2f / %.2f MB\n", texCache.count,
+				texCache.bytes / (1024.0f * 1024.0f), texCache.budget / (1024.0f * 1024.0f));
+			ImGui::Text("Texture Cache Hits: %llu, Misses: %llu, Evictions: %llu\n",
+				(unsigned long long)texCache.hits, (unsigned long long)texCache.misses, (unsigned long long)texCache.evictions);
 		}
 	}
 	ImGui::End();
@@ -4561,8 +4576,8 @@ void Gui::drawKeyvalueEditor_RawEditTab() {
 		for (int i = 0; i < app->pickInfo.ents.size(); i++) {
 			Entity* ent = map->ents[app->pickInfo.ents[i]];
 
-			for (int k = 0; k < ent->keyOrder.size(); k++) {
-				string key = ent->keyOrder[k];
+			for (int k = 0; k < ent->getKeyCount(); k++) {
+				const string& key = ent->getKey(k);
 				if (!addedKeys.count(key)) {
 					addedKeys.insert(key);
 					combinedKeys.push_back(key);
@@ -4579,7 +4594,10 @@ void Gui::drawKeyvalueEditor_RawEditTab() {
 		fullRefreshNeeded = keysMoved;
 	}
 	else {
-		combinedKeys = app->pickInfo.getEnt()->keyOrder;
+		Entity* ent = app->pickInfo.getEnt();
+		for (int k = 0; k < ent->getKeyCount(); k++) {
+			combinedKeys.push_back(ent->getKey(k));
+		}
 	}
 
 	struct InputData {
@@ -4620,7 +4638,7 @@ void Gui::drawKeyvalueEditor_RawEditTab() {
 
 			if (modelUpdate) {
 				inputData->bspRenderer->preRenderEnts();
-				g_app->saveLumpState(inputData->bspRenderer->map, 0xffffffff, false);
+				g_app->saveLumpState(inputData->bspRenderer->map, 0xffffffff);
 			}
 			if (anyUpdate && g_app->pickInfo.ents.size() < 100) {
 				g_app->updateEntConnections();
@@ -4665,7 +4683,7 @@ void Gui::drawKeyvalueEditor_RawEditTab() {
 
 			if (modelUpdate) {
 				inputData->bspRenderer->preRenderEnts();
-				g_app->saveLumpState(inputData->bspRenderer->map, 0xffffffff, false);
+				g_app->saveLumpState(inputData->bspRenderer->map, 0xffffffff);
 			}
 			if (anyUpdate && g_app->pickInfo.ents.size() < 100) {
 				g_app->updateEntConnections();
@@ -4739,14 +4757,12 @@ void Gui::drawKeyvalueEditor_RawEditTab() {
 			{
 				Entity* ent = app->pickInfo.getEnt();
 				int n_next = (ImGui::GetMousePos().y - startY) / (ImGui::GetItemRectSize().y + style.FramePadding.y * 2);
-				if (n_next >= 0 && n_next < ent->keyOrder.size() && n_next < MAX_KEYS_PER_ENT)
+				if (n_next >= 0 && n_next < ent->getKeyCount() && n_next < MAX_KEYS_PER_ENT)
 				{
 					dragIds[i] = dragIds[n_next];
 					dragIds[n_next] = item;
 
-					string temp = ent->keyOrder[i];
-					ent->keyOrder[i] = ent->keyOrder[n_next];
-					ent->keyOrder[n_next] = temp;
+					ent->swapKeys(i, n_next);
 
 					// fix false-positive error highlight
 					ignoreErrors = 2;
@@ -5720,7 +5736,16 @@ void Gui::drawSettings() {
 			if (ImGui::DragInt("Font Size", &g_settings.fontSize, 0.1f, 8, 48, "%d pixels")) {
 				shouldReloadFonts = true;
 			}
-			ImGui::DragInt("Undo Levels", &app->undoLevels, 0.05f, 0, 64);
+			ImGui::DragInt("Undo Memory Limit", &app->undoMemoryLimit, 4.0f, 16, 4096, "%d MB");
+			if (ImGui::IsItemHovered()) {
+				ImGui::SetTooltip("The oldest undo steps are deleted once the undo history uses this much memory.");
+			}
+			if (ImGui::DragInt("Texture Cache Limit", &g_settings.textureCacheLimit, 4.0f, 0, 4096, "%d MB")) {
+				g_textureCache.setBudget((size_t)g_settings.textureCacheLimit * 1024 * 1024);
+			}
+			if (ImGui::IsItemHovered()) {
+				ImGui::SetTooltip("Memory used to keep WAD textures loaded, so that they load faster when a map is reloaded or another map uses the same WADs.");
+			}
 
 			ImGui::Columns(2);
 			ImGui::Checkbox("Verbose Logging", &g_verbose);
@@ -6686,8 +6711,8 @@ void Gui::drawEntityReport() {
 
 							bool foundKey = false;
 							string actualKey;
-							for (int c = 0; c < ent->keyOrder.size(); c++) {
-								string key = toLowerCase(ent->keyOrder[c]);
+							for (int c = 0; c < ent->getKeyCount(); c++) {
+								string key = toLowerCase(ent->getKey(c));
 								if (key == searchKey || (partialMatches && key.find(searchKey) != string::npos)) {
 									foundKey = true;
 									actualKey = key;
@@ -6711,8 +6736,8 @@ void Gui::drawEntityReport() {
 						else if (strlen(valueFilter[k]) > 0) {
 							string searchValue = trimSpaces(toLowerCase(valueFilter[k]));
 							bool foundMatch = false;
-							for (int c = 0; c < ent->keyOrder.size(); c++) {
-								string val = toLowerCase(ent->getKeyvalue(ent->keyOrder[c]));
+							for (int c = 0; c < ent->getKeyCount(); c++) {
+								string val = toLowerCase(ent->getValue(c));
 								if (val == searchValue || (partialMatches && val.find(searchValue) != string::npos)) {
 									foundMatch = true;
 									break;
@@ -24,6 +24,7 @@
 #include <lodepng.h>
 #include "embedded_shaders.h"
 #include "ScriptManager.h"
+#include "TextureCache.h"
 
 #include "icons/app.h"
 #include "icons/app2.h"
@@ -31,6 +32,9 @@
 // everything except VIS, ENTITIES, MARKSURFS
 #define EDIT_MODEL_LUMPS (PLANES | TEXTURES | VERTICES | NODES | TEXINFO | FACES | LIGHTING | CLIPNODES | LEAVES | EDGES | SURFEDGES | MODELS)
 
+// number of commands at the end of the undo/redo history that aren't compressed, so that they're fast to undo/redo
+#define UNDO_UNCOMPRESSED_LEVELS 8
+
 future<void> Renderer::fgdFuture;
 
 int glGetErrorDebug() {
@@ -221,9 +225,6 @@ Renderer::Renderer() {
 	reloading = true;
 	fgdFuture = async(launch::async, &Renderer::loadFgds, this);
 
-	memset(&undoLumpState, 0, sizeof(LumpState));
-	memset(&initialLumpState, 0, sizeof(LumpState));
-
 	glCheckError("Initializing context");
 
 	// Initialize AngelScript
@@ -755,6 +756,11 @@ void Renderer::renderLoop() {
 			glCheckError("FGD post load");
 		}
 
+		if (undoCompressFuture.valid() && undoCompressFuture.wait_for(chrono::milliseconds(0)) == future_status::ready) {
+			undoCompressFuture.get();
+			calcUndoMemoryUsage();
+		}
+
 		if (!isFocused && !isHovered) {
 			sleepms(50);
 		}
@@ -1288,14 +1294,8 @@ void Renderer::clearMapData() {
 		entConnectionLinks.clear();
 	}
 
-	for (int i = 0; i < HEADER_LUMPS; i++) {
-		if (undoLumpState.lumps[i]) {
-			delete[] undoLumpState.lumps[i];
-			delete[] initialLumpState.lumps[i];
-		}
-	}
-	memset(&undoLumpState, 0, sizeof(LumpState));
-	memset(&initialLumpState, 0, sizeof(LumpState));
+	undoLumpState = LumpState();
+	initialLumpState = LumpState();
 
 	forceAngleRotation = false; // can cause confusion opening a new map
 }
@@ -1387,7 +1387,7 @@ void Renderer::saveSettings() {
 	g_settings.zfar = zFar;
 	g_settings.fov = fov;
 	g_settings.render_flags = g_settings.render_flags;
-	g_settings.undoLevels = undoLevels;
+	g_settings.undoMemoryLimit = undoMemoryLimit;
 	g_settings.moveSpeed = moveSpeed;
 	g_settings.rotSpeed = rotationSpeed;
 }
@@ -1411,7 +1411,8 @@ void Renderer::loadSettings() {
 	zFarMdl = g_settings.zFarMdl;
 	fov = g_settings.fov;
 	g_settings.render_flags = g_settings.render_flags;
-	undoLevels = g_settings.undoLevels;
+	undoMemoryLimit = g_settings.undoMemoryLimit;
+	g_textureCache.setBudget((size_t)g_settings.textureCacheLimit * 1024 * 1024);
 	rotationSpeed = g_settings.rotSpeed;
 	moveSpeed = g_settings.moveSpeed;
 
@@ -2457,7 +2458,7 @@ void Renderer::pickObject() {
 		if (pickInfo.getEnt()) {
 			updateModelVerts();
 			if (pickInfo.getEnt() && pickInfo.getEnt()->isBspModel())
-				saveLumpState(pickInfo.getMap(), 0xffffffff, true);
+				saveLumpState(pickInfo.getMap(), 0xffffffff);
 			pickCount++; // force transform window update
 		}
 
@@ -3720,21 +3721,27 @@ void Renderer::updateEntConnections() {
 		const COLOR4 callerColor = { 0, 255, 255, 255 };
 		const COLOR4 bothColor = { 0, 255, 0, 255 };
 
+		EntityIndex& entIndex = map->get_ent_index();
+
 		for (int i = 0; i < pickInfo.ents.size(); i++) {
 			int entindx = pickInfo.ents[i];
 			Entity* self = map->ents[entindx];
-			unordered_set<string> selfNames = self->getAllTargetnames();
 
-			for (int k = 0; k < map->ents.size(); k++) {
+			vector<int> targetIdxs = entIndex.getTargetsOf(entindx);
+			vector<int> callerIdxs = entIndex.getCallersOf(entindx);
+
+			vector<int> linkedIdxs;
+			std::set_union(targetIdxs.begin(), targetIdxs.end(), callerIdxs.begin(), callerIdxs.end(),
+				std::back_inserter(linkedIdxs));
+
+			for (int k : linkedIdxs) {
 				Entity* ent = map->ents[k];
 
 				if (k == entindx)
 					continue;
 
-				
-				unordered_set<string> tnames = ent->getAllTargetnames();
-				bool isTarget = tnames.size() && self->hasTarget(tnames);
-				bool isCaller = selfNames.size() && ent->hasTarget(selfNames);
+				bool isTarget = std::binary_search(targetIdxs.begin(), targetIdxs.end(), k);
+				bool isCaller = std::binary_search(callerIdxs.begin(), callerIdxs.end(), k);
 
 				EntConnection link;
 				memset(&link, 0, sizeof(EntConnection));
@@ -4668,7 +4675,7 @@ void Renderer::deleteEnts() {
 
 void Renderer::deselectObject() {
 	if (pickInfo.getEnt() && pickInfo.getEnt()->isBspModel())
-		saveLumpState(pickInfo.getMap(), 0xffffffff, true);
+		saveLumpState(pickInfo.getMap(), 0xffffffff);
 
 	// update deselected point ents
 	for (int entIdx : pickInfo.ents) {
@@ -4791,21 +4798,11 @@ void Renderer::updateEntityUndoState() {
 		undoEntOrigin = pickInfo.getEnt()->getOrigin();
 }
 
-void Renderer::saveLumpState(Bsp* map, int targetLumps, bool deleteOldState) {
-	if (deleteOldState) {
-		for (int i = 0; i < HEADER_LUMPS; i++) {
-			if (undoLumpState.lumps[i])
-				delete[] undoLumpState.lumps[i];
-		}
-	}
-
+void Renderer::saveLumpState(Bsp* map, int targetLumps) {
 	undoLumpState = map->duplicate_lumps(targetLumps);
 }
 
 void Renderer::updateEntityLumpUndoState(Bsp* map) {
-	if (undoLumpState.lumps[LUMP_ENTITIES])
-		delete[] undoLumpState.lumps[LUMP_ENTITIES];
-
 	LumpState dupLump = map->duplicate_lumps(LUMP_ENTITIES);
 	undoLumpState.lumps[LUMP_ENTITIES] = dupLump.lumps[LUMP_ENTITIES];
 	undoLumpState.lumpLen[LUMP_ENTITIES] = dupLump.lumpLen[LUMP_ENTITIES];
@@ -4829,16 +4826,14 @@ bool Renderer::canPushEntityUndoState() {
 		Entity* currentEnt = map->ents[currentIdx];
 		Entity* undoEnt = undoEntityState[i].ent;
 			
-		if (undoEnt->keyOrder.size() == currentEnt->keyOrder.size()) {
-			for (int i = 0; i < undoEnt->keyOrder.size(); i++) {
-				string oldKey = undoEnt->keyOrder[i];
-				string newKey = currentEnt->keyOrder[i];
+		if (undoEnt->getKeyCount() == currentEnt->getKeyCount()) {
+			for (int i = 0; i < undoEnt->getKeyCount(); i++) {
+				const string& oldKey = undoEnt->getKey(i);
+				const string& newKey = currentEnt->getKey(i);
 				if (oldKey != newKey) {
 					return true;
 				}
-				string oldVal = undoEnt->getKeyvalue(oldKey);
-				string newVal = currentEnt->getKeyvalue(oldKey);
-				if (oldVal != newVal) {
+				if (undoEnt->getValue(i) != currentEnt->getValue(i)) {
 					return true;
 				}
 			}
@@ -4879,7 +4874,7 @@ void Renderer::pushModelUndoState(string actionDesc, int targetLumps) {
 	bool anyDifference = false;
 	for (int i = 0; i < HEADER_LUMPS; i++) {
 		if (newLumps.lumps[i] && undoLumpState.lumps[i]) {
-			if (newLumps.lumpLen[i] != undoLumpState.lumpLen[i] || memcmp(newLumps.lumps[i], undoLumpState.lumps[i], newLumps.lumpLen[i]) != 0) {
+			if (newLumps.lumpLen[i] != undoLumpState.lumpLen[i] || memcmp(newLumps.lumps[i].get(), undoLumpState.lumps[i].get(), newLumps.lumpLen[i]) != 0) {
 				anyDifference = true;
 				differences[i] = true;
 			}
@@ -4894,37 +4889,34 @@ void Renderer::pushModelUndoState(string actionDesc, int targetLumps) {
 	// delete lumps that have no differences to save space
 	for (int i = 0; i < HEADER_LUMPS; i++) {
 		if (!differences[i]) {
-			delete[] undoLumpState.lumps[i];
-			delete[] newLumps.lumps[i];
-			undoLumpState.lumps[i] = newLumps.lumps[i] = NULL;
+			undoLumpState.lumps[i].reset();
+			newLumps.lumps[i].reset();
 			undoLumpState.lumpLen[i] = newLumps.lumpLen[i] = 0;
 		}
 	}
 
 	EditBspModelCommand* editCommand = new EditBspModelCommand(actionDesc, pickInfo, undoLumpState, newLumps, undoEntOrigin);
 	pushUndoCommand(editCommand);
-	saveLumpState(pickInfo.getMap(), 0xffffffff, false);
+	saveLumpState(pickInfo.getMap(), 0xffffffff);
 
 	// entity origin edits also update the ent origin (TODO: this breaks when moving + scaling something)
 	updateEntityUndoState();
 }
 
 void Renderer::pushUndoCommand(Command* cmd) {
+	waitForUndoCompression();
+
 	undoHistory.push_back(cmd);
 	clearRedoCommands();
-
-	while (!undoHistory.empty() && undoHistory.size() > undoLevels) {
-		delete undoHistory[0];
-		undoHistory.erase(undoHistory.begin());
-	}
-
-	calcUndoMemoryUsage();
+	trimUndoHistory();
+	compressUndoHistory();
 }
 
 void Renderer::undo() {
 	if (undoHistory.empty()) {
 		return;
 	}
+	waitForUndoCompression();
 
 	Command* undoCommand = undoHistory[undoHistory.size() - 1];
 	if (!undoCommand->allowedDuringLoad && isLoading) {
@@ -4932,15 +4924,22 @@ void Renderer::undo() {
 		return;
 	}
 
+	undoCommand->failed = false;
 	undoCommand->undo();
+	if (undoCommand->failed) {
+		logf("Failed to undo %s. The command was kept in the undo history.\n", undoCommand->desc.c_str());
+		return;
+	}
 	undoHistory.pop_back();
 	redoHistory.push_back(undoCommand);
+	compressUndoHistory();
 }
 
 void Renderer::redo() {
 	if (redoHistory.empty()) {
 		return;
 	}
+	waitForUndoCompression();
 
 	Command* redoCommand = redoHistory[redoHistory.size() - 1];
 	if (!redoCommand->allowedDuringLoad && isLoading) {
@@ -4948,12 +4947,20 @@ void Renderer::redo() {
 		return;
 	}
 
+	redoCommand->failed = false;
 	redoCommand->execute();
+	if (redoCommand->failed) {
+		logf("Failed to redo %s. The command was kept in the redo history.\n", redoCommand->desc.c_str());
+		return;
+	}
 	redoHistory.pop_back();
 	undoHistory.push_back(redoCommand);
+	compressUndoHistory();
 }
 
 void Renderer::clearUndoCommands() {
+	waitForUndoCompression();
+
 	for (int i = 0; i < undoHistory.size(); i++) {
 		delete undoHistory[i];
 		undoHistory[i] = NULL;
@@ -4964,6 +4971,8 @@ void Renderer::clearUndoCommands() {
 }
 
 void Renderer::clearRedoCommands() {
+	waitForUndoCompression();
+
 	for (int i = 0; i < redoHistory.size(); i++) {
 		delete redoHistory[i];
 		redoHistory[i] = NULL;
@@ -4974,13 +4983,69 @@ void Renderer::clearRedoCommands() {
 }
 
 void Renderer::calcUndoMemoryUsage() {
+	waitForUndoCompression();
+
 	undoMemoryUsage = (undoHistory.size() + redoHistory.size()) * sizeof(Command*);
+	undoCompressedBytes = 0;
+	undoUncompressedBytes = 0;
 
 	for (int i = 0; i < undoHistory.size(); i++) {
 		undoMemoryUsage += undoHistory[i]->memoryUsage();
+		undoHistory[i]->addCompressionStats(undoCompressedBytes, undoUncompressedBytes);
 	}
 	for (int i = 0; i < redoHistory.size(); i++) {
 		undoMemoryUsage += redoHistory[i]->memoryUsage();
+		redoHistory[i]->addCompressionStats(undoCompressedBytes, undoUncompressedBytes);
+	}
+}
+
+void Renderer::trimUndoHistory() {
+	calcUndoMemoryUsage();
+
+	int64_t limit = (int64_t)undoMemoryLimit * 1024 * 1024;
+	bool anyDeleted = false;
+
+	// the newest command is always kept
+	while (undoHistory.size() > 1 && undoMemoryUsage > limit) {
+		undoMemoryUsage -= undoHistory[0]->memoryUsage() + sizeof(Command*);
+		delete undoHistory[0];
+		undoHistory.erase(undoHistory.begin());
+		anyDeleted = true;
+	}
+
+	if (anyDeleted) {
+		calcUndoMemoryUsage();
+	}
+}
+
+void Renderer::compressUndoHistory() {
+	waitForUndoCompression();
+
+	// the oldest commands are at the start of each list
+	vector<Command*> oldCommands;
+	for (int i = 0; i + UNDO_UNCOMPRESSED_LEVELS < (int)undoHistory.size(); i++) {
+		oldCommands.push_back(undoHistory[i]);
+	}
+	for (int i = 0; i + UNDO_UNCOMPRESSED_LEVELS < (int)redoHistory.size(); i++) {
+		oldCommands.push_back(redoHistory[i]);
+	}
+
+	if (oldCommands.empty()) {
+		return;
+	}
+
+	// The history isn't touched until the job finishes (see waitForUndoCompression),
+	// so the commands can be compressed in-place
+	undoCompressFuture = async(launch::async, [oldCommands]() {
+		for (Command* cmd : oldCommands) {
+			cmd->compress();
+		}
+	});
+}
+
+void Renderer::waitForUndoCompression() {
+	if (undoCompressFuture.valid()) {
+		undoCompressFuture.get();
 	}
 }
 
@@ -5036,10 +5101,6 @@ void Renderer::merge(string fpath) {
 	
 	LumpState mergedLumps = mergeResult.map->duplicate_lumps(0xffffffff);
 	mapRenderer->map->replace_lumps(mergedLumps);
-
-	for (int i = 0; i < HEADER_LUMPS; i++) {
-		delete[] mergedLumps.lumps[i];
-	}
 	logf("Merged maps!\n");
 
 	command->pushUndoState();
@@ -5118,15 +5179,11 @@ bool Renderer::confirmMapExit() {
 				lumpsChanged = true;
 				break;
 			}
-			if (memcmp(initialLumpState.lumps[i], currentLumps.lumps[i], currentLumps.lumpLen[i])) {
+			if (memcmp(initialLumpState.lumps[i].get(), currentLumps.lumps[i].get(), currentLumps.lumpLen[i])) {
 				lumpsChanged = true;
 				break;
 			}
 		}
-		for (int i = 0; i < HEADER_LUMPS; i++) {
-			delete[] currentLumps.lumps[i];
-		}
-
 		if (lumpsChanged) {
 			string msg = "Save changes to " + g_app->mapRenderer->map->name + "?";
 			int ret = tinyfd_messageBox(
@@ -5161,14 +5218,7 @@ bool Renderer::confirmMapExit() {
 void Renderer::setInitialLumpState() {
 	Bsp* map = mapRenderer->map;
 
-	for (int i = 0; i < HEADER_LUMPS; i++) {
-		if (undoLumpState.lumps[i]) {
-			delete[] initialLumpState.lumps[i];
-		}
-	}
-	memset(&initialLumpState, 0, sizeof(LumpState));
-
-	saveLumpState(map, 0xffffffff, true);
+	// the initial state shares lump buffers with the undo states until the lumps are edited
+	saveLumpState(map, 0xffffffff);
 	initialLumpState = undoLumpState;
-	saveLumpState(map, 0xffffffff, false);
 }
\ No newline at end of file
@@ -257,8 +257,11 @@ private:
 	int vertPickCount = 0;
 	bool forceRefreshTransformWindow;
 
-	int undoLevels = 64;
-	int undoMemoryUsage = 0; // approximate space used by undo+redo history
+	int undoMemoryLimit = 512; // MB of undo+redo history to keep before deleting the oldest commands
+	int64_t undoMemoryUsage = 0; // approximate space used by undo+redo history
+	int64_t undoCompressedBytes = 0; // size of compressed undo data
+	int64_t undoUncompressedBytes = 0; // size of the compressed undo data before it was compressed
+	future<void> undoCompressFuture; // compresses old commands in the background
 	vector<Command*> undoHistory;
 	vector<Command*> redoHistory;
 	vector<EntityState> undoEntityState;
@@ -370,10 +373,13 @@ private:
 	void clearUndoCommands();
 	void clearRedoCommands();
 	void calcUndoMemoryUsage();
+	void trimUndoHistory(); // deletes the oldest commands until the history fits in the memory limit
+	void compressUndoHistory(); // starts compressing commands that are far back in the history
+	void waitForUndoCompression(); // must be called before touching commands in the history
 	void clearMapData();
 
 	void updateEntityUndoState();
-	void saveLumpState(Bsp* map, int targetLumps, bool deleteOldState);
+	void saveLumpState(Bsp* map, int targetLumps);
 	void updateEntityLumpUndoState(Bsp* map);
 
 	void loadFgds();
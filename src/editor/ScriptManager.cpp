@@ -146,17 +146,17 @@ bool ScriptEntity::isBspModel() const {
 
 int ScriptEntity::getKeyCount() const {
     if (!entity) return 0;
-    return (int)entity->keyOrder.size();
+    return entity->getKeyCount();
 }
 
 std::string ScriptEntity::getKeyAt(int index) const {
-    if (!entity || index < 0 || index >= (int)entity->keyOrder.size()) return "";
-    return entity->keyOrder[index];
+    if (!entity || index < 0 || index >= entity->getKeyCount()) return "";
+    return entity->getKey(index);
 }
 
 std::string ScriptEntity::getValueAt(int index) const {
-    if (!entity || index < 0 || index >= (int)entity->keyOrder.size()) return "";
-    return entity->getKeyvalue(entity->keyOrder[index]);
+    if (!entity || index < 0 || index >= entity->getKeyCount()) return "";
+    return entity->getValue(index);
 }
 
 int ScriptEntity::getIndex() const {
@@ -708,6 +708,16 @@ static ScriptEntity* Script_getEntityByClassname(const std::string& name) {
     return nullptr;
 }
 
+static CScriptArray* Script_getEntityTargets(int index) {
+    if (g_scriptManager) return g_scriptManager->getEntityTargets(index);
+    return nullptr;
+}
+
+static CScriptArray* Script_getEntityCallers(int index) {
+    if (g_scriptManager) return g_scriptManager->getEntityCallers(index);
+    return nullptr;
+}
+
 static ScriptEntity* Script_createEntity(const std::string& classname) {
     if (g_scriptManager) return g_scriptManager->createEntity(classname);
     return nullptr;
@@ -943,6 +953,12 @@ void ScriptManager::registerGlobalFunctions() {
         asFUNCTION(Script_getEntityByTargetname), asCALL_CDECL); assert(r >= 0);
     r = engine->RegisterGlobalFunction("Entity@ findByClassname(const string &in)", 
         asFUNCTION(Script_getEntityByClassname), asCALL_CDECL); assert(r >= 0);
+    // entity connections, by entity index: Map::getTargetsOf lists what an entity triggers,
+    // and Map::getCallersOf lists what triggers it
+    r = engine->RegisterGlobalFunction("array<Entity@>@ getTargetsOf(int)", 
+        asFUNCTION(Script_getEntityTargets), asCALL_CDECL); assert(r >= 0);
+    r = engine->RegisterGlobalFunction("array<Entity@>@ getCallersOf(int)", 
+        asFUNCTION(Script_getEntityCallers), asCALL_CDECL); assert(r >= 0);
     r = engine->RegisterGlobalFunction("Entity@ createEntity(const string &in)", 
         asFUNCTION(Script_createEntity), asCALL_CDECL); assert(r >= 0);
     r = engine->RegisterGlobalFunction("void deleteEntity(int)", 
@@ -1270,9 +1286,10 @@ ScriptEntity* ScriptManager::getEntityByTargetname(const std::string& targetname
     if (!app || !app->mapRenderer || !app->mapRenderer->map) return nullptr;
     
     Bsp* map = app->mapRenderer->map;
-    for (int i = 0; i < (int)map->ents.size(); i++) {
-        if (map->ents[i]->getTargetname() == targetname) {
-            return getEntity(i);
+    for (int entIdx : map->get_ent_index().findTargetname(targetname)) {
+        // the index also has names from FGD target_source keys
+        if (map->ents[entIdx]->getTargetname() == targetname) {
+            return getEntity(entIdx);
         }
     }
     return nullptr;
@@ -1282,12 +1299,8 @@ ScriptEntity* ScriptManager::getEntityByClassname(const std::string& classname)
     if (!app || !app->mapRenderer || !app->mapRenderer->map) return nullptr;
     
     Bsp* map = app->mapRenderer->map;
-    for (int i = 0; i < (int)map->ents.size(); i++) {
-        if (map->ents[i]->getClassname() == classname) {
-            return getEntity(i);
-        }
-    }
-    return nullptr;
+    const std::vector<int>& found = map->get_ent_index().findClassname(classname);
+    return found.empty() ? nullptr : getEntity(found[0]);
 }
 
 ScriptEntity* ScriptManager::createEntity(const std::string& classname) {
@@ -1502,7 +1515,27 @@ void ScriptManager::endEntityBatch() {
 }
 
 CScriptArray* ScriptManager::getSelectedEntities() {
-    // Get the array type from the engine
+    if (!app) {
+        return createEntityArray(std::vector<int>());
+    }
+    return createEntityArray(app->pickInfo.ents);
+}
+
+CScriptArray* ScriptManager::getEntityTargets(int index) {
+    if (!app || !app->mapRenderer || !app->mapRenderer->map) {
+        return createEntityArray(std::vector<int>());
+    }
+    return createEntityArray(app->mapRenderer->map->get_ent_index().getTargetsOf(index));
+}
+
+CScriptArray* ScriptManager::getEntityCallers(int index) {
+    if (!app || !app->mapRenderer || !app->mapRenderer->map) {
+        return createEntityArray(std::vector<int>());
+    }
+    return createEntityArray(app->mapRenderer->map->get_ent_index().getCallersOf(index));
+}
+
+CScriptArray* ScriptManager::createEntityArray(const std::vector<int>& entIdxs) {
     asITypeInfo* arrayType = engine->GetTypeInfoByDecl("array<Entity@>");
     if (!arrayType) {
         logf("[Script ERROR] Could not find array<Entity@> type\n");
@@ -1510,19 +1543,11 @@ CScriptArray* ScriptManager::getSelectedEntities() {
     }
     
     CScriptArray* arr = CScriptArray::Create(arrayType);
-    if (!arr) return nullptr;
-    
-    if (!app || !app->mapRenderer || !app->mapRenderer->map) {
-        return arr; // Return empty array
-    }
-    
-    if (app->pickInfo.ents.empty()) {
-        return arr; // Return empty array
-    }
+    if (!arr || !app || !app->mapRenderer || !app->mapRenderer->map) return arr;
     
     Bsp* map = app->mapRenderer->map;
     
-    for (int entIdx : app->pickInfo.ents) {
+    for (int entIdx : entIdxs) {
         if (entIdx >= 0 && entIdx < (int)map->ents.size()) {
             ScriptEntity* ent = new ScriptEntity(map->ents[entIdx], map, entIdx);
             arr->InsertLast(&ent);
@@ -195,6 +195,10 @@ public:
     // Visual refresh after modifications
     void refreshEntityDisplay();
     
+    // Entity connections, returns array of Entity@
+    CScriptArray* getEntityTargets(int index);  // entities the given entity triggers
+    CScriptArray* getEntityCallers(int index);  // entities that trigger the given entity
+    
     // Get all entities by classname (returns array)
     std::vector<ScriptEntity*> getAllEntitiesByClassname(const std::string& classname);
     
@@ -234,6 +238,9 @@ public:
     static float radToDeg(float radians);
     
 private:
+    // returns an array of the entities at the given indexes. Invalid indexes are skipped.
+    CScriptArray* createEntityArray(const std::vector<int>& entIdxs);
+    
     asIScriptEngine* engine;
     asIScriptContext* context;
     asIScriptModule* currentModule;
@@ -57,7 +57,7 @@ Texture::~Texture()
 }
 
 vector<COLOR3> Texture::resample(COLOR3* srcData, int srcW, int srcH, COLOR3* dstData,
-	int dstW, int dstH, int mode, bool masked, COLOR3 maskColor) {
+	int dstW, int dstH, int mode, bool masked, COLOR3 maskColor, int threadCount) {
 	
 	vector<COLOR3> palette;
 
@@ -75,7 +75,7 @@ vector<COLOR3> Texture::resample(COLOR3* srcData, int srcW, int srcH, COLOR3* ds
 		delete[] maskedData;
 
 		// quantize the image, saving one palette entry for the mask color
-		palette = median_cut_quantize(dstData, dstW * dstH, 255);
+		palette = median_cut_quantize(dstData, dstW * dstH, 255, threadCount);
 
 		// apply the mask color using nearest neighbor sampling
 		COLOR3* nearestResamp = new COLOR3[dstW * dstH];
@@ -96,7 +96,7 @@ vector<COLOR3> Texture::resample(COLOR3* srcData, int srcW, int srcH, COLOR3* ds
 		base::ResampleImage24((byte*)srcData, srcW, srcH, (byte*)dstData, dstW, dstH, (base::KernelType)mode);
 		
 		if (mode != KernelTypeNearest) {
-			palette = median_cut_quantize(dstData, dstW * dstH, 256);
+			palette = median_cut_quantize(dstData, dstW * dstH, 256, threadCount);
 		}
 		else {
 			unordered_set<COLOR3> uniqueColors;
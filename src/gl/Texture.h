@@ -50,8 +50,9 @@ public:
 	Texture(int width, int height, void * data);
 	~Texture();
 
+	// threadCount limits the threads used to quantize the result (0 = one per core)
 	static vector<COLOR3> resample(COLOR3* srcData, int srcW, int srcH, COLOR3* dstData,
-		int dstW, int dstH, int mode, bool masked, COLOR3 maskColor);
+		int dstW, int dstH, int mode, bool masked, COLOR3 maskColor, int threadCount=0);
 
 	void generateMipMaps(int mipLevels);
 
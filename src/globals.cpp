@@ -4,9 +4,11 @@
 
 using namespace std;
 
-ProgressMeter g_progress;
+thread_local ProgressMeter g_progress;
 vector<string> g_log_buffer;
 mutex g_log_mutex;
+thread_local string* g_job_log = NULL;
+thread_local int g_job_threads = 0;
 std::thread::id g_main_thread_id = std::this_thread::get_id();
 
 AppSettings g_settings;
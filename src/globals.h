@@ -41,11 +41,19 @@ struct MapLimits {
 class Renderer;
 
 extern bool g_verbose;
-extern ProgressMeter g_progress;
+extern thread_local ProgressMeter g_progress; // per-thread so that batch jobs don't share progress state
 extern std::vector<std::string> g_log_buffer;
 extern const char* g_version_string;
 extern std::mutex g_log_mutex;
 
+// when set, logs from the current thread are collected here instead of being printed.
+// Used by batch jobs so that their output doesn't interleave.
+extern thread_local std::string* g_job_log;
+
+// when set, the most threads that work started by the current thread should use. Batch jobs run
+// side by side, so each one gets a share of the cores.
+extern thread_local int g_job_threads;
+
 extern AppSettings g_settings;
 extern Renderer* g_app;
 extern MapLimits g_limits;
@@ -4,6 +4,8 @@
 #include "CommandLine.h"
 #include "Renderer.h"
 #include "globals.h"
+#include <atomic>
+#include <chrono>
 
 // fix v6:
 // - force rotate not refreshing entities anymore
@@ -185,7 +187,7 @@ void start_viewer(const char* map) {
 		}
 	}
 
-	Renderer renderer = Renderer();
+	Renderer renderer;
 
 	if (!map) {
 		Bsp* emptyBsp = new Bsp();
@@ -262,7 +264,7 @@ int merge_maps(CommandLine& cli) {
 	vector<Bsp*> maps;
 
 	for (int i = 0; i < input_maps.size(); i++) {
-		Bsp* map = new Bsp(input_maps[i]);
+		Bsp* map = new Bsp(input_maps[i], true);
 		if (!map->valid)
 			return 1;
 		maps.push_back(map);
@@ -272,7 +274,7 @@ int merge_maps(CommandLine& cli) {
 		logf("Preprocessing %s:\n", maps[i]->name.c_str());
 
 		logf("    Deleting unused data...\n");
-		STRUCTCOUNT removed = maps[i]->remove_unused_model_structures();
+		STRUCTCOUNT removed = maps[i]->remove_unused_model_structures(true, g_verbose);
 		g_progress.clear();
 		removed.print_delete_stats(2);
 
@@ -297,6 +299,12 @@ int merge_maps(CommandLine& cli) {
 	int max_dim = cli.hasOption("-hl") ? 4096 : 32768;
 
 	BspMerger merger;
+	if (cli.hasOption("-j")) {
+		merger.threadCount = cli.getOptionInt("-j");
+	}
+	if (cli.hasOption("-mem")) {
+		merger.memoryBudget = (size_t)cli.getOptionInt("-mem") * 1024 * 1024;
+	}
 	Bsp* result = merger.merge(maps, gap, output_name,
 		cli.hasOption("-noripent"), cli.hasOption("-noscript"), false, false, max_dim).map;
 
@@ -319,9 +327,21 @@ int merge_maps(CommandLine& cli) {
 }
 
 int print_info(CommandLine& cli) {
-	Bsp* map = new Bsp(cli.bspfile);
-	if (!map->valid)
-		return 1;
+	if (cli.hasOption("-header")) {
+		BSPLIMITSTATS stats;
+		string fpath = cli.bspfile;
+		if (fpath.size() < 4 || toLowerCase(fpath).rfind(".bsp") != fpath.size() - 4) {
+			fpath = fpath + ".bsp";
+		}
+
+		if (!Bsp::read_limit_stats(fpath, stats)) {
+			logf("%s is not a valid BSP file\n", fpath.c_str());
+			return 1;
+		}
+
+		Bsp::print_limit_stats(stats);
+		return 0;
+	}
 
 	bool limitMode = false;
 	int listLength = 10;
@@ -352,6 +372,11 @@ int print_info(CommandLine& cli) {
 		listLength = 32768; // should be more than enough
 	}
 
+	// entity objects are only needed to name the models in the -limit list
+	Bsp* map = new Bsp(cli.bspfile, true, limitMode);
+	if (!map->valid)
+		return 1;
+
 	map->print_info(limitMode, listLength, sortMode);
 
 	delete map;
@@ -360,7 +385,7 @@ int print_info(CommandLine& cli) {
 }
 
 int noclip(CommandLine& cli) {
-	Bsp* map = new Bsp(cli.bspfile);
+	Bsp* map = new Bsp(cli.bspfile, true);
 	if (!map->valid)
 		return 1;
 
@@ -459,7 +484,7 @@ int noclip(CommandLine& cli) {
 }
 
 int simplify(CommandLine& cli) {
-	Bsp* map = new Bsp(cli.bspfile);
+	Bsp* map = new Bsp(cli.bspfile, true);
 	if (!map->valid)
 		return 1;
 
@@ -522,7 +547,7 @@ int simplify(CommandLine& cli) {
 }
 
 int deleteCmd(CommandLine& cli) {
-	Bsp* map = new Bsp(cli.bspfile);
+	Bsp* map = new Bsp(cli.bspfile, true);
 	if (!map->valid)
 		return 1;
 
@@ -552,7 +577,7 @@ int deleteCmd(CommandLine& cli) {
 }
 
 int transform(CommandLine& cli) {
-	Bsp* map = new Bsp(cli.bspfile);
+	Bsp* map = new Bsp(cli.bspfile, true);
 	if (!map->valid)
 		return 1;
 
@@ -582,7 +607,7 @@ int transform(CommandLine& cli) {
 }
 
 int unembed(CommandLine& cli) {
-	Bsp* map = new Bsp(cli.bspfile);
+	Bsp* map = new Bsp(cli.bspfile, true);
 	if (!map->valid)
 		return 1;
 
@@ -592,11 +617,13 @@ int unembed(CommandLine& cli) {
 	if (map->isValid()) map->write(cli.hasOption("-o") ? cli.getOption("-o") : map->path);
 	logf("\n");
 
+	delete map;
+
 	return 0;
 }
 
 int rename_texture(CommandLine& cli) {
-	Bsp* map = new Bsp(cli.bspfile);
+	Bsp* map = new Bsp(cli.bspfile, true);
 	if (!map->valid)
 		return 1;
 
@@ -614,6 +641,161 @@ int rename_texture(CommandLine& cli) {
 }
 
 
+int run_command(CommandLine& cli) {
+	if (cli.command == "info") {
+		return print_info(cli);
+	}
+	else if (cli.command == "noclip") {
+		return noclip(cli);
+	}
+	else if (cli.command == "simplify") {
+		return simplify(cli);
+	}
+	else if (cli.command == "delete") {
+		return deleteCmd(cli);
+	}
+	else if (cli.command == "transform") {
+		return transform(cli);
+	}
+	else if (cli.command == "merge") {
+		return merge_maps(cli);
+	}
+	else if (cli.command == "unembed") {
+		return unembed(cli);
+	}
+	else if (cli.command == "renametex") {
+		return rename_texture(cli);
+	}
+	else {
+		logf("unrecognized command: %s\n", cli.command.c_str());
+	}
+
+	return 1;
+}
+
+struct BatchJob {
+	string bspfile;
+	string log;
+	int result;
+	double seconds;
+};
+
+// runs the command on every map matched by the -batch option, using a pool of worker threads
+int run_batch(CommandLine& cli) {
+	if (cli.command == "merge") {
+		logf("ERROR: merge can't be used with -batch\n");
+		return 1;
+	}
+	if (cli.hasOption("-o")) {
+		logf("ERROR: -o can't be used with -batch. Maps are overwritten in place.\n");
+		return 1;
+	}
+
+	string source = cli.getOption("-batch");
+	vector<string> fpaths;
+
+	if (source.find_first_of("*?") != string::npos) {
+		fpaths = getMatchingFiles(source);
+	}
+	else {
+		// list file with one map path per line
+		int len;
+		char* dat = loadFile(source, len);
+		if (!dat) {
+			logf("ERROR: failed to read map list %s\n", source.c_str());
+			return 1;
+		}
+
+		vector<string> lines = splitString(string(dat, len), "\n");
+		delete[] dat;
+
+		for (int i = 0; i < lines.size(); i++) {
+			string line = trimSpaces(lines[i]);
+			if (line.empty() || line[0] == '#') {
+				continue;
+			}
+			fpaths.push_back(line);
+		}
+	}
+
+	if (fpaths.empty()) {
+		logf("ERROR: no maps found for %s\n", source.c_str());
+		return 1;
+	}
+
+	int threadCount = cli.hasOption("-j") ? cli.getOptionInt("-j") : thread::hardware_concurrency();
+	threadCount = max(1, min(threadCount, (int)fpaths.size()));
+
+	logf("Running '%s' on %d maps with %d threads\n\n", cli.command.c_str(), (int)fpaths.size(), threadCount);
+
+	// jobs share the cores instead of each starting a thread per core
+	int threadsPerJob = max(1, (int)thread::hardware_concurrency() / threadCount);
+
+	vector<BatchJob> jobs(fpaths.size());
+	for (int i = 0; i < fpaths.size(); i++) {
+		jobs[i].bspfile = fpaths[i];
+		jobs[i].result = 1;
+		jobs[i].seconds = 0;
+	}
+
+	atomic<int> nextJob(0);
+	atomic<int> jobsDone(0);
+
+	auto worker = [&]() {
+		// progress meters from parallel jobs would overwrite each other
+		g_progress.hide = true;
+
+		for (int i = nextJob++; i < jobs.size(); i = nextJob++) {
+			BatchJob& job = jobs[i];
+			CommandLine jobCli = cli;
+			jobCli.bspfile = job.bspfile;
+
+			auto start = chrono::steady_clock::now();
+
+			g_job_log = &job.log;
+			g_job_threads = threadsPerJob;
+			job.result = run_command(jobCli);
+			g_job_log = NULL;
+			g_job_threads = 0;
+
+			job.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+			// print the whole log at once so that jobs don't interleave
+			string title = "==== [" + to_string(++jobsDone) + "/" + to_string(jobs.size()) + "] " + job.bspfile + " ====\n";
+			logText(title + job.log + "\n");
+			job.log.clear();
+		}
+	};
+
+	vector<thread> threads;
+	for (int i = 0; i < threadCount; i++) {
+		threads.push_back(thread(worker));
+	}
+	for (int i = 0; i < threads.size(); i++) {
+		threads[i].join();
+	}
+
+	int failures = 0;
+	double totalTime = 0;
+
+	logf("  Result   Time (s)   Map\n");
+	logf("--------  ---------  ------------------------------\n");
+	for (int i = 0; i < jobs.size(); i++) {
+		bool ok = jobs[i].result == 0;
+		failures += !ok;
+		totalTime += jobs[i].seconds;
+
+		if (!ok)
+			print_color(PRINT_RED | PRINT_BRIGHT);
+		logf("%8s  %9.2f  %s\n", ok ? "OK" : "FAILED", jobs[i].seconds, jobs[i].bspfile.c_str());
+		if (!ok)
+			print_color(PRINT_RED | PRINT_GREEN | PRINT_BLUE);
+	}
+	logf("\n%d of %d maps succeeded (%.2fs of work)\n", (int)jobs.size() - failures, (int)jobs.size(), totalTime);
+
+	return failures ? 1 : 0;
+}
+
 void print_help(string command) {
 	if (command == "merge") {
 		logf(
@@ -642,7 +824,11 @@ void print_help(string command) {
 			"  -hl          : Arranges maps to fit inside the vanilla Half-Life engine (+/-4096).\n"
 			"                 Otherwise uses the Sven Co-op limit of +/-32768.\n"
 			"  -gap \"X,Y,Z\" : Amount of extra space to add between each map\n"
-			"  -v           : Verbose console output.\n"
+			"  -j <count>   : Number of threads used to merge lumps and maps. Defaults to\n"
+			"                 the number of CPU cores. Use 1 to merge one at a time.\n"
+			"  -mem <MB>    : Limits how many maps are merged at once, based on their\n"
+			"                 estimated memory usage. Default is 2048.\n"
+			"  -v           : Verbose console output. Includes the time spent on each lump.\n"
 			);
 	}
 	else if (command == "info") {
@@ -656,6 +842,8 @@ void print_help(string command) {
 			"  -limit <name> : List the models contributing most to the named limit.\n"
 			"                  <name> can be one of: [clipnodes, nodes, faces, vertexes]\n"
 			"  -all          : Show the full list of models when using -limit.\n"
+			"  -header       : Only read lump sizes from the BSP header. Much faster, but\n"
+			"                  skips the AllocBlock, lightstyle, and entity counts.\n"
 			);
 	}
 	else if (command == "noclip") {
@@ -752,6 +940,13 @@ void print_help(string command) {
 			"  unembed   : Deletes embedded texture data\n"
 			"  renametex : Renames/replaces a texture in the BSP\n"
 
+			"\n[Batch mode]\n"
+			"  bspguy <command> -batch <pattern|listfile> [-j #] [options]\n"
+			"  Runs the command on every map matching a wildcard pattern (\"maps/*.bsp\"),\n"
+			"  or on every map listed in a text file (one path per line). Maps are\n"
+			"  processed in parallel by -j threads (default = CPU count). -o is not\n"
+			"  allowed, and merge is not supported.\n"
+
 			"\nRun 'bspguy <command> help' to read about a specific command.\n"
 			"\nTo launch the 3D editor, run this program without any arguments."
 			);
@@ -841,42 +1036,20 @@ int main(int argc, char* argv[])
 	}
 	else
 	{
-		if (cli.bspfile.empty()) {
-			logf("ERROR: no map specified\n"); 
-			return 1;
-		}
-
 		if (cli.hasOption("-v")) {
 			g_verbose = true;
 		}
 
-		if (cli.command == "info") {
-			return print_info(cli);
-		}
-		else if (cli.command == "noclip") {
-			return noclip(cli);
-		}
-		else if (cli.command == "simplify") {
-			return simplify(cli);
-		}
-		else if (cli.command == "delete") {
-			return deleteCmd(cli);
+		if (cli.hasOption("-batch")) {
+			return run_batch(cli);
 		}
-		else if (cli.command == "transform") {
-			return transform(cli);
-		}
-		else if (cli.command == "merge") {
-			return merge_maps(cli);
-		}
-		else if (cli.command == "unembed") {
-			return unembed(cli);
-		}
-		else if (cli.command == "renametex") {
-			return rename_texture(cli);
-		}
-		else {
-			logf("unrecognized command: %d\n", cli.command.c_str());
+
+		if (cli.bspfile.empty()) {
+			logf("ERROR: no map specified\n"); 
+			return 1;
 		}
+
+		return run_command(cli);
 	}
 
 	return 0;
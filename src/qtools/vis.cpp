@@ -2,9 +2,13 @@
 #include "rad.h"
 #include "util.h"
 #include "globals.h"
+#include "StructIndex.h"
 #include <string.h>
+#include <thread>
+#include <unordered_map>
 
 #define MAX_MAP_LEAVES 65536 // set this to the largest value in any engine
+#define MIN_ROWS_PER_THREAD 256 // smaller jobs aren't worth starting a thread for
 
 bool g_debug_shift = false;
 
@@ -30,115 +34,109 @@ void printVisRow(byte* vis, int len, int offsetLeaf, int mask) {
 	logf("\n");
 }
 
-bool shiftVis(byte* vis, int len, int offsetLeaf, int shift) {
-	if (shift == 0)
-		return false;
+// Rows are processed in chunks of up to 56 bits, which is the most a 64-bit load can hold at any bit offset.
+// These assume a little-endian CPU, like the rest of the BSP code.
+#define BIT_CHUNK 56
 
-	byte bitsPerStep = 8;
-	byte offsetBit = offsetLeaf % bitsPerStep;
-	byte mask = 0; // part of the byte that shouldn't be shifted
-	for (int i = 0; i < offsetBit; i++) {
-		mask |= 1 << i;
+// reads BIT_CHUNK bits starting at the given bit. Bits past the end of the row read as 0.
+static inline uint64_t readBits(const byte* row, int rowBytes, int bitPos) {
+	int byteIdx = bitPos >> 3;
+	int avail = rowBytes - byteIdx;
+	if (avail <= 0) {
+		return 0;
 	}
 
-	int byteShifts = abs(shift) / 8;
-	int bitShifts = abs(shift) % 8;
+	uint64_t word = 0;
+	memcpy(&word, row + byteIdx, avail < 8 ? avail : 8);
+	return word >> (bitPos & 7);
+}
+
+// writes the low bitCount bits (at most BIT_CHUNK) of bits, starting at the given bit
+static inline void writeBits(byte* row, int bitPos, uint64_t bits, int bitCount) {
+	int byteIdx = bitPos >> 3;
+	int shift = bitPos & 7;
+	int byteCount = (shift + bitCount + 7) >> 3;
+	uint64_t mask = ((1ULL << bitCount) - 1) << shift;
+
+	uint64_t word = 0;
+	memcpy(&word, row + byteIdx, byteCount);
+	word = (word & ~mask) | ((bits << shift) & mask);
+	memcpy(row + byteIdx, &word, byteCount);
+}
 
-	// shift until offsetLeaf isn't sharing a byte with the leaves that come before it
-	// then we can do a much faster memcpy on the section that needs to be shifted
-	if ((offsetLeaf % 8) + bitShifts < 8 && byteShifts > 0) {
-		byteShifts -= 1;
-		bitShifts += 8;
+// sets bits in the range [start, end) to 0
+static void clearBits(byte* row, int start, int end) {
+	for (int i = start; i < end; i += BIT_CHUNK) {
+		int count = end - i < BIT_CHUNK ? end - i : BIT_CHUNK;
+		writeBits(row, i, 0, count);
 	}
+}
 
-	if (shift < 0) {
-		// TODO: memcpy for negative shifts
-		bitShifts = abs(shift);
-		byteShifts = 0;
+// counts the set bits in the range [start, end)
+static int countBits(const byte* row, int rowBytes, int start, int end) {
+	int total = 0;
+	for (int i = start; i < end; i += BIT_CHUNK) {
+		int count = end - i < BIT_CHUNK ? end - i : BIT_CHUNK;
+		uint64_t bits = readBits(row, rowBytes, i) & ((1ULL << count) - 1);
+		while (bits) {
+			bits &= bits - 1;
+			total++;
+		}
 	}
+	return total;
+}
+
+bool shiftVis(byte* vis, int len, int offsetLeaf, int shift) {
+	if (shift == 0)
+		return false;
+
+	int totalBits = len * 8;
+	byte mask = (1 << (offsetLeaf % 8)) - 1; // part of the byte that shouldn't be shifted
 
 	if (g_debug_shift) {
 		logf("\nSHIFT\n");
+		logf("%2d = ", 0);
+		printVisRow(vis, len, offsetLeaf, mask);
 	}
 
 	int overflow = 0;
-	for (int k = 0; k < bitShifts; k++) {
 
-		if (g_debug_shift) {
-			logf("%2d = ", k);
-			printVisRow(vis, len, offsetLeaf, mask);
+	if (shift > 0) {
+		// leaves shifted past the end of the row are lost
+		int lostStart = totalBits - shift > offsetLeaf ? totalBits - shift : offsetLeaf;
+		overflow = countBits(vis, len, lostStart, totalBits);
+
+		// move chunks starting from the end of the row, so each chunk is read before it's overwritten
+		for (int end = totalBits - shift; end > offsetLeaf; ) {
+			int count = end - offsetLeaf < BIT_CHUNK ? end - offsetLeaf : BIT_CHUNK;
+			int src = end - count;
+			writeBits(vis, src + shift, readBits(vis, len, src), count);
+			end = src;
 		}
 
-		if (shift > 0) {
-			bool carry = 0;
-			for (int i = 0; i < len; i++) {
-				uint oldCarry = carry;
-				carry = (vis[i] & 0x80) != 0;
-
-				if (offsetBit != 0 && i * bitsPerStep < offsetLeaf && i * bitsPerStep + bitsPerStep > offsetLeaf) {
-					vis[i] = (vis[i] & mask) | ((vis[i] & ~mask) << 1);
-				}
-				else if (i >= offsetLeaf / bitsPerStep) {
-					vis[i] = (vis[i] << 1) + oldCarry;
-				}
-				else {
-					carry = 0;
-				}
-			}
-
-			if (carry) {
-				overflow++;
-			}
+		clearBits(vis, offsetLeaf, offsetLeaf + shift < totalBits ? offsetLeaf + shift : totalBits);
+	}
+	else {
+		int dist = -shift;
+
+		// leaves in [offsetLeaf, offsetLeaf + dist) are overwritten by the ones after them
+		for (int dst = offsetLeaf; dst < totalBits - dist; ) {
+			int count = totalBits - dist - dst < BIT_CHUNK ? totalBits - dist - dst : BIT_CHUNK;
+			writeBits(vis, dst, readBits(vis, len, dst + dist), count);
+			dst += count;
 		}
-		else {
-			bool carry = 0;
-			for (int i = len-1; i >= 0; i--) {
-				uint oldCarry = carry;
-				carry = (vis[i] & 0x01) != 0;
-
-				if (offsetBit != 0 && i * bitsPerStep < offsetLeaf && i * bitsPerStep + bitsPerStep > offsetLeaf) {
-					vis[i] = (vis[i] & mask) | ((vis[i] >> 1) & ~mask) | (oldCarry << 7);
-				}
-				else if (i >= offsetLeaf / bitsPerStep) {
-					vis[i] = (vis[i] >> 1) + (oldCarry << 7);
-				}
-				else {
-					carry = 0;
-				}
-			}
 
-			if (carry) {
-				overflow++;
-			}
-		}
+		clearBits(vis, totalBits - dist > offsetLeaf ? totalBits - dist : offsetLeaf, totalBits);
+	}
 
-		if (g_debug_shift && k == bitShifts-1) {
-			logf("%2d = ", k+1);
-			printVisRow(vis, len, offsetLeaf, mask);
-		}
+	if (g_debug_shift) {
+		logf("%2d = ", abs(shift));
+		printVisRow(vis, len, offsetLeaf, mask);
 	}
+
 	if (overflow)
 		logf("OVERFLOWED %d VIS LEAVES WHILE SHIFTING FROM LEAF %d\n", overflow, offsetLeaf);
 
-
-	if (byteShifts > 0) {
-		// TODO: detect overflows here too
-		static byte temp[MAX_MAP_LEAVES / 8];
-
-		if (shift > 0) {
-			int startByte = (offsetLeaf + bitShifts) / 8;
-			int moveSize = len - (startByte + byteShifts);
-
-			memcpy(temp, (byte*)vis + startByte, moveSize);
-			memset((byte*)vis + startByte, 0, byteShifts);
-			memcpy((byte*)vis + startByte + byteShifts, temp, moveSize);
-		}
-		else {
-			// TODO LOL
-		}
-		
-	}
-
 	return overflow;
 }
 
@@ -209,156 +207,240 @@ bool decompress_vis_lump(BSPLEAF* leafLump, byte* visLump, int visLength, byte*
 // BEGIN COPIED QVIS CODE
 //
 
+// returns the number of non-zero bytes at the start of the buffer, checking 8 bytes at a time
+static inline int nonZeroRun(const byte* src, int maxLen) {
+	int i = 0;
+	for (; i + 8 <= maxLen; i += 8) {
+		uint64_t word;
+		memcpy(&word, src + i, 8);
+
+		// sets the high bit of each zero byte. Bytes after the first zero can be false positives.
+		uint64_t zeroBytes = (word - 0x0101010101010101ULL) & ~word & 0x8080808080808080ULL;
+		if (zeroBytes) {
+			return i + (countTrailingZeros64(zeroBytes) >> 3);
+		}
+	}
+	while (i < maxLen && src[i]) {
+		i++;
+	}
+	return i;
+}
+
+// returns the number of zero bytes at the start of the buffer, checking 8 bytes at a time
+static inline int zeroRun(const byte* src, int maxLen) {
+	int i = 0;
+	for (; i + 8 <= maxLen; i += 8) {
+		uint64_t word;
+		memcpy(&word, src + i, 8);
+		if (word) {
+			return i + (countTrailingZeros64(word) >> 3);
+		}
+	}
+	while (i < maxLen && !src[i]) {
+		i++;
+	}
+	return i;
+}
+
 bool DecompressVis(const byte* src, byte* const dest, const unsigned int dest_length, uint numLeaves,
 	byte* visLump, int visLength)
 {
-	unsigned int    current_length = 0;
-	int             c;
-	byte* out;
-	int             row;
-
-	row = (numLeaves + 7) >> 3; // same as the length used by VIS program in CompressVis
+	int row = (numLeaves + 7) >> 3; // same as the length used by VIS program in CompressVis
 	// The wrong size will cause DecompressVis to spend extremely long time once the source pointer runs into the invalid area in g_dvisdata (for example, in BuildFaceLights, some faces could hang for a few seconds), and sometimes to crash.
-	out = dest;
+	const byte* visEnd = visLump + visLength;
+	int outLen = 0;
 
-	do
+	hlassume(row <= (int)dest_length, assume_DECOMPRESSVIS_OVERFLOW);
+	if (row > (int)dest_length) {
+		row = dest_length;
+	}
+
+	while (outLen < row)
 	{
-		if (src - visLump >= visLength) {
-			//hlassume(src - visLump < visLength, assume_DECOMPRESSVIS_OVERFLOW);
+		if (src >= visEnd) {
 			return false;
 		}
+
 		if (*src)
 		{
-			current_length++;
-			hlassume(current_length <= dest_length, assume_DECOMPRESSVIS_OVERFLOW);
+			// copy the whole run of literal bytes at once
+			int maxRun = row - outLen;
+			if (visEnd - src < maxRun) {
+				maxRun = visEnd - src;
+			}
 
-			*out = *src;
-			out++;
-			src++;
+			int run = nonZeroRun(src, maxRun);
+			memcpy(dest + outLen, src, run);
+			outLen += run;
+			src += run;
 			continue;
 		}
 
-		//hlassume(&src[1] - g_dvisdata < g_visdatasize, assume_DECOMPRESSVIS_OVERFLOW);
-		c = src[1];
-		src += 2;
-		while (c)
-		{
-			current_length++;
-			hlassume(current_length <= dest_length, assume_DECOMPRESSVIS_OVERFLOW);
-
-			*out = 0;
-			out++;
-			c--;
+		if (src + 1 >= visEnd) {
+			return false;
+		}
 
-			if (out - dest >= row)
-			{
-				return true;
-			}
+		int c = src[1];
+		src += 2;
+		if (c > row - outLen) {
+			c = row - outLen;
 		}
-	} while (out - dest < row);
+
+		memset(dest + outLen, 0, c);
+		outLen += c;
+	}
 
 	return true;
 }
 
 int CompressVis(const byte* const src, const unsigned int src_length, byte* dest, unsigned int dest_length)
 {
-	unsigned int    j;
-	byte* dest_p = dest;
-	unsigned int    current_length = 0;
+	unsigned int j = 0;
+	unsigned int current_length = 0;
 
-	for (j = 0; j < src_length; j++)
+	while (j < src_length)
 	{
-		current_length++;
-		hlassume(current_length <= dest_length, assume_COMPRESSVIS_OVERFLOW);
-
-		*dest_p = src[j];
-		dest_p++;
-
 		if (src[j])
 		{
+			int run = nonZeroRun(src + j, src_length - j);
+
+			hlassume(current_length + run <= dest_length, assume_COMPRESSVIS_OVERFLOW);
+			if (current_length + run > dest_length) {
+				break;
+			}
+
+			memcpy(dest + current_length, src + j, run);
+			current_length += run;
+			j += run;
 			continue;
 		}
 
-		unsigned char   rep = 1;
+		// zero runs are stored as a 0 followed by the run length
+		int maxRun = src_length - j < 255 ? src_length - j : 255;
+		int rep = zeroRun(src + j, maxRun);
 
-		for (j++; j < src_length; j++)
-		{
-			if (src[j] || rep == 255)
-			{
-				break;
-			}
-			else
-			{
-				rep++;
-			}
+		hlassume(current_length + 2 <= dest_length, assume_COMPRESSVIS_OVERFLOW);
+		if (current_length + 2 > dest_length) {
+			break;
 		}
-		current_length++;
-		hlassume(current_length <= dest_length, assume_COMPRESSVIS_OVERFLOW);
 
-		*dest_p = rep;
-		dest_p++;
-		j--;
+		dest[current_length++] = 0;
+		dest[current_length++] = rep;
+		j += rep;
 	}
 
-	return dest_p - dest;
+	return current_length;
 }
 
-int CompressAll(BSPLEAF* leafs, byte* uncompressed, byte* output, int numLeaves, int bufferSize)
+int CompressAll(BSPLEAF* leafs, byte* uncompressed, byte* output, int numLeaves, int bufferSize, int threadCount)
 {
-	int x = 0;
-	byte* dest;
-	byte* src;
-	byte compressed[MAX_MAP_LEAVES / 8];
 	uint g_bitbytes = ((numLeaves + 63) & ~63) >> 3;
 
-	byte* vismap_p = output;
-
+	// leaves with identical rows share compressed data
 	int* sharedRows = new int[numLeaves];
+	vector<int> uniqueRows;
+	unordered_multimap<uint64_t, int> rowHashes;
+	rowHashes.reserve(numLeaves);
+
 	for (int i = 0; i < numLeaves; i++) {
 		byte* src = uncompressed + i * g_bitbytes;
+		uint64_t hash = hashBytes(src, g_bitbytes);
 
 		sharedRows[i] = i;
-		for (int k = 0; k < i; k++) {
-			if (sharedRows[k] != k) {
-				continue; // already compared in an earlier row
-			}
-			byte* previous = uncompressed + k * g_bitbytes;
-			if (memcmp(src, previous, g_bitbytes) == 0) {
-				sharedRows[i] = k;
+		auto range = rowHashes.equal_range(hash);
+		for (auto it = range.first; it != range.second; ++it) {
+			if (memcmp(src, uncompressed + it->second * g_bitbytes, g_bitbytes) == 0) {
+				sharedRows[i] = it->second;
 				break;
 			}
 		}
+
+		if (sharedRows[i] == i) {
+			rowHashes.insert(std::make_pair(hash, i));
+			uniqueRows.push_back(i);
+		}
 		g_progress.tick();
 	}
 
-	for (int i = 0; i < numLeaves; i++)
-	{
-		if (sharedRows[i] != i) {
-			leafs[i + 1].nVisOffset = leafs[sharedRows[i] + 1].nVisOffset;
-			continue;
+	if (threadCount <= 0) {
+		threadCount = std::thread::hardware_concurrency();
+	}
+	int uniqueCount = uniqueRows.size();
+	threadCount = qmax(1, qmin(threadCount, uniqueCount / MIN_ROWS_PER_THREAD));
+
+	// each thread compresses a contiguous range of rows into its own buffer,
+	// so concatenating the buffers gives the same layout as compressing in order
+	vector<vector<byte>> threadOutput(threadCount);
+	vector<int> compressedOffset(uniqueCount); // relative to the start of the thread's buffer
+	vector<int> compressedSize(uniqueCount);
+
+	auto compress_rows = [&](int threadIdx) {
+		byte compressed[MAX_MAP_LEAVES / 8];
+		vector<byte>& dest = threadOutput[threadIdx];
+		int start = (int)(((int64_t)uniqueCount * threadIdx) / threadCount);
+		int end = (int)(((int64_t)uniqueCount * (threadIdx + 1)) / threadCount);
+
+		for (int k = start; k < end; k++) {
+			byte* src = uncompressed + uniqueRows[k] * g_bitbytes;
+			int x = CompressVis(src, g_bitbytes, compressed, sizeof(compressed));
+
+			compressedOffset[k] = dest.size();
+			compressedSize[k] = x;
+			dest.insert(dest.end(), compressed, compressed + x);
 		}
+	};
 
-		memset(&compressed, 0, sizeof(compressed));
-
-		src = uncompressed + i * g_bitbytes;
+	if (threadCount == 1) {
+		compress_rows(0);
+	}
+	else {
+		vector<std::thread> threads;
+		for (int i = 0; i < threadCount; i++) {
+			threads.push_back(std::thread(compress_rows, i));
+		}
+		for (int i = 0; i < threadCount; i++) {
+			threads[i].join();
+		}
+	}
 
-		// Compress all leafs into global compression buffer
-		x = CompressVis(src, g_bitbytes, compressed, sizeof(compressed));
+	// prefix sum of the thread buffer sizes gives each buffer's position in the output
+	vector<int> threadBase(threadCount);
+	int totalSize = 0;
+	for (int i = 0; i < threadCount; i++) {
+		threadBase[i] = totalSize;
+		totalSize += threadOutput[i].size();
+	}
 
-		dest = vismap_p;
-		vismap_p += x;
+	if (totalSize > bufferSize)
+	{
+		logf("Vismap expansion overflow\n");
+	}
 
-		if (vismap_p > output + bufferSize)
-		{
-			logf("Vismap expansion overflow\n");
+	for (int i = 0; i < threadCount; i++) {
+		int copySize = qmin((int)threadOutput[i].size(), bufferSize - threadBase[i]);
+		if (copySize > 0) {
+			memcpy(output + threadBase[i], &threadOutput[i][0], copySize);
 		}
+	}
+
+	for (int t = 0; t < threadCount; t++) {
+		int start = (int)(((int64_t)uniqueCount * t) / threadCount);
+		int end = (int)(((int64_t)uniqueCount * (t + 1)) / threadCount);
 
-		leafs[i + 1].nVisOffset = dest - output;            // leaf 0 is a common solid
+		for (int k = start; k < end; k++) {
+			int offset = threadBase[t] + compressedOffset[k];
+			bool fits = offset + compressedSize[k] <= bufferSize;
+			leafs[uniqueRows[k] + 1].nVisOffset = fits ? offset : -1; // leaf 0 is a common solid
+		}
+	}
 
-		memcpy(dest, compressed, x);
+	for (int i = 0; i < numLeaves; i++) {
+		if (sharedRows[i] != i) {
+			leafs[i + 1].nVisOffset = leafs[sharedRows[i] + 1].nVisOffset;
+		}
 	}
 
 	delete[] sharedRows;
 
-	return vismap_p - output;
+	return qmin(totalSize, bufferSize);
 }
@@ -1,5 +1,10 @@
+#pragma once
 #include "types.h"
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 struct BSPLEAF;
 
 bool shiftVis(byte* vis, int len, int offsetLeaf, int shift);
@@ -20,7 +25,19 @@ bool DecompressVis(const byte* src, byte* const dest, const unsigned int dest_le
 
 int CompressVis(const byte* const src, const unsigned int src_length, byte* dest, unsigned int dest_length);
 
-// compress all VIS data for every leaf. numLeaves should exclude the shared solid leaf 0
-int CompressAll(BSPLEAF* leafs, byte* uncompressed, byte* output, int numLeaves, int bufferSize);
-
-extern bool g_debug_shift;
\ No newline at end of file
+// compress all VIS data for every leaf. numLeaves should exclude the shared solid leaf 0.
+// Rows are compressed in parallel (threadCount <= 0 uses every core), and leaves with identical rows share data.
+int CompressAll(BSPLEAF* leafs, byte* uncompressed, byte* output, int numLeaves, int bufferSize, int threadCount = 0);
+
+extern bool g_debug_shift;
+
+// index of the lowest set bit. v must not be 0
+inline int countTrailingZeros64(uint64_t v) {
+#ifdef _MSC_VER
+	unsigned long idx;
+	_BitScanForward64(&idx, v);
+	return idx;
+#else
+	return __builtin_ctzll(v);
+#endif
+}
\ No newline at end of file
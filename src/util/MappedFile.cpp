@@ -0,0 +1,103 @@
+#include "MappedFile.h"
+
+#ifdef WIN32
+#include <Windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile() {
+	mem = NULL;
+	len = 0;
+}
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+bool MappedFile::open(const string& fpath) {
+	close();
+
+#ifdef WIN32
+	HANDLE file = CreateFileA(fpath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	LARGE_INTEGER fsize;
+	if (!GetFileSizeEx(file, &fsize) || fsize.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+	CloseHandle(file);
+	if (!mapping) {
+		return false;
+	}
+
+	// the view keeps the mapping object alive after its handle is closed
+	void* view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+	CloseHandle(mapping);
+	if (!view) {
+		return false;
+	}
+
+	mem = (byte*)view;
+	len = (size_t)fsize.QuadPart;
+#else
+	int fd = ::open(fpath.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat sb;
+	if (fstat(fd, &sb) != 0 || sb.st_size == 0) {
+		::close(fd);
+		return false;
+	}
+
+	// the mapping stays valid after the descriptor is closed
+	void* view = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (view == MAP_FAILED) {
+		return false;
+	}
+
+	mem = (byte*)view;
+	len = sb.st_size;
+#endif
+
+	return true;
+}
+
+void MappedFile::close() {
+	if (!mem) {
+		return;
+	}
+
+#ifdef WIN32
+	UnmapViewOfFile(mem);
+#else
+	munmap(mem, len);
+#endif
+
+	mem = NULL;
+	len = 0;
+}
+
+bool MappedFile::contains(const void* ptr) {
+	return mem && (const byte*)ptr >= mem && (const byte*)ptr < mem + len;
+}
+
+byte* MappedFile::data() {
+	return mem;
+}
+
+size_t MappedFile::size() {
+	return len;
+}
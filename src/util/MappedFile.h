@@ -0,0 +1,28 @@
+#pragma once
+#include "types.h"
+#include <string>
+
+// Maps a file into memory for reading. Pages are mapped copy-on-write, so writing through
+// the returned pointer only modifies private memory and never reaches the file on disk.
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	// returns false if the file could not be opened or mapped
+	bool open(const string& fpath);
+
+	// unmaps the file. Pointers into the mapping are invalid after this.
+	void close();
+
+	// true if ptr points somewhere inside the mapped region
+	bool contains(const void* ptr);
+
+	byte* data();
+	size_t size();
+
+private:
+	byte* mem;
+	size_t len;
+};
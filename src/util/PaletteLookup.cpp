@@ -0,0 +1,128 @@
+#include "PaletteLookup.h"
+#include <string.h>
+#include <algorithm>
+
+PaletteLookup::PaletteLookup(const COLOR3* palette, int count) {
+	this->count = std::min(std::max(count, 0), 256);
+	memcpy(this->palette, palette, this->count * sizeof(COLOR3));
+	memset(hashKeys, 0, sizeof(hashKeys));
+	memset(hashValues, 0, sizeof(hashValues));
+
+	for (int i = 0; i < this->count; i++) {
+		COLOR3 c = palette[i];
+		uint32_t key = ((c.r << 16) | (c.g << 8) | c.b) + 1;
+		uint32_t slot = hashSlot(key);
+
+		while (hashKeys[slot] && hashKeys[slot] != key) {
+			slot = (slot + 1) & (HASH_SIZE - 1);
+		}
+		if (!hashKeys[slot]) { // keep the first entry for duplicate colors
+			hashKeys[slot] = key;
+			hashValues[slot] = i;
+		}
+	}
+
+	// A palette color can only be the nearest to something in a cell if its distance to the closest
+	// point of the cell is no larger than the smallest distance any color has to the cell's farthest point.
+	int cellCount = GRID_DIM * GRID_DIM * GRID_DIM;
+	int minDist[256];
+	int maxDist[256];
+
+	for (int cell = 0; cell < cellCount; cell++) {
+		cellStart[cell] = candidates.size();
+
+		int lo[3] = {
+			(cell / (GRID_DIM * GRID_DIM)) << GRID_SHIFT,
+			((cell / GRID_DIM) % GRID_DIM) << GRID_SHIFT,
+			(cell % GRID_DIM) << GRID_SHIFT
+		};
+		int bestMax = INT32_MAX;
+
+		for (int i = 0; i < this->count; i++) {
+			if (findExact(palette[i]) != i) {
+				minDist[i] = INT32_MAX; // duplicate color, never chosen over the first entry
+				continue;
+			}
+
+			int v[3] = { palette[i].r, palette[i].g, palette[i].b };
+			minDist[i] = maxDist[i] = 0;
+			for (int a = 0; a < 3; a++) {
+				int hi = lo[a] + (1 << GRID_SHIFT) - 1;
+				int near = v[a] < lo[a] ? lo[a] - v[a] : (v[a] > hi ? v[a] - hi : 0);
+				int far = std::max(v[a] - lo[a], hi - v[a]);
+				minDist[i] += near * near;
+				maxDist[i] += far * far;
+			}
+			bestMax = std::min(bestMax, maxDist[i]);
+		}
+
+		for (int i = 0; i < this->count; i++) {
+			if (minDist[i] <= bestMax) {
+				candidates.push_back(i);
+			}
+		}
+	}
+	cellStart[cellCount] = candidates.size();
+}
+
+uint8_t PaletteLookup::find(COLOR3 c) const {
+	int idx = findExact(c);
+	return idx != -1 ? idx : findNearest(c);
+}
+
+void PaletteLookup::findAll(const COLOR3* colors, uint8_t* indexes, int count) const {
+	if (count <= 0) {
+		return;
+	}
+
+	// neighboring pixels often have the same color
+	COLOR3 last = colors[0];
+	uint8_t lastIdx = find(last);
+
+	for (int i = 0; i < count; i++) {
+		COLOR3 c = colors[i];
+		if (c.r != last.r || c.g != last.g || c.b != last.b) {
+			last = c;
+			lastIdx = find(c);
+		}
+		indexes[i] = lastIdx;
+	}
+}
+
+int PaletteLookup::findExact(COLOR3 c) const {
+	uint32_t key = ((c.r << 16) | (c.g << 8) | c.b) + 1;
+	uint32_t slot = hashSlot(key);
+
+	while (hashKeys[slot]) {
+		if (hashKeys[slot] == key) {
+			return hashValues[slot];
+		}
+		slot = (slot + 1) & (HASH_SIZE - 1);
+	}
+
+	return -1;
+}
+
+uint8_t PaletteLookup::findNearest(COLOR3 c) const {
+	int cell = ((c.r >> GRID_SHIFT) * GRID_DIM + (c.g >> GRID_SHIFT)) * GRID_DIM + (c.b >> GRID_SHIFT);
+
+	int best = 0;
+	int bestDist = INT32_MAX;
+	for (int i = cellStart[cell]; i < cellStart[cell + 1]; i++) {
+		const COLOR3& p = palette[candidates[i]];
+		int dr = c.r - p.r;
+		int dg = c.g - p.g;
+		int db = c.b - p.b;
+		int dist = dr * dr + dg * dg + db * db;
+		if (dist < bestDist) {
+			bestDist = dist;
+			best = candidates[i];
+		}
+	}
+
+	return best;
+}
+
+uint32_t PaletteLookup::hashSlot(uint32_t key) {
+	return (key * 2654435761u) >> (32 - HASH_BITS);
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include "colors.h"
+#include <vector>
+
+// Maps colors to indexes in a palette of up to 256 colors. Colors in the palette are found with a hash
+// lookup. Other colors are mapped to the nearest palette color, searching only the palette entries that
+// can be nearest to any color in the same cell of a coarse grid over RGB space.
+class PaletteLookup
+{
+public:
+	PaletteLookup(const COLOR3* palette, int count);
+
+	// returns the index of the first palette entry with the given color, or the nearest entry by
+	// distance in RGB space (lowest index on ties). Returns 0 for an empty palette.
+	uint8_t find(COLOR3 c) const;
+
+	// maps count colors to palette indexes
+	void findAll(const COLOR3* colors, uint8_t* indexes, int count) const;
+
+private:
+	static const int HASH_BITS = 10; // 4x the largest palette, to keep probe chains short
+	static const int HASH_SIZE = 1 << HASH_BITS;
+	static const int GRID_SHIFT = 5; // 8x8x8 cells
+	static const int GRID_DIM = 256 >> GRID_SHIFT;
+
+	COLOR3 palette[256];
+	int count;
+
+	uint32_t hashKeys[HASH_SIZE]; // packed color + 1, or 0 if the slot is empty
+	uint8_t hashValues[HASH_SIZE];
+
+	// candidate palette indexes for each grid cell, in ascending order
+	std::vector<uint8_t> candidates;
+	int cellStart[GRID_DIM * GRID_DIM * GRID_DIM + 1];
+
+	// returns -1 if the color isn't in the palette
+	int findExact(COLOR3 c) const;
+	uint8_t findNearest(COLOR3 c) const;
+
+	static uint32_t hashSlot(uint32_t key);
+};
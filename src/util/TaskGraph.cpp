@@ -0,0 +1,198 @@
+#include "TaskGraph.h"
+#include "util.h"
+#include "globals.h"
+#include <chrono>
+#include <condition_variable>
+#include <algorithm>
+#include <set>
+#include <thread>
+#include <mutex>
+
+using namespace std::chrono;
+
+int TaskGraph::add(std::string name, std::function<void()> func, std::vector<int> deps, size_t cost) {
+	Task task;
+	task.name = name;
+	task.func = func;
+	for (int dep : deps) {
+		if (dep >= 0) {
+			task.deps.push_back(dep);
+		}
+	}
+	task.waitingFor = 0;
+	task.cost = cost;
+	task.startTime = 0;
+	task.endTime = 0;
+	tasks.push_back(task);
+
+	return tasks.size() - 1;
+}
+
+void TaskGraph::run(int threadCount, size_t budget) {
+	for (int i = 0; i < tasks.size(); i++) {
+		tasks[i].dependents.clear();
+	}
+	for (int i = 0; i < tasks.size(); i++) {
+		tasks[i].waitingFor = tasks[i].deps.size();
+		for (int dep : tasks[i].deps) {
+			tasks[dep].dependents.push_back(i);
+		}
+	}
+
+	steady_clock::time_point begin = steady_clock::now();
+	auto elapsed = [begin]() {
+		return duration<double>(steady_clock::now() - begin).count();
+	};
+
+	if (threadCount <= 1 || tasks.size() <= 1) {
+		for (int i = 0; i < tasks.size(); i++) {
+			tasks[i].startTime = elapsed();
+			tasks[i].func();
+			tasks[i].endTime = elapsed();
+		}
+		totalTime = elapsed();
+		return;
+	}
+
+	std::mutex lock;
+	std::condition_variable cv;
+	std::set<int> ready; // lowest ids are started first
+	std::vector<int> finishOrder;
+	int finished = 0;
+	int running = 0;
+	size_t runningCost = 0;
+	int taskCount = tasks.size();
+
+	// returns the first ready task that fits in the budget, or -1
+	auto next_task = [&]() {
+		for (int idx : ready) {
+			if (budget == 0 || running == 0 || runningCost + tasks[idx].cost <= budget) {
+				return idx;
+			}
+		}
+		return -1;
+	};
+
+	for (int i = 0; i < taskCount; i++) {
+		if (tasks[i].waitingFor == 0) {
+			ready.insert(i);
+		}
+	}
+
+	// worker threads don't inherit the job log, so tasks log to their own buffer instead
+	std::string* jobLog = g_job_log;
+
+	auto worker = [&]() {
+		g_progress.hide = true;
+
+		std::unique_lock<std::mutex> lk(lock);
+		while (true) {
+			cv.wait(lk, [&] { return next_task() != -1 || finished == taskCount; });
+			if (finished == taskCount) {
+				return;
+			}
+
+			int idx = next_task();
+			ready.erase(idx);
+			running++;
+			runningCost += tasks[idx].cost;
+			lk.unlock();
+
+			Task& task = tasks[idx];
+			g_job_log = jobLog ? &task.log : NULL;
+			task.startTime = elapsed();
+			task.func();
+			task.endTime = elapsed();
+			g_job_log = NULL;
+
+			lk.lock();
+			finishOrder.push_back(idx);
+			finished++;
+			running--;
+			runningCost -= task.cost;
+			for (int dependent : task.dependents) {
+				if (--tasks[dependent].waitingFor == 0) {
+					ready.insert(dependent);
+				}
+			}
+			cv.notify_all();
+		}
+	};
+
+	vector<std::thread> threads;
+	for (int i = 0; i < threadCount && i < taskCount; i++) {
+		threads.push_back(std::thread(worker));
+	}
+
+	int ticked = 0;
+	while (ticked < taskCount) {
+		std::vector<int> newFinished;
+		{
+			std::unique_lock<std::mutex> lk(lock);
+			cv.wait(lk, [&] { return finished > ticked; });
+			newFinished.assign(finishOrder.begin() + ticked, finishOrder.end());
+		}
+		for (int idx : newFinished) {
+			// only this thread writes to the job log, so logs from tasks that run at the same time don't mix
+			if (jobLog) {
+				logText(tasks[idx].log);
+				tasks[idx].log.clear();
+			}
+			g_progress.tick();
+			ticked++;
+		}
+	}
+
+	for (int i = 0; i < threads.size(); i++) {
+		threads[i].join();
+	}
+
+	totalTime = elapsed();
+}
+
+void TaskGraph::print_timing() {
+	if (tasks.empty()) {
+		return;
+	}
+
+	logf("    Task                    Start      Time\n");
+	logf("    --------------------  --------  --------\n");
+	for (int i = 0; i < tasks.size(); i++) {
+		Task& task = tasks[i];
+		logf("    %-20s  %7.3fs  %7.3fs\n", task.name.c_str(), task.startTime, task.endTime - task.startTime);
+	}
+
+	// walk back from the last task to finish, through whichever dependency finished last
+	int idx = 0;
+	for (int i = 1; i < tasks.size(); i++) {
+		if (tasks[i].endTime > tasks[idx].endTime) {
+			idx = i;
+		}
+	}
+
+	vector<int> path;
+	while (idx != -1) {
+		path.push_back(idx);
+
+		int lastDep = -1;
+		for (int dep : tasks[idx].deps) {
+			if (lastDep == -1 || tasks[dep].endTime > tasks[lastDep].endTime) {
+				lastDep = dep;
+			}
+		}
+		idx = lastDep;
+	}
+	std::reverse(path.begin(), path.end());
+
+	string pathStr;
+	for (int i = 0; i < path.size(); i++) {
+		pathStr += (i > 0 ? " -> " : "") + tasks[path[i]].name;
+	}
+
+	logf("    Critical path: %s\n", pathStr.c_str());
+	logf("    Total time: %.3fs\n", totalTime);
+}
+
+int TaskGraph::size() {
+	return tasks.size();
+}
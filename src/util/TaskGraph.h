@@ -0,0 +1,45 @@
+#pragma once
+#include <functional>
+#include <string>
+#include <vector>
+
+// Runs a set of tasks on a pool of threads. A task starts once all the tasks it depends on have finished,
+// so tasks that can run at the same time must not touch the same data.
+class TaskGraph
+{
+public:
+	// returns an id for the task. Dependencies must be ids of tasks that were added earlier.
+	// Negative ids are ignored, so tasks that might not have been added can be listed.
+	// cost is an estimate of the resources (e.g. bytes of memory) the task needs while it runs.
+	int add(std::string name, std::function<void()> func, std::vector<int> deps = std::vector<int>(), size_t cost = 0);
+
+	// runs all tasks and waits for them to finish. Progress meters are hidden in worker threads, and the
+	// calling thread's meter ticks once per finished task instead. threadCount <= 1 runs the tasks on the
+	// calling thread, in the order they were added.
+	// If the calling thread has a job log, each task's log is buffered and added to it when the task finishes.
+	// If budget is non-zero, tasks only start while the total cost of running tasks stays within the
+	// budget. A task that costs more than the budget runs when nothing else is running.
+	void run(int threadCount, size_t budget = 0);
+
+	// logs when each task started and how long it took, followed by the chain of dependencies
+	// that determined the total time (the critical path)
+	void print_timing();
+
+	int size();
+
+private:
+	struct Task {
+		std::string name;
+		std::function<void()> func;
+		std::vector<int> deps;
+		std::vector<int> dependents;
+		int waitingFor; // number of unfinished dependencies
+		size_t cost;
+		std::string log; // buffered output, if the calling thread has a job log
+		double startTime;
+		double endTime;
+	};
+
+	std::vector<Task> tasks;
+	double totalTime = 0;
+};
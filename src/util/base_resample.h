@@ -35,6 +35,13 @@
 #include <cstdint>
 #include <memory>
 #include <string>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BASE_RESAMPLE_SSE2
+#include <emmintrin.h>
+#endif
 
 #ifndef __BASE_TYPES_H__
 #define __BASE_TYPES_H__
@@ -765,6 +772,310 @@ bool SampleKernel(uint8* src, uint32 src_width, uint32 src_height,
   return false;
 }
 
+/* The source pixels and weights that one output pixel of a separable pass is
+   made from. The weights only depend on the output coordinate along the pass
+   direction, so they are computed once per output column (or row) rather than
+   once per output pixel. Applying the taps performs the same float operations
+   in the same order as the SampleKernel functions, so the output is identical. */
+struct KernelTaps {
+  uint32 first; /* index of the first tap in the KernelTapList arrays */
+  uint32 count;
+  bool copy; /* the output is the first tap's pixel, unfiltered */
+  bool normalize; /* the weighted sum is divided by the sum of the weights */
+  float32 scale_factor; /* 1 / sum of the weights */
+};
+
+struct KernelTapList {
+  ::std::vector<KernelTaps> outputs;
+  ::std::vector<int32> index; /* source pixel of each tap */
+  ::std::vector<float32> weight;
+};
+
+/* Appends the taps for an output pixel at sub-pixel location f_pos along the
+   pass direction. ratio is the resample factor in that direction. */
+bool ComputeKernelTaps(KernelType type, float32 f_pos, float32 ratio,
+                       uint32 src_size, KernelTapList* list) {
+  KernelTaps taps;
+  taps.first = list->index.size();
+  taps.count = 0;
+  taps.copy = false;
+  taps.normalize = true;
+  taps.scale_factor = 1.0f;
+
+  auto add_tap = [&](int32 index, float32 weight) {
+    list->index.push_back(index);
+    list->weight.push_back(weight);
+    taps.count++;
+  };
+
+  /* the kernel radius and weight function, as in the SampleKernel functions */
+  int32 lo = 0, hi = -1;
+  float32 coeff_b = 0, coeff_c = 0, coeff_a = 0;
+
+  switch (type) {
+    case KernelTypeNearest: {
+      int32 i_pos = (int32)(f_pos + 0.5f);
+      add_tap(clip_range(i_pos, 0, src_size - 1), 1.0f);
+      taps.copy = true;
+      list->outputs.push_back(taps);
+      return true;
+    }
+    case KernelTypeBilinear: {
+      int32 sample = f_pos;
+      float32 f_delta = (float32)f_pos - sample;
+      add_tap(clip_range(sample, 0, src_size - 1), 1.0f - f_delta);
+      add_tap(clip_range(sample + 1, 0, src_size - 1), f_delta);
+      taps.normalize = false;
+      list->outputs.push_back(taps);
+      return true;
+    }
+    case KernelTypeBicubic: coeff_b = 0; coeff_c = 1; break;
+    case KernelTypeCatmull: coeff_b = 0; coeff_c = 0.5; break;
+    case KernelTypeMitchell: coeff_b = 1.0f / 3.0f; coeff_c = 1.0f / 3.0f; break;
+    case KernelTypeCardinal: coeff_b = 0.0f; coeff_c = 0.75f; break;
+    case KernelTypeBSpline: coeff_b = 1; coeff_c = 0; break;
+    case KernelTypeLanczos: coeff_a = 1; break;
+    case KernelTypeLanczos2: coeff_a = 2; break;
+    case KernelTypeLanczos3: coeff_a = 3; break;
+    case KernelTypeLanczos4: coeff_a = 4; break;
+    case KernelTypeLanczos5: coeff_a = 5; break;
+    case KernelTypeAverage:
+    case KernelTypeGaussian: break;
+    default: return false;
+  }
+
+  switch (type) {
+    case KernelTypeLanczos:
+    case KernelTypeLanczos2:
+    case KernelTypeLanczos3:
+    case KernelTypeLanczos4:
+    case KernelTypeLanczos5:
+      lo = -(int32)coeff_a;
+      hi = (int32)coeff_a - 1;
+      break;
+    case KernelTypeAverage:
+      lo = -(int32)(ratio + 1.0f) + 1;
+      hi = ratio + 1.0f;
+      break;
+    case KernelTypeGaussian:
+      lo = -(int32)(ratio + 1.0f);
+      hi = ratio + 1.0f;
+      break;
+    default: /* bicubic */
+      lo = -2;
+      hi = 1;
+      break;
+  }
+
+  float32 sample_count = 0;
+
+  for (int32 i = lo; i <= hi; i++) {
+    int32 i_pos = (int32)f_pos + i;
+
+    if (i_pos < 0 || i_pos > src_size - 1) {
+      continue;
+    }
+
+    float32 distance = fabs((float32)f_pos - i_pos);
+    float32 weight = 0.0f;
+
+    switch (type) {
+      case KernelTypeLanczos:
+      case KernelTypeLanczos2:
+      case KernelTypeLanczos3:
+      case KernelTypeLanczos4:
+      case KernelTypeLanczos5:
+        weight = lanczos_weight(coeff_a, distance);
+        break;
+      case KernelTypeGaussian:
+        weight = gaussian_weight(distance, ratio);
+        break;
+      case KernelTypeAverage:
+        if (ratio >= 1.0) {
+          distance = min(ratio, distance);
+          weight = 1.0f - distance / ratio;
+        } else if (distance >= 0.5f - ratio) {
+          weight = 1.0f - distance;
+        } else {
+          /* the kernel is contained within this source pixel */
+          list->index.resize(taps.first);
+          list->weight.resize(taps.first);
+          taps.count = 0;
+          add_tap(i_pos, 1.0f);
+          taps.copy = true;
+          list->outputs.push_back(taps);
+          return true;
+        }
+        break;
+      default:
+        weight = bicubic_weight(coeff_b, coeff_c, distance);
+        break;
+    }
+
+    add_tap(i_pos, weight);
+    sample_count += weight;
+  }
+
+  taps.scale_factor = 1.0f / sample_count;
+  list->outputs.push_back(taps);
+  return true;
+}
+
+/* Computes the taps for each of the dst_size outputs of a pass. */
+bool ComputeKernelTapList(KernelType type, float32 ratio, uint32 src_size,
+                          uint32 dst_size, KernelTapList* list) {
+  list->outputs.reserve(dst_size);
+  for (uint32 i = 0; i < dst_size; i++) {
+    if (!ComputeKernelTaps(type, (float32)i * ratio, ratio, src_size, list)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Converts a filtered channel value to a pixel byte. */
+inline uint8 FinishSample(const KernelTaps& taps, float32 total) {
+  if (taps.normalize) {
+    return clip_range(taps.scale_factor * total, 0, 255);
+  }
+  return total;
+}
+
+/* Filters each row of src horizontally into dst, which has the same height. */
+void ResampleRows(uint8* src, uint32 src_width, uint8* dst, uint32 dst_width,
+                  uint32 height, const KernelTapList& list) {
+#ifdef BASE_RESAMPLE_SSE2
+  /* pixels of the current row as 4 floats each, so a pixel's channels are
+     filtered together */
+  ::std::unique_ptr<float32[]> row(new float32[4 * src_width]);
+#endif
+
+  for (uint32 j = 0; j < height; j++) {
+    uint8* src_row = BLOCK_OFFSET_RGB24(src, src_width, 0, j);
+    uint8* dst_row = BLOCK_OFFSET_RGB24(dst, dst_width, 0, j);
+
+#ifdef BASE_RESAMPLE_SSE2
+    for (uint32 i = 0; i < src_width; i++) {
+      row[i * 4 + 0] = src_row[i * 3 + 0];
+      row[i * 4 + 1] = src_row[i * 3 + 1];
+      row[i * 4 + 2] = src_row[i * 3 + 2];
+      row[i * 4 + 3] = 0;
+    }
+#endif
+
+    for (uint32 i = 0; i < dst_width; i++) {
+      const KernelTaps& taps = list.outputs[i];
+      const int32* index = &list.index[taps.first];
+      const float32* weight = &list.weight[taps.first];
+      uint8* output = dst_row + 3 * i;
+
+      if (taps.copy) {
+        memcpy(output, src_row + 3 * index[0], 3);
+        continue;
+      }
+
+#ifdef BASE_RESAMPLE_SSE2
+      __m128 total = _mm_setzero_ps();
+      for (uint32 k = 0; k < taps.count; k++) {
+        __m128 pixel = _mm_loadu_ps(&row[index[k] * 4]);
+        total = _mm_add_ps(total, _mm_mul_ps(pixel, _mm_set1_ps(weight[k])));
+      }
+      if (taps.normalize) {
+        total = _mm_mul_ps(_mm_set1_ps(taps.scale_factor), total);
+      }
+
+      /* truncate, then saturate to 0-255 like clip_range */
+      __m128i result = _mm_cvttps_epi32(total);
+      result = _mm_packs_epi32(result, result);
+      result = _mm_packus_epi16(result, result);
+      uint32 packed = _mm_cvtsi128_si32(result);
+      output[0] = packed;
+      output[1] = packed >> 8;
+      output[2] = packed >> 16;
+#else
+      float32 total_samples[3] = {0};
+      for (uint32 k = 0; k < taps.count; k++) {
+        uint8* src_pixel = src_row + 3 * index[k];
+        total_samples[0] += src_pixel[0] * weight[k];
+        total_samples[1] += src_pixel[1] * weight[k];
+        total_samples[2] += src_pixel[2] * weight[k];
+      }
+      output[0] = FinishSample(taps, total_samples[0]);
+      output[1] = FinishSample(taps, total_samples[1]);
+      output[2] = FinishSample(taps, total_samples[2]);
+#endif
+    }
+  }
+}
+
+/* Filters src vertically into dst. Every channel of every pixel in an output
+   row uses the same taps, so rows are filtered as flat arrays of bytes. */
+void ResampleColumns(uint8* src, uint32 width, uint8* dst, uint32 dst_height,
+                     const KernelTapList& list) {
+  uint32 row_bytes = 3 * width;
+
+  for (uint32 j = 0; j < dst_height; j++) {
+    const KernelTaps& taps = list.outputs[j];
+    const int32* index = &list.index[taps.first];
+    const float32* weight = &list.weight[taps.first];
+    uint8* dst_row = dst + row_bytes * j;
+
+    if (taps.copy) {
+      memcpy(dst_row, src + row_bytes * index[0], row_bytes);
+      continue;
+    }
+
+    uint32 x = 0;
+
+#ifdef BASE_RESAMPLE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 16 <= row_bytes; x += 16) {
+      __m128 total[4] = {_mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps(),
+                         _mm_setzero_ps()};
+
+      for (uint32 k = 0; k < taps.count; k++) {
+        __m128i bytes =
+            _mm_loadu_si128((const __m128i*)(src + row_bytes * index[k] + x));
+        __m128i lo16 = _mm_unpacklo_epi8(bytes, zero);
+        __m128i hi16 = _mm_unpackhi_epi8(bytes, zero);
+        __m128 pixels[4] = {
+            _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo16, zero)),
+            _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo16, zero)),
+            _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi16, zero)),
+            _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi16, zero))};
+        __m128 w = _mm_set1_ps(weight[k]);
+
+        for (int32 n = 0; n < 4; n++) {
+          total[n] = _mm_add_ps(total[n], _mm_mul_ps(pixels[n], w));
+        }
+      }
+
+      if (taps.normalize) {
+        __m128 scale = _mm_set1_ps(taps.scale_factor);
+        for (int32 n = 0; n < 4; n++) {
+          total[n] = _mm_mul_ps(scale, total[n]);
+        }
+      }
+
+      /* truncate, then saturate to 0-255 like clip_range */
+      __m128i lo = _mm_packs_epi32(_mm_cvttps_epi32(total[0]),
+                                   _mm_cvttps_epi32(total[1]));
+      __m128i hi = _mm_packs_epi32(_mm_cvttps_epi32(total[2]),
+                                   _mm_cvttps_epi32(total[3]));
+      _mm_storeu_si128((__m128i*)(dst_row + x), _mm_packus_epi16(lo, hi));
+    }
+#endif
+
+    for (; x < row_bytes; x++) {
+      float32 total = 0;
+      for (uint32 k = 0; k < taps.count; k++) {
+        total += src[row_bytes * index[k] + x] * weight[k];
+      }
+      dst_row[x] = FinishSample(taps, total);
+    }
+  }
+}
+
 /* Resamples a 24 bit RGB image using a bilinear, bicubic, or lanczos filter. */
 bool ResampleImage24(uint8* src, uint32 src_width, uint32 src_height,
                      uint8* dst, uint32 dst_width, uint32 dst_height,
@@ -827,44 +1138,21 @@ bool ResampleImage24(uint8* src, uint32 src_width, uint32 src_height,
   float32 v_ratio =
       (1 == dst_height ? 1.0f : ((float32)src_height - 1) / (dst_height - 1));
 
-  /* horizontal sampling first. */
-  for (uint32 j = 0; j < src_height; j++)
-    for (uint32 i = 0; i < dst_width; i++) {
-      uint8* output = BLOCK_OFFSET_RGB24(buffer.get(), dst_width, i, j);
-
-      /* Determine the sub-pixel location of our *target* (i,j) coordinate, in
-         the space of our source image. */
-      float32 f_x = (float32)i * h_ratio;
-      float32 f_y = (float32)j;
-
-      if (!SampleKernel(src, src_width, src_height, KernelDirectionHorizontal,
-                        f_x, f_y, type, h_ratio, v_ratio, output)) {
-        if (errors) {
-          *errors = "Failure during horizontal resample operation.";
-        }
-        return false;
-      }
+  /* compute the filter taps for each output column and row */
+  KernelTapList h_taps, v_taps;
+  if (!ComputeKernelTapList(type, h_ratio, src_width, dst_width, &h_taps) ||
+      !ComputeKernelTapList(type, v_ratio, src_height, dst_height, &v_taps)) {
+    if (errors) {
+      *errors = "Unsupported kernel type passed to ResampleImage24.";
     }
+    return false;
+  }
+
+  /* horizontal sampling first. */
+  ResampleRows(src, src_width, buffer.get(), dst_width, src_height, h_taps);
 
   /* vertical sampling next. */
-  for (uint32 j = 0; j < dst_height; j++)
-    for (uint32 i = 0; i < dst_width; i++) {
-      uint8* output = BLOCK_OFFSET_RGB24(dst, dst_width, i, j);
-
-      /* Determine the sub-pixel location of our *target* (i,j) coordinate, in
-         the space of our temp image. */
-      float32 f_x = (float32)i;
-      float32 f_y = (float32)j * v_ratio;
-
-      if (!SampleKernel(buffer.get(), dst_width, src_height,
-                        KernelDirectionVertical, f_x, f_y, type, h_ratio,
-                        v_ratio, output)) {
-        if (errors) {
-          *errors = "Failure during vertical resample operation.";
-        }
-        return false;
-      }
-    }
+  ResampleColumns(buffer.get(), dst_width, dst, dst_height, v_taps);
 
   return true;
 }
@@ -259,6 +259,23 @@ bool lzmaCompress(std::string inPath, std::string outPath, uint32_t preset) {
 	return success;
 }
 
+bool lzmaCompressMemory(const uint8_t* data, size_t dataLen, vector<uint8_t>& outBytes, uint32_t preset) {
+	outBytes.resize(lzma_stream_buffer_bound(dataLen));
+	size_t outPos = 0;
+
+	lzma_ret ret = lzma_easy_buffer_encode(preset, LZMA_CHECK_CRC32, NULL, data, dataLen,
+		&outBytes[0], &outPos, outBytes.size());
+
+	if (ret != LZMA_OK) {
+		logf("lzma encoder error (error code %u)\n", ret);
+		outBytes.clear();
+		return false;
+	}
+
+	outBytes.resize(outPos);
+	return true;
+}
+
 static bool
 init_decoder(lzma_stream* strm)
 {
@@ -6,4 +6,7 @@
 
 bool lzmaCompress(std::string inPath, std::string outPath, uint32_t preset);
 
+// compresses a buffer into the .xz format. Low presets are much faster and still compress well.
+bool lzmaCompressMemory(const uint8_t* data, size_t dataLen, std::vector<uint8_t>& outBytes, uint32_t preset);
+
 bool lzmaDecompress(uint8_t* compressedData, int compressedDataLen, std::vector<uint8_t>& outBytes);
\ No newline at end of file
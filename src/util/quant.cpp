@@ -3,130 +3,475 @@
 //
 
 #include "quant.h"
-#include <iostream>
 #include <vector>
-#include <cmath>
 #include <cstdint>
-#include <limits>
 #include <algorithm>
-#include <cfloat>
+#include <thread>
+#include <unordered_set>
+#include <unordered_map>
 
-float color_distance(const COLOR3& c1, const COLOR3& c2) {
-    return std::sqrt(
-        (c1.r - c2.r) * (c1.r - c2.r) +
-        (c1.g - c2.g) * (c1.g - c2.g) +
-        (c1.b - c2.b) * (c1.b - c2.b));
-}
+// Colors are counted in a histogram with 6 bits per channel, and boxes of histogram cells are split
+// until there are enough boxes for the palette. Palette colors are the average of the full 8-bit
+// colors of the pixels in each box.
+#define HIST_BITS 6
+#define HIST_DIM (1 << HIST_BITS)
+#define HIST_SHIFT (8 - HIST_BITS)
+#define HIST_SIZE (HIST_DIM * HIST_DIM * HIST_DIM)
 
-COLOR3 average_color(const std::vector<COLOR3>& colors) {
-    if (colors.empty()) return COLOR3(0, 0, 0);
+// passes that move palette colors to the average of their nearest pixels
+#define REFINE_PASSES 2
 
-    uint64_t r_sum = 0, g_sum = 0, b_sum = 0;
-    for (const auto& c : colors) {
-        r_sum += c.r;
-        g_sum += c.g;
-        b_sum += c.b;
-    }
+// images smaller than this are processed on one thread
+#define PARALLEL_PIXELS (256 * 256)
+
+inline int hist_index(int r, int g, int b) {
+    return (r * HIST_DIM + g) * HIST_DIM + b;
+}
 
-    size_t count = colors.size();
-    return COLOR3(r_sum / count, g_sum / count, b_sum / count);
+inline int hist_index(const COLOR3& c) {
+    return hist_index(c.r >> HIST_SHIFT, c.g >> HIST_SHIFT, c.b >> HIST_SHIFT);
 }
 
+// a histogram cell that contains colors
+struct Cell {
+    uint8_t v[3];
+    uint32_t count;
+};
+
+// A box of histogram cells. The box owns a range of the cell list, so splitting it only has to
+// look at the cells that contain colors.
 struct Box {
-    std::vector<COLOR3> colors;
-    char split_channel;
-    int range;
+    int begin, end;
+    int lo[3];
+    int hi[3]; // inclusive
+    uint64_t count;
+    double error; // sum of squared distances of the box's colors from their mean
+    int split_channel; // channel with the largest variance
 
-    Box(std::vector<COLOR3>&& input) : colors(std::move(input)) {
-        compute_range_and_channel();
+    Box(const std::vector<Cell>& cells, int begin, int end) : begin(begin), end(end) {
+        update(cells);
     }
 
-    void compute_range_and_channel() {
-        if (colors.empty()) {
-            split_channel = 'r';
-            range = 0;
+    // finds the bounds of the box and measures the spread of its colors
+    void update(const std::vector<Cell>& cells) {
+        double sum[3] = { 0, 0, 0 };
+        double sumSq[3] = { 0, 0, 0 };
+        count = 0;
+
+        for (int c = 0; c < 3; c++) {
+            lo[c] = HIST_DIM;
+            hi[c] = -1;
+        }
+
+        for (int i = begin; i < end; i++) {
+            const Cell& cell = cells[i];
+            count += cell.count;
+            for (int c = 0; c < 3; c++) {
+                int v = cell.v[c];
+                lo[c] = std::min(lo[c], v);
+                hi[c] = std::max(hi[c], v);
+                sum[c] += (double)cell.count * v;
+                sumSq[c] += (double)cell.count * v * v;
+            }
+        }
+
+        error = 0;
+        split_channel = 0;
+        if (!count)
             return;
+
+        double bestVariance = -1;
+        for (int c = 0; c < 3; c++) {
+            double variance = sumSq[c] - sum[c] * sum[c] / count;
+            error += variance;
+            if (variance > bestVariance && hi[c] > lo[c]) {
+                bestVariance = variance;
+                split_channel = c;
+            }
+        }
+    }
+
+    bool can_split() const {
+        return end - begin > 1;
+    }
+
+    // splits the channel with the largest variance where the two halves have the smallest total
+    // variance along it. This box becomes the lower half.
+    Box split(std::vector<Cell>& cells) {
+        int c = split_channel;
+        std::sort(cells.begin() + begin, cells.begin() + end, [c](const Cell& a, const Cell& b) {
+            return a.v[c] < b.v[c];
+        });
+
+        double totalSum = 0, totalSq = 0;
+        for (int i = begin; i < end; i++) {
+            double v = cells[i].v[c];
+            totalSum += cells[i].count * v;
+            totalSq += cells[i].count * v * v;
+        }
+
+        // first cell of the upper half. Cells with the same value stay on the same side.
+        int mid = begin + 1;
+        double bestError = -1;
+        double n = 0, sum = 0, sq = 0;
+        for (int i = begin; i < end - 1; i++) {
+            double v = cells[i].v[c];
+            n += cells[i].count;
+            sum += cells[i].count * v;
+            sq += cells[i].count * v * v;
+            if (cells[i + 1].v[c] == cells[i].v[c])
+                continue;
+
+            double upperN = count - n;
+            double upperSum = totalSum - sum;
+            double err = (sq - sum * sum / n) + ((totalSq - sq) - upperSum * upperSum / upperN);
+            if (bestError < 0 || err < bestError) {
+                bestError = err;
+                mid = i + 1;
+            }
+        }
+
+        Box upper(cells, mid, end);
+        end = mid;
+        update(cells);
+
+        return upper;
+    }
+};
+
+// runs func(start, end, thread) over the pixel range, split across threads for large images.
+// thread is the index of the calling thread, for writing to per-thread results.
+template<typename F>
+void for_pixel_ranges(int pixel_count, int thread_count, F func) {
+    if (thread_count <= 1) {
+        func(0, pixel_count, 0);
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    int chunk = (pixel_count + thread_count - 1) / thread_count;
+    for (int t = 0; t < thread_count; t++) {
+        int start = t * chunk;
+        int end = std::min(pixel_count, start + chunk);
+        threads.push_back(std::thread(func, start, end, t));
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+}
+
+// Finds the nearest palette color for pixels, using the histogram cells as an inverse palette table.
+// Each cell that contains colors lists the palette entries that can be nearest to a color in the cell,
+// which is usually only a few.
+struct InversePalette {
+    const std::vector<COLOR3>& palette;
+    std::vector<int> cellStart; // candidates for cell i are cellStart[i*2] to cellStart[i*2+1]
+    std::vector<uint8_t> candidates;
+
+    InversePalette(const std::vector<COLOR3>& palette, const std::vector<uint32_t>& hist, int thread_count)
+        : palette(palette), cellStart(HIST_SIZE * 2, 0) {
+        // Candidates are first found for a coarse grid. A color that can't be nearest to anything in a
+        // coarse cell can't be nearest to anything in the histogram cells inside it, so only the coarse
+        // candidates are checked for each histogram cell.
+        const int coarseShift = 4;
+        const int coarseDim = 256 >> coarseShift;
+        std::vector<uint8_t> allColors(palette.size());
+        for (int i = 0; i < palette.size(); i++) {
+            allColors[i] = i;
+        }
+
+        // only coarse cells that contain colors are needed
+        std::vector<bool> coarseUsed(coarseDim * coarseDim * coarseDim, false);
+        for (int cell = 0; cell < HIST_SIZE; cell++) {
+            if (hist[cell]) {
+                coarseUsed[coarse_index(cell, coarseShift)] = true;
+            }
+        }
+
+        std::vector<std::vector<uint8_t>> coarse(coarseDim * coarseDim * coarseDim);
+        for (int cell = 0; cell < coarse.size(); cell++) {
+            if (!coarseUsed[cell])
+                continue;
+            int lo[3] = {
+                (cell / (coarseDim * coarseDim)) << coarseShift,
+                ((cell / coarseDim) % coarseDim) << coarseShift,
+                (cell % coarseDim) << coarseShift
+            };
+            find_candidates(lo, 1 << coarseShift, allColors, coarse[cell]);
         }
 
-        uint8_t r_min = 255, r_max = 0;
-        uint8_t g_min = 255, g_max = 0;
-        uint8_t b_min = 255, b_max = 0;
+        // each thread lists the candidates for its own range of cells, then the lists are joined
+        std::vector<std::vector<uint8_t>> lists(thread_count);
+        std::vector<int> rangeStart(thread_count, 0), rangeEnd(thread_count, 0);
 
-        for (const auto& c : colors) {
-            r_min = std::min(r_min, c.r); r_max = std::max(r_max, c.r);
-            g_min = std::min(g_min, c.g); g_max = std::max(g_max, c.g);
-            b_min = std::min(b_min, c.b); b_max = std::max(b_max, c.b);
+        for_pixel_ranges(HIST_SIZE, thread_count, [&](int start, int end, int t) {
+            std::vector<uint8_t>& list = lists[t];
+            rangeStart[t] = start;
+            rangeEnd[t] = end;
+
+            for (int cell = start; cell < end; cell++) {
+                if (!hist[cell])
+                    continue;
+
+                int lo[3] = {
+                    (cell >> (HIST_BITS * 2)) << HIST_SHIFT,
+                    ((cell >> HIST_BITS) & (HIST_DIM - 1)) << HIST_SHIFT,
+                    (cell & (HIST_DIM - 1)) << HIST_SHIFT
+                };
+                cellStart[cell * 2] = list.size();
+                find_candidates(lo, 1 << HIST_SHIFT, coarse[coarse_index(cell, coarseShift)], list);
+                cellStart[cell * 2 + 1] = list.size();
+            }
+        });
+
+        for (int t = 0; t < thread_count; t++) {
+            int offset = candidates.size();
+            candidates.insert(candidates.end(), lists[t].begin(), lists[t].end());
+            for (int i = rangeStart[t] * 2; i < rangeEnd[t] * 2; i++) {
+                cellStart[i] += offset;
+            }
         }
+    }
+
+    // returns the cell of a coarser grid that contains the histogram cell
+    static int coarse_index(int cell, int coarseShift) {
+        int shift = coarseShift - HIST_SHIFT;
+        int coarseBits = 8 - coarseShift;
+        int r = (cell >> (HIST_BITS * 2)) >> shift;
+        int g = ((cell >> HIST_BITS) & (HIST_DIM - 1)) >> shift;
+        int b = (cell & (HIST_DIM - 1)) >> shift;
+        return (((r << coarseBits) | g) << coarseBits) | b;
+    }
 
-        int r_range = r_max - r_min;
-        int g_range = g_max - g_min;
-        int b_range = b_max - b_min;
+    // appends the colors from the given list that can be nearest to some color in the cube starting at lo.
+    // A color can only be nearest if its distance to the closest point of the cube is no larger than
+    // the smallest distance any color has to the cube's farthest point.
+    void find_candidates(const int lo[3], int size, const std::vector<uint8_t>& colors, std::vector<uint8_t>& out) const {
+        int minDist[256];
+        int bestMax = INT32_MAX;
 
-        if (r_range >= g_range && r_range >= b_range) {
-            split_channel = 'r';
-            range = r_range;
+        for (int i = 0; i < colors.size(); i++) {
+            const COLOR3& p = palette[colors[i]];
+            int v[3] = { p.r, p.g, p.b };
+            int minD = 0, maxD = 0;
+            for (int c = 0; c < 3; c++) {
+                int hi = lo[c] + size - 1;
+                int nearD = v[c] < lo[c] ? lo[c] - v[c] : (v[c] > hi ? v[c] - hi : 0);
+                int farD = std::max(v[c] - lo[c], hi - v[c]);
+                minD += nearD * nearD;
+                maxD += farD * farD;
+            }
+            minDist[i] = minD;
+            bestMax = std::min(bestMax, maxD);
         }
-        else if (g_range >= r_range && g_range >= b_range) {
-            split_channel = 'g';
-            range = g_range;
+
+        for (int i = 0; i < colors.size(); i++) {
+            if (minDist[i] <= bestMax)
+                out.push_back(colors[i]);
         }
-        else {
-            split_channel = 'b';
-            range = b_range;
+    }
+
+    // returns the first palette index with the smallest distance to the color. The color's cell must
+    // contain colors in the histogram the table was built from.
+    int find(const COLOR3& c) const {
+        int cell = hist_index(c);
+        const uint8_t* list = candidates.data();
+
+        int best = 0;
+        int bestDist = INT32_MAX;
+        for (int i = cellStart[cell * 2]; i < cellStart[cell * 2 + 1]; i++) {
+            const COLOR3& p = palette[list[i]];
+            int dr = c.r - p.r;
+            int dg = c.g - p.g;
+            int db = c.b - p.b;
+            int dist = dr * dr + dg * dg + db * db;
+            if (dist < bestDist) {
+                bestDist = dist;
+                best = list[i];
+            }
         }
+
+        return best;
     }
 };
 
-bool sort_r(const COLOR3& a, const COLOR3& b) { return a.r < b.r; }
-bool sort_g(const COLOR3& a, const COLOR3& b) { return a.g < b.g; }
-bool sort_b(const COLOR3& a, const COLOR3& b) { return a.b < b.b; }
+std::vector<COLOR3> median_cut_quantize(COLOR3* pixels, int pixel_count, int k, int max_threads) {
+    k = std::min(k, 256); // palette lookups are limited to 8-bit indexes
+    if (pixel_count <= 0 || k <= 0) {
+        return std::vector<COLOR3>();
+    }
+
+    // images with few enough colors are used as-is
+    std::unordered_set<COLOR3> uniqueColors;
+    for (int i = 0; i < pixel_count && (int)uniqueColors.size() <= k; i++) {
+        uniqueColors.insert(pixels[i]);
+    }
+    if ((int)uniqueColors.size() <= k) {
+        return std::vector<COLOR3>(uniqueColors.begin(), uniqueColors.end());
+    }
+
+    if (max_threads <= 0) {
+        max_threads = std::thread::hardware_concurrency();
+    }
+
+    int thread_count = 1;
+    if (pixel_count >= PARALLEL_PIXELS) {
+        thread_count = std::max(1, std::min(max_threads, pixel_count / (PARALLEL_PIXELS / 4)));
+    }
+
+    // count colors into one histogram per thread, then merge them
+    std::vector<std::vector<uint32_t>> hists(thread_count);
+    for_pixel_ranges(pixel_count, thread_count, [&](int start, int end, int t) {
+        std::vector<uint32_t>& hist = hists[t];
+        hist.resize(HIST_SIZE, 0);
+        for (int i = start; i < end; i++) {
+            hist[hist_index(pixels[i])]++;
+        }
+    });
+
+    std::vector<uint32_t>& hist = hists[0];
+    for (int t = 1; t < thread_count; t++) {
+        for (int i = 0; i < HIST_SIZE; i++) {
+            hist[i] += hists[t][i];
+        }
+    }
+
+    std::vector<Cell> cells;
+    for (int i = 0; i < HIST_SIZE; i++) {
+        if (hist[i]) {
+            Cell cell;
+            cell.v[0] = i >> (HIST_BITS * 2);
+            cell.v[1] = (i >> HIST_BITS) & (HIST_DIM - 1);
+            cell.v[2] = i & (HIST_DIM - 1);
+            cell.count = hist[i];
+            cells.push_back(cell);
+        }
+    }
 
-// Median Cut Quantization using cached range data
-std::vector<COLOR3> median_cut_quantize(COLOR3* pixels, int pixel_count, int k) {
     std::vector<Box> boxes;
-    boxes.emplace_back(std::vector<COLOR3>(pixels, pixels + pixel_count));
+    boxes.push_back(Box(cells, 0, cells.size()));
 
-    while (boxes.size() < k) {
-        // Find box with largest range
-        auto it = std::max_element(boxes.begin(), boxes.end(), [](const Box& a, const Box& b) {
-            return a.range < b.range;
-        });
+    while ((int)boxes.size() < k) {
+        // split the box whose colors are furthest from their average
+        int best = -1;
+        for (int i = 0; i < boxes.size(); i++) {
+            if (boxes[i].can_split() && (best == -1 || boxes[i].error > boxes[best].error)) {
+                best = i;
+            }
+        }
 
-        if (it == boxes.end() || it->colors.size() <= 1)
+        if (best == -1)
             break;
 
-        char channel = it->split_channel;
-        switch (channel) {
-            case 'r': std::sort(it->colors.begin(), it->colors.end(), sort_r); break;
-            case 'g': std::sort(it->colors.begin(), it->colors.end(), sort_g); break;
-            case 'b': std::sort(it->colors.begin(), it->colors.end(), sort_b); break;
+        Box upper = boxes[best].split(cells);
+        boxes.push_back(upper);
+    }
+
+    // average the pixels that fall into each box
+    std::vector<uint8_t> cellBox(HIST_SIZE, 0);
+    for (int i = 0; i < boxes.size(); i++) {
+        for (int k = boxes[i].begin; k < boxes[i].end; k++) {
+            const Cell& cell = cells[k];
+            cellBox[hist_index(cell.v[0], cell.v[1], cell.v[2])] = i;
         }
+    }
 
-        size_t mid = it->colors.size() / 2;
-        std::vector<COLOR3> lower(it->colors.begin(), it->colors.begin() + mid);
-        std::vector<COLOR3> upper(it->colors.begin() + mid, it->colors.end());
+    std::vector<std::vector<uint64_t>> sums(thread_count);
+    for_pixel_ranges(pixel_count, thread_count, [&](int start, int end, int t) {
+        std::vector<uint64_t>& sum = sums[t];
+        sum.resize(boxes.size() * 3, 0);
+        for (int i = start; i < end; i++) {
+            const COLOR3& c = pixels[i];
+            uint64_t* boxSum = &sum[cellBox[hist_index(c)] * 3];
+            boxSum[0] += c.r;
+            boxSum[1] += c.g;
+            boxSum[2] += c.b;
+        }
+    });
 
-        *it = Box(std::move(lower));
-        boxes.emplace_back(std::move(upper));
+    std::vector<COLOR3> palette;
+    for (int i = 0; i < boxes.size(); i++) {
+        uint64_t total[3] = { 0, 0, 0 };
+        for (int t = 0; t < thread_count; t++) {
+            for (int c = 0; c < 3; c++) {
+                total[c] += sums[t][i * 3 + c];
+            }
+        }
+        uint64_t count = std::max(boxes[i].count, (uint64_t)1);
+        palette.push_back(COLOR3(total[0] / count, total[1] / count, total[2] / count));
     }
 
-    std::vector<COLOR3> palette;
-    for (const Box& box : boxes)
-        palette.push_back(average_color(box.colors));
+    // Boxes can't be split smaller than a histogram cell, so images with few cells can leave palette
+    // slots unused. Those are given the colors that are furthest from the palette.
+    if ((int)palette.size() < k) {
+        InversePalette lookup(palette, hist, thread_count);
+        std::unordered_map<COLOR3, int> colorError;
+        for (int i = 0; i < pixel_count; i++) {
+            const COLOR3& c = pixels[i];
+            if (colorError.count(c))
+                continue;
+            const COLOR3& p = palette[lookup.find(c)];
+            int dr = c.r - p.r;
+            int dg = c.g - p.g;
+            int db = c.b - p.b;
+            colorError[c] = dr * dr + dg * dg + db * db;
+        }
 
-    // quantize the image
-    for (int i = 0; i < pixel_count; ++i) {
-        float min_dist = FLT_MAX;
-        int best = 0;
-        for (int j = 0; j < palette.size(); ++j) {
-            float d = color_distance(pixels[i], palette[j]);
-            if (d < min_dist) {
-                min_dist = d;
-                best = j;
+        std::vector<std::pair<int, COLOR3>> worst;
+        for (auto it = colorError.begin(); it != colorError.end(); ++it) {
+            if (it->second > 0)
+                worst.push_back(std::make_pair(it->second, it->first));
+        }
+        std::sort(worst.begin(), worst.end(), [](const std::pair<int, COLOR3>& a, const std::pair<int, COLOR3>& b) {
+            if (a.first != b.first)
+                return a.first > b.first;
+            return (a.second.r << 16 | a.second.g << 8 | a.second.b) < (b.second.r << 16 | b.second.g << 8 | b.second.b);
+        });
+
+        for (int i = 0; i < worst.size() && (int)palette.size() < k; i++) {
+            palette.push_back(worst[i].second);
+        }
+    }
+
+    // move each palette color to the average of the pixels that are nearest to it, which fixes
+    // colors that were split into the wrong box by the coarse histogram cells
+    for (int iter = 0; iter < REFINE_PASSES; iter++) {
+        InversePalette lookup(palette, hist, thread_count);
+
+        std::vector<std::vector<uint64_t>> sums(thread_count);
+        for_pixel_ranges(pixel_count, thread_count, [&](int start, int end, int t) {
+            std::vector<uint64_t>& sum = sums[t];
+            sum.resize(palette.size() * 4, 0);
+            for (int i = start; i < end; i++) {
+                const COLOR3& c = pixels[i];
+                uint64_t* colorSum = &sum[lookup.find(c) * 4];
+                colorSum[0] += c.r;
+                colorSum[1] += c.g;
+                colorSum[2] += c.b;
+                colorSum[3]++;
+            }
+        });
+
+        for (int i = 0; i < palette.size(); i++) {
+            uint64_t total[4] = { 0, 0, 0, 0 };
+            for (int t = 0; t < thread_count; t++) {
+                for (int c = 0; c < 4; c++) {
+                    total[c] += sums[t][i * 4 + c];
+                }
+            }
+            if (total[3]) {
+                palette[i] = COLOR3(total[0] / total[3], total[1] / total[3], total[2] / total[3]);
             }
         }
-        pixels[i] = palette[best];
     }
 
+    // quantize the image
+    InversePalette lookup(palette, hist, thread_count);
+    for_pixel_ranges(pixel_count, thread_count, [&](int start, int end, int t) {
+        for (int i = start; i < end; i++) {
+            pixels[i] = palette[lookup.find(pixels[i])];
+        }
+    });
+
     return palette;
 }
@@ -2,4 +2,5 @@
 #include <vector>
 #include <unordered_map>
 
-std::vector<COLOR3> median_cut_quantize(COLOR3* pixels, int pixel_count, int k=256);
\ No newline at end of file
+// max_threads limits the threads used for large images. 0 allows one per core.
+std::vector<COLOR3> median_cut_quantize(COLOR3* pixels, int pixel_count, int k=256, int max_threads=0);
\ No newline at end of file
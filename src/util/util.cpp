@@ -8,6 +8,7 @@
 #include <iostream>
 #include <algorithm>
 #include <float.h>
+#include <thread>
 
 #ifdef WIN32
 #include <Windows.h>
@@ -38,8 +39,19 @@ namespace fs = std::experimental::filesystem;
 
 
 static char log_line[16384];
+static thread_local char job_log_line[16384];
 
 void logf(const char* format, ...) {
+	if (g_job_log) {
+		va_list vl;
+		va_start(vl, format);
+		vsnprintf(job_log_line, 16384, format, vl);
+		va_end(vl);
+
+		g_job_log->append(job_log_line);
+		return;
+	}
+
 	g_log_mutex.lock();
 
 	va_list vl;
@@ -58,6 +70,16 @@ void debugf(const char* format, ...) {
 		return;
 	}
 
+	if (g_job_log) {
+		va_list vl;
+		va_start(vl, format);
+		vsnprintf(job_log_line, 4096, format, vl);
+		va_end(vl);
+
+		g_job_log->append(job_log_line);
+		return;
+	}
+
 	g_log_mutex.lock();
 
 	va_list vl;
@@ -71,6 +93,80 @@ void debugf(const char* format, ...) {
 	g_log_mutex.unlock();
 }
 
+void logText(const string& text) {
+	if (g_job_log) {
+		g_job_log->append(text);
+		return;
+	}
+
+	g_log_mutex.lock();
+
+	fwrite(text.c_str(), 1, text.size(), stdout);
+	g_log_buffer.push_back(text);
+
+	g_log_mutex.unlock();
+}
+
+int getJobThreadCount() {
+	if (g_job_threads > 0) {
+		return g_job_threads;
+	}
+	return std::max(1, (int)std::thread::hardware_concurrency());
+}
+
+// case-sensitive match with * and ? wildcards
+static bool wildcardMatch(const char* pattern, const char* str) {
+	const char* starPattern = NULL;
+	const char* starStr = NULL;
+
+	while (*str) {
+		if (*pattern == '*') {
+			starPattern = pattern++;
+			starStr = str;
+		}
+		else if (*pattern == '?' || *pattern == *str) {
+			pattern++;
+			str++;
+		}
+		else if (starPattern) {
+			pattern = starPattern + 1;
+			str = ++starStr;
+		}
+		else {
+			return false;
+		}
+	}
+
+	while (*pattern == '*')
+		pattern++;
+
+	return *pattern == '\0';
+}
+
+vector<string> getMatchingFiles(string pattern) {
+	vector<string> matches;
+
+	size_t lastSlash = pattern.find_last_of("/\\");
+	string dir = lastSlash != string::npos ? pattern.substr(0, lastSlash + 1) : "";
+	string filePattern = lastSlash != string::npos ? pattern.substr(lastSlash + 1) : pattern;
+
+	std::error_code err;
+	for (fs::directory_iterator it(dir.empty() ? "." : dir, err), end; !err && it != end; it.increment(err)) {
+		if (!fs::is_regular_file(it->status())) {
+			continue;
+		}
+
+		string fname = it->path().filename().string();
+		if (wildcardMatch(filePattern.c_str(), fname.c_str())) {
+			matches.push_back(dir + fname);
+		}
+	}
+
+	sort(matches.begin(), matches.end());
+
+	return matches;
+}
+
 bool fileExists(const string& fileName)
 {
 #ifdef USE_FILESYSTEM
@@ -135,6 +231,18 @@ std::streampos fileSize(const string& filePath) {
 	return fsize;
 }
 
+uint64_t fileModifiedTime(const string& filePath) {
+	std::error_code err;
+	auto time = fs::last_write_time(filePath, err);
+	return err ? 0 : (uint64_t)time.time_since_epoch().count();
+}
+
+bool replaceFile(const string& src, const string& dst) {
+	std::error_code err;
+	fs::rename(src, dst, err);
+	return !err;
+}
+
 vector<string> splitString(string str, const char* delimitters)
 {
 	vector<string> split;
@@ -897,6 +1005,10 @@ void replaceAll(std::string& str, const std::string& from, const std::string& to
 #ifdef WIN32
 void print_color(int colors)
 {
+	if (g_job_log) {
+		return; // console attributes can't be buffered with the job log
+	}
+
 	HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
 	colors = colors ? colors : (FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE);
 	SetConsoleTextAttribute(console, (WORD)colors);
@@ -35,6 +35,15 @@ void logf(const char* format, ...);
 
 void debugf(const char* format, ...);
 
+// log text of any length without formatting
+void logText(const string& text);
+
+// threads the current job should use for parallel work (g_job_threads, or one per core if that's not set)
+int getJobThreadCount();
+
+// returns files matching a wildcard pattern (* and ?). Wildcards are only allowed in the file name.
+vector<string> getMatchingFiles(string pattern);
+
 bool fileExists(const string& fileName);
 
 char* loadFile(const string& fileName, int& length);
@@ -45,6 +54,12 @@ bool removeFile(const string& fileName);
 
 std::streampos fileSize(const string& filePath);
 
+// returns a value that changes whenever the file is written to, or 0 if the file doesn't exist
+uint64_t fileModifiedTime(const string& filePath);
+
+// renames src to dst, replacing dst if it exists
+bool replaceFile(const string& src, const string& dst);
+
 vector<string> splitString(string str, const char* delimitters);
 
 string basename(string path);